@@ -1,2 +1,22 @@
-/Users/joshuayu/VulkanSDK/1.4.309.0/macOS/bin/glslc $1/shader.vert -o $1/shaders/vert.spv
-/Users/joshuayu/VulkanSDK/1.4.309.0/macOS/bin/glslc $1/shader.frag -o $1/shaders/frag.spv
+#!/bin/sh
+# Compiles the GLSL sources in $1 into "$1"/shaders; run by the Xcode "Run Script" build phase before Compile Sources so
+# the SPIR-V always matches the shader interface in main.cpp
+set -e
+
+GLSLC="${VULKAN_SDK:+$VULKAN_SDK/bin/glslc}"
+if [ -z "$GLSLC" ] || [ ! -x "$GLSLC" ]; then
+    GLSLC="$(command -v glslc || true)"
+fi
+if [ -z "$GLSLC" ]; then
+    GLSLC=/Users/joshuayu/VulkanSDK/1.4.309.0/macOS/bin/glslc
+fi
+if [ ! -x "$GLSLC" ]; then
+    echo "error: glslc not found; set VULKAN_SDK or add glslc to PATH" >&2
+    exit 1
+fi
+
+mkdir -p "$1/shaders"
+"$GLSLC" "$1"/shader.vert -o "$1"/shaders/vert.spv
+"$GLSLC" "$1"/shader.vert -DCOMPACT_VERTEX -o "$1"/shaders/vert_compact.spv
+"$GLSLC" "$1"/shader.frag -o "$1"/shaders/frag.spv
+"$GLSLC" "$1"/cull.comp -o "$1"/shaders/cull.spv
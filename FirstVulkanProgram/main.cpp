@@ -21,11 +21,51 @@
 #include <algorithm>
 #include <optional>
 #include <set>
+#include <map>
 #include <limits>
 #include <fstream>
 #include <array>
 #include <chrono>
 #include <unordered_map>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <exception>
+#include <bit>
+#include <numeric>
+#include <cmath>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>  // CPU mip generation
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// x86 builds compile MipGenerator's AVX2 paths with a target attribute and pick them at runtime with cpuHasAvx2(), so the
+// default (SSE2) build uses AVX2 where the CPU has it and still runs where it doesn't
+// - Don't add -mavx2 to the build settings: the compiler may then emit AVX2 anywhere, and the app faults on CPUs without it
+#if defined(__SSE2__) && (defined(__GNUC__) || defined(__clang__))
+#define AVX2_DISPATCH 1
+#define AVX2_TARGET __attribute__((target("avx2")))
+inline bool cpuHasAvx2() {
+#if defined(__AVX2__)
+    return true;
+#else
+    static const bool supported = __builtin_cpu_supports("avx2");
+    return supported;
+#endif
+}
+#endif
+
+#include <sys/mman.h>   // mmap for mesh cache
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 /*
  Linking - General / Runpath Search Paths   for .dylib      same as -Wl,-rpath,
@@ -54,115 +94,4707 @@ const bool SEPARATE_TRANSFER_QUEUE_FAMILY = true;
 #ifdef NDEBUG
     const bool enableValidationLayers = false;
 #else
-    const bool enableValidationLayers = true;
+    const bool enableValidationLayers = true;
+#endif
+
+const std::string SOURCE_PATH = "/Users/joshuayu/Documents/Programming/Vulkan/FirstVulkanProgram/FirstVulkanProgram/";
+const std::string MODEL_PATH = "models/viking_room.obj";
+const std::string MESH_CACHE_PATH = "models/viking_room.meshcache"; // Binary vertices/indices written after the first OBJ parse
+
+const bool MESH_CACHE_ENABLED = true;
+
+const std::string PIPELINE_CACHE_PATH = "shaders/pipeline.cache"; // Driver pipeline cache data, saved at exit and loaded at startup
+const bool PIPELINE_CACHE_ENABLED = true;
+
+const std::string TEXTURE_PATH = "textures/viking_room.png";
+const std::string TEXTURE_CONTAINER_PATH = "textures/viking_room.ktx2"; // Pre-mipped texture baked from TEXTURE_PATH
+const std::string TEXTURE_CONTAINER_BC_PATH = "textures/viking_room_bc.ktx2"; // Block-compressed version, used when the device supports BC formats
+
+const bool CPU_MIPMAPS = false; // Generate mips with MipGenerator instead of GPU blits (automatic when the format can't be linearly blitted)
+const bool KAISER_MIP_FILTER = false; // Kaiser-windowed sinc instead of a 2x2 box for CPU-generated and baked mips
+const bool BENCHMARK_MIP_GENERATION = false; // Report MipGenerator throughput for 1024x1024 and 4096x4096 images at startup
+
+const bool TEXTURE_CONTAINER_ENABLED = true; // Load the KTX2 container (baking it when missing or stale) instead of decoding the PNG and blitting mips
+const bool COMPRESS_TEXTURES = true; // Bake the container as BC1 (opaque) / BC7 (with alpha) when the device can sample BC formats
+const bool BC7_OPAQUE_TEXTURES = false; // Use BC7 (1 byte/texel, higher quality) instead of BC1 (0.5 bytes/texel) for opaque textures too
+const bool STREAM_TEXTURES = true; // Upload only the smallest container mips before the first frame; stream the larger ones in while rendering
+const uint32_t STREAMING_INITIAL_SIZE = 128; // Largest mip dimension uploaded before the first frame when streaming
+const uint64_t STAGING_RING_SIZE = 64ull << 20; // Persistently mapped upload buffer shared by every vertex, index and texture upload
+const uint64_t GEOMETRY_VERTEX_BUFFER_SIZE = 64ull << 20; // Device-local vertex buffer every mesh is sub-allocated from
+const uint64_t GEOMETRY_INDEX_BUFFER_SIZE = 32ull << 20; // Device-local index buffer every mesh is sub-allocated from
+const bool VERIFY_MESH_REMOVAL = false; // At startup, add and remove two small meshes and check the geometry buffer's free ranges coalesce
+const uint64_t DRAW_UNIFORM_RING_SIZE = 4ull << 20; // Per frame in flight; DrawUniforms for every draw of a frame (16384 draws at a 256-byte offset alignment)
+const uint32_t INSTANCE_CAPACITY = 1 << 17; // Per frame in flight; InstanceData (96 bytes) for every instanced draw
+const uint32_t MAX_GPU_DRAWS = 4096; // Per frame in flight; objects the GPU-driven path can cull and draw
+
+const bool PARALLEL_OBJ_PARSER = true; // Parse the OBJ with ParallelObjParser (falls back to tinyobj::LoadObj for unsupported files)
+const bool VERIFY_PARALLEL_OBJ = false; // Also parse with tinyobj::LoadObj and compare the results
+
+const bool COMPACT_VERTICES = true; // Allow the quantized CompactVertex layout (and 16-bit indices) when the mesh permits it
+
+const bool OPTIMIZE_MESH = true; // Reorder triangles/vertices for post-transform cache, overdraw and fetch locality while loading, before the mesh cache is written
+
+const bool GENERATE_LODS = true; // Build a chain of simplified index buffers for the model with MeshSimplifier after optimizeMesh()
+const uint32_t MAX_MESH_LODS = 6; // Levels per mesh, including the full-detail one
+const float LOD_TRIANGLE_RATIO = 0.5f; // Target triangle count of each level relative to the previous one
+const float LOD_MAX_ERROR = 0.05f; // Relative to the mesh extent; no coarser level is generated once simplifying needs more
+const float LOD_PIXEL_ERROR = 1.0f; // Each instance draws the coarsest level whose error projects to at most this many pixels (F6 toggles selection)
+const size_t MIN_LOD_SELECTIONS_PER_THREAD = 16384; // Visible instances per thread when selecting levels on the CPU path
+
+const bool BENCHMARK_VERTEX_WELDING = false; // Compare VertexWelder against std::unordered_map<Vertex, uint32_t> at startup
+
+const std::vector<uint32_t> INSTANCE_GRID_COUNTS = {0, 1024, 16384, 65536}; // Copies of the model drawn instanced (F3 cycles; 0 = the single model)
+const uint32_t INSTANCE_UPDATES_PER_FRAME = 4096; // Grid instances re-oriented each frame (round-robin); only these are copied to the GPU
+const bool BENCHMARK_INSTANCING = false; // Draw grids of INSTANCE_BENCHMARK_COUNTS instances before the main loop and report frame times
+const std::vector<uint32_t> INSTANCE_BENCHMARK_COUNTS = {1, 256, 1024, 4096, 16384, 65536};
+
+const bool GPU_DRIVEN_RENDERING = true; // Cull in a compute pass and draw with one vkCmdDrawIndexedIndirectCount when supported (F4 toggles the CPU path)
+const bool VERIFY_GPU_CULLING = false; // Also cull on the CPU in the GPU-driven path and report frames whose visible counts differ
+
+const bool PARALLEL_COMMAND_RECORDING = true; // Record the CPU path's draws into secondary command buffers on worker threads (F5 toggles)
+const uint32_t MIN_DRAWS_PER_RECORDING_THREAD = 256; // Frames with fewer draws per thread use fewer threads; below two threads' worth, draws are recorded inline
+const bool BENCHMARK_COMMAND_RECORDING = false; // Draw RECORDING_BENCHMARK_DRAW_COUNTS objects before the main loop and report recording times per thread count
+const std::vector<uint32_t> RECORDING_BENCHMARK_DRAW_COUNTS = {1024, 4096, 16384};
+
+const uint32_t SCENE_CAPACITY = 1 << 17; // SceneGraph entities: the turntable, every RenderObject and the instance grid's entities
+const bool BENCHMARK_SCENE_UPDATE = false; // Report SceneGraph::update() times for SCENE_BENCHMARK_ENTITY_COUNT entities at startup
+const uint32_t SCENE_BENCHMARK_ENTITY_COUNT = 100000;
+
+const bool REPORT_CULLING = false; // Print the average visible/culled instance counts per frame once per second
+const bool BENCHMARK_FRUSTUM_CULLING = false; // Report FrustumCuller throughput on millions of random boxes at startup
+
+VkResult CreateDebugUtilsMessengerEXT(VkInstance instance, const VkDebugUtilsMessengerCreateInfoEXT* pCreateInfo, const VkAllocationCallbacks* pAllocator, VkDebugUtilsMessengerEXT* pDebugMessenger) {
+    auto func = (PFN_vkCreateDebugUtilsMessengerEXT) vkGetInstanceProcAddr(instance, "vkCreateDebugUtilsMessengerEXT");
+    if (func)
+        return func(instance, pCreateInfo, pAllocator, pDebugMessenger);
+    else
+        return VK_ERROR_EXTENSION_NOT_PRESENT;
+}
+
+void DestroyDebugUtilsMessengerEXT(VkInstance instance, VkDebugUtilsMessengerEXT debugMessenger, const VkAllocationCallbacks* pAllocator) {
+    auto func = (PFN_vkDestroyDebugUtilsMessengerEXT) vkGetInstanceProcAddr(instance, "vkDestroyDebugUtilsMessengerEXT");
+    if (func)
+        func(instance, debugMessenger, pAllocator);
+}
+
+struct QueueFamilyIndices {
+    std::optional<uint32_t> graphicsFamily;
+    std::optional<uint32_t> transferFamily;
+    std::optional<uint32_t> presentFamily;
+    bool isComplete() {
+        if (SEPARATE_TRANSFER_QUEUE_FAMILY) {
+            return graphicsFamily.has_value() && presentFamily.has_value() && transferFamily.has_value();
+        } else {
+            return graphicsFamily.has_value() && presentFamily.has_value();
+        }
+    }
+};
+
+struct SwapchainSupportDetails {
+    VkSurfaceCapabilitiesKHR capabilities;
+    std::vector<VkSurfaceFormatKHR> formats;
+    std::vector<VkPresentModeKHR> presentModes;
+};
+
+struct Vertex {
+    glm::vec3 pos;
+    glm::vec3 color;
+    glm::vec2 texCoord;
+    
+    static VkVertexInputBindingDescription getBindingDescription() {
+        VkVertexInputBindingDescription bindingDescription{};
+        bindingDescription.binding = 0;
+        bindingDescription.stride = sizeof(Vertex);
+        bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+        
+        return bindingDescription;
+    }
+    
+    static std::array<VkVertexInputAttributeDescription, 3> getAttributeDescriptions() {
+        std::array<VkVertexInputAttributeDescription, 3> attributeDescriptions{};
+        attributeDescriptions[0].binding = 0;
+        attributeDescriptions[0].location = 0;
+        attributeDescriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT;
+        attributeDescriptions[0].offset = offsetof(Vertex, pos);
+        
+        attributeDescriptions[1].binding = 0;
+        attributeDescriptions[1].location = 1;
+        attributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
+        attributeDescriptions[1].offset = offsetof(Vertex, color);
+        
+        attributeDescriptions[2].binding = 0;
+        attributeDescriptions[2].location = 2;
+        attributeDescriptions[2].format = VK_FORMAT_R32G32_SFLOAT;
+        attributeDescriptions[2].offset = offsetof(Vertex, texCoord);
+        
+        return attributeDescriptions;
+    };
+    
+    // For use in unordered_map
+    bool operator==(const Vertex& other) const {
+        return pos == other.pos && color == other.color && texCoord == other.texCoord;
+    }
+};
+
+// Quantized vertex layout (12 bytes vs. 32) for meshes with constant vertex color
+// - Position: 16-bit unorm relative to the mesh AABB, dequantized in shader.vert (COMPACT_VERTEX) with MeshDequantization
+// - Texture coordinates: half floats
+// - Position is padded to 4 components since R16G16B16_UNORM isn't a mandatory vertex format
+struct CompactVertex {
+    uint16_t pos[4];
+    uint16_t texCoord[2];
+    
+    static VkVertexInputBindingDescription getBindingDescription() {
+        VkVertexInputBindingDescription bindingDescription{};
+        bindingDescription.binding = 0;
+        bindingDescription.stride = sizeof(CompactVertex);
+        bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+        
+        return bindingDescription;
+    }
+    
+    static std::array<VkVertexInputAttributeDescription, 2> getAttributeDescriptions() {
+        std::array<VkVertexInputAttributeDescription, 2> attributeDescriptions{};
+        attributeDescriptions[0].binding = 0;
+        attributeDescriptions[0].location = 0;
+        attributeDescriptions[0].format = VK_FORMAT_R16G16B16A16_UNORM;
+        attributeDescriptions[0].offset = offsetof(CompactVertex, pos);
+        
+        // Location 1 (color) is a constant in the compact vertex shader
+        attributeDescriptions[1].binding = 0;
+        attributeDescriptions[1].location = 2;
+        attributeDescriptions[1].format = VK_FORMAT_R16G16_SFLOAT;
+        attributeDescriptions[1].offset = offsetof(CompactVertex, texCoord);
+        
+        return attributeDescriptions;
+    };
+};
+
+// Vertex shader push constants for CompactVertex: position = offset + unorm * scale
+struct MeshDequantization {
+    alignas(16) glm::vec4 positionScale;
+    alignas(16) glm::vec4 positionOffset;
+};
+
+// Axis-aligned bounding box
+struct Aabb {
+    glm::vec3 min = glm::vec3(0.0f);
+    glm::vec3 max = glm::vec3(0.0f);
+    
+    // Bounds of the box after an affine transform (center/extent form, so no corners are transformed)
+    Aabb transformed(const glm::mat4& transform) const {
+        glm::vec3 center = glm::vec3(transform * glm::vec4(0.5f * (min + max), 1.0f));
+        glm::vec3 extent = 0.5f * (max - min);
+        glm::vec3 transformedExtent = glm::abs(glm::vec3(transform[0])) * extent.x + glm::abs(glm::vec3(transform[1])) * extent.y +
+                                      glm::abs(glm::vec3(transform[2])) * extent.z;
+        return {center - transformedExtent, center + transformedExtent};
+    }
+};
+
+// IEEE 754 binary32 -> binary16, round to nearest even (overflow -> inf, NaN kept quiet)
+inline uint16_t floatToHalf(float value) {
+    uint32_t bits = std::bit_cast<uint32_t>(value);
+    uint32_t sign = (bits >> 16) & 0x8000;
+    uint32_t magnitude = bits & 0x7FFFFFFF;
+    
+    if (magnitude >= 0x7F800000) { // Inf or NaN
+        return static_cast<uint16_t>(sign | 0x7C00 | (magnitude > 0x7F800000 ? 0x200 : 0));
+    }
+    if (magnitude >= 0x477FF000) { // Rounds to >= 65520 -> inf
+        return static_cast<uint16_t>(sign | 0x7C00);
+    }
+    if (magnitude < 0x38800000) { // Half subnormal (or zero)
+        // Shift the implicit-1 mantissa right and round to nearest even
+        uint32_t exponent = magnitude >> 23;
+        if (exponent < 102) // Below half the smallest subnormal
+            return static_cast<uint16_t>(sign);
+        uint32_t mantissa = (magnitude & 0x7FFFFF) | 0x800000;
+        uint32_t shift = 126 - exponent;
+        uint32_t half = mantissa >> shift;
+        uint32_t remainder = mantissa & ((1u << shift) - 1);
+        uint32_t midpoint = 1u << (shift - 1);
+        if (remainder > midpoint || (remainder == midpoint && (half & 1)))
+            half++;
+        return static_cast<uint16_t>(sign | half);
+    }
+    // Normal: rebias exponent (127 -> 15) and round the 13 dropped mantissa bits
+    uint32_t half = (magnitude - 0x38000000) >> 13;
+    uint32_t remainder = magnitude & 0x1FFF;
+    if (remainder > 0x1000 || (remainder == 0x1000 && (half & 1)))
+        half++; // May carry into the exponent, which is still correct
+    return static_cast<uint16_t>(sign | half);
+}
+
+namespace std {
+    // For use in unordered_map
+    template<> struct hash<Vertex> {
+        size_t operator()(const Vertex& vertex) const {
+            return ((hash<glm::vec3>()(vertex.pos) ^
+                   (hash<glm::vec3>()(vertex.color) << 1)) >> 1) ^
+                   (hash<glm::vec2>()(vertex.texCoord) << 1);
+        }
+    };
+}
+
+// Read-only memory mapping of a whole file (unmapped on destruction)
+struct MappedFile {
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+    
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() { close(); }
+    
+    bool open(const std::string& filename) {
+        close();
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0) {
+            ::close(fd);
+            return false;
+        }
+        void* ptr = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd); // The mapping stays valid after the descriptor is closed
+        if (ptr == MAP_FAILED)
+            return false;
+        data = static_cast<const uint8_t*>(ptr);
+        size = static_cast<size_t>(st.st_size);
+        return true;
+    }
+    void close() {
+        if (data)
+            munmap(const_cast<uint8_t*>(data), size);
+        data = nullptr;
+        size = 0;
+    }
+};
+
+// 64-bit hash over raw bytes (8 bytes per step, multiply-xorshift mixing)
+inline uint64_t hashBytes(const void* bytes, size_t size, uint64_t seed = 0) {
+    const uint64_t k = 0x9E3779B97F4A7C15ull;
+    const uint8_t* p = static_cast<const uint8_t*>(bytes);
+    uint64_t h = seed ^ (size * k);
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, p + i, 8);
+        word *= k;
+        word ^= word >> 32;
+        h = (h ^ word) * 0xD6E8FEB86659FD93ull;
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, p + i, size - i);
+    h = (h ^ (tail * k)) * 0xD6E8FEB86659FD93ull;
+    h ^= h >> 32;
+    h *= 0xD6E8FEB86659FD93ull;
+    h ^= h >> 29;
+    return h;
+}
+
+// Persistent threads behind parallelFor(), started on first use so per-frame callers (culling, LOD selection) don't
+// create and join threads every call
+// - A call queues its chunks as tasks, runs the first itself, then runs its own still-queued tasks while waiting, so
+//   concurrent parallelFor() calls (e.g. from a texture streaming thread) and nested ones can't deadlock the pool
+// - An exception thrown by a chunk is rethrown on the calling thread once all of the call's chunks have finished
+class WorkerPool {
+public:
+    using TaskFunction = void (*)(void* context, size_t begin, size_t end);
+    
+    static WorkerPool& shared() {
+        static WorkerPool pool(std::max(1u, std::thread::hardware_concurrency()) - 1);
+        return pool;
+    }
+    
+    explicit WorkerPool(uint32_t workerCount) {
+        for (uint32_t i = 0; i < workerCount; i++) {
+            workers.emplace_back([this] { work(); });
+        }
+    }
+    ~WorkerPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        workAvailable.notify_all();
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+    }
+    
+    // Workers plus the calling thread
+    size_t threadCount() const {
+        return workers.size() + 1;
+    }
+    
+    // Runs function(context, begin, end) over [0, count) in ranges of chunkSize; returns when all of them have finished
+    void run(TaskFunction function, void* context, size_t count, size_t chunkSize) {
+        Batch batch;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (size_t begin = chunkSize; begin < count; begin += chunkSize) {
+                queue.push_back({function, context, begin, std::min(count, begin + chunkSize), &batch});
+                batch.pending++;
+            }
+        }
+        workAvailable.notify_all();
+        
+        execute({function, context, 0, std::min(count, chunkSize), &batch});
+        std::unique_lock<std::mutex> lock(mutex);
+        while (batch.pending > 0) {
+            auto task = std::find_if(queue.begin(), queue.end(), [&batch](const Task& task) { return task.batch == &batch; });
+            if (task == queue.end()) {
+                finished.wait(lock);
+                continue;
+            }
+            Task ownTask = *task;
+            queue.erase(task);
+            lock.unlock();
+            execute(ownTask);
+            lock.lock();
+            batch.pending--;
+        }
+        if (batch.error) {
+            std::rethrow_exception(batch.error);
+        }
+    }
+    
+private:
+    struct Batch {
+        size_t pending = 0; // Queued or running tasks other than the caller's first
+        std::exception_ptr error; // First exception thrown by a task
+    };
+    struct Task {
+        TaskFunction function;
+        void* context;
+        size_t begin, end;
+        Batch* batch;
+    };
+    
+    std::vector<std::thread> workers;
+    std::mutex mutex; // Guards everything below, and each Batch
+    std::condition_variable workAvailable;
+    std::condition_variable finished;
+    std::deque<Task> queue;
+    bool stopping = false;
+    
+    void execute(const Task& task) {
+        try {
+            task.function(task.context, task.begin, task.end);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!task.batch->error) {
+                task.batch->error = std::current_exception();
+            }
+        }
+    }
+    
+    void work() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            workAvailable.wait(lock, [this] { return stopping || !queue.empty(); });
+            if (stopping)
+                return;
+            Task task = queue.front();
+            queue.pop_front();
+            lock.unlock();
+            execute(task);
+            lock.lock();
+            task.batch->pending--;
+            finished.notify_all();
+        }
+    }
+};
+
+// Size of the contiguous chunks parallelFor() splits [0, count) into: one per pool thread, at least minPerThread each
+inline size_t parallelChunkSize(size_t count, size_t minPerThread) {
+    size_t threadCount = std::min(WorkerPool::shared().threadCount(), std::max<size_t>(1, count / std::max<size_t>(1, minPerThread)));
+    return std::max<size_t>(1, (count + threadCount - 1) / threadCount);
+}
+
+// Runs body(begin, end) over [0, count) split into parallelChunkSize() chunks on the WorkerPool
+// - Runs inline when count is below minPerThread * 2, where handing chunks to the workers would dominate
+template<typename Func>
+void parallelFor(size_t count, size_t minPerThread, Func&& body) {
+    size_t chunkSize = parallelChunkSize(count, minPerThread);
+    if (chunkSize >= count) {
+        body(size_t(0), count);
+        return;
+    }
+    using Body = std::remove_reference_t<Func>;
+    WorkerPool::shared().run([](void* context, size_t begin, size_t end) { (*static_cast<Body*>(context))(begin, end); },
+                             const_cast<void*>(static_cast<const void*>(&body)), count, chunkSize);
+}
+
+// Welds identical vertices of an unindexed (per-corner) vertex stream into unique vertices and an index buffer
+// - Vertices are compared and hashed as raw bytes, so -0.0f and 0.0f (or differing NaN payloads) are treated as distinct
+// - Unique vertices keep first-occurrence order, so output is identical to the old std::unordered_map dedup (which
+//   compares floats by value) for meshes without -0.0f or NaN components; with them the welder can only keep extra
+//   vertices, never merge ones the map kept apart
+// - All tables are owned by the welder and freed when it goes out of scope
+class VertexWelder {
+public:
+    static const size_t PARALLEL_THRESHOLD = 1 << 21; // Corners; below this the serial path is faster than the parallel passes
+    
+    void weld(const std::vector<Vertex>& corners, std::vector<Vertex>& outVertices, std::vector<uint32_t>& outIndices, bool allowParallel = true) {
+        if (allowParallel && corners.size() >= PARALLEL_THRESHOLD && WorkerPool::shared().threadCount() > 1) {
+            weldParallel(corners, outVertices, outIndices);
+        } else {
+            weldSerial(corners, outVertices, outIndices);
+        }
+    }
+    
+    static uint64_t hashVertex(const Vertex& vertex) {
+        // Four 64-bit lanes of the 32-byte vertex, each multiplied and folded (strong enough for linear probing on float data)
+        uint64_t words[4];
+        memcpy(words, &vertex, sizeof(words));
+        uint64_t h = 0x9E3779B97F4A7C15ull;
+        for (uint64_t word : words) {
+            word *= 0xBF58476D1CE4E5B9ull;
+            word ^= word >> 31;
+            h = (h ^ word) * 0x94D049BB133111EBull;
+        }
+        return h ^ (h >> 29);
+    }
+    
+    void weldSerial(const std::vector<Vertex>& corners, std::vector<Vertex>& outVertices, std::vector<uint32_t>& outIndices) {
+        outVertices.clear();
+        outIndices.resize(corners.size());
+        // Open addressing, linear probing; each slot holds a vertex index into outVertices plus the upper hash bits to skip most memcmps
+        size_t capacity = tableCapacity(corners.size());
+        size_t mask = capacity - 1;
+        std::vector<uint32_t> slots(capacity, EMPTY);
+        std::vector<uint32_t> slotHashes(capacity);
+        outVertices.reserve(corners.size() / 4); // Typical triangle meshes share each vertex between ~6 corners
+        
+        for (size_t c = 0; c < corners.size(); c++) {
+            const Vertex& vertex = corners[c];
+            uint64_t hash = hashVertex(vertex);
+            uint32_t tag = static_cast<uint32_t>(hash >> 32);
+            size_t slot = hash & mask;
+            while (true) {
+                uint32_t entry = slots[slot];
+                if (entry == EMPTY) {
+                    entry = static_cast<uint32_t>(outVertices.size());
+                    slots[slot] = entry;
+                    slotHashes[slot] = tag;
+                    outVertices.push_back(vertex);
+                    outIndices[c] = entry;
+                    break;
+                }
+                if (slotHashes[slot] == tag && sameVertex(outVertices[entry], vertex)) {
+                    outIndices[c] = entry;
+                    break;
+                }
+                slot = (slot + 1) & mask;
+            }
+        }
+    }
+    
+    void weldParallel(const std::vector<Vertex>& corners, std::vector<Vertex>& outVertices, std::vector<uint32_t>& outIndices) {
+        // 1. Hash every corner (parallel over chunks)
+        // 2. Bucket by hash; each WorkerPool task owns one partition's table and finds the first corner of every duplicate
+        // 3. Serial sweep in corner order assigns final indices, which keeps first-occurrence order deterministic
+        const size_t cornerCount = corners.size();
+        outVertices.clear();
+        outIndices.resize(cornerCount);
+        std::vector<uint64_t> hashes(cornerCount);
+        parallelFor(cornerCount, 1 << 16, [&](size_t begin, size_t end) {
+            for (size_t c = begin; c < end; c++) {
+                hashes[c] = hashVertex(corners[c]);
+            }
+        });
+        
+        // Bucket the corners by partition (the top hash bits) in one pass; each bucket stays in corner order
+        uint32_t partitionCount = static_cast<uint32_t>(std::max<size_t>(1, WorkerPool::shared().threadCount()));
+        auto partitionOf = [partitionCount](uint64_t hash) { return static_cast<uint32_t>((hash >> 40) % partitionCount); };
+        std::vector<size_t> bucketStarts(partitionCount + 1, 0);
+        for (size_t c = 0; c < cornerCount; c++) {
+            bucketStarts[partitionOf(hashes[c]) + 1]++;
+        }
+        std::partial_sum(bucketStarts.begin(), bucketStarts.end(), bucketStarts.begin());
+        std::vector<uint32_t> bucketCorners(cornerCount);
+        std::vector<size_t> bucketFill(bucketStarts.begin(), bucketStarts.end() - 1);
+        for (size_t c = 0; c < cornerCount; c++) {
+            bucketCorners[bucketFill[partitionOf(hashes[c])]++] = static_cast<uint32_t>(c);
+        }
+        
+        // outIndices temporarily holds the first corner that carries the same vertex
+        parallelFor(partitionCount, 1, [&](size_t firstPartition, size_t lastPartition) {
+            for (size_t partition = firstPartition; partition < lastPartition; partition++) {
+                // The table probes with the low hash bits, so it stays independent of the partitioning
+                size_t capacity = tableCapacity(bucketStarts[partition + 1] - bucketStarts[partition]);
+                size_t mask = capacity - 1;
+                std::vector<uint32_t> slots(capacity, EMPTY);
+                for (size_t b = bucketStarts[partition]; b < bucketStarts[partition + 1]; b++) {
+                    uint32_t c = bucketCorners[b];
+                    uint64_t hash = hashes[c];
+                    size_t slot = hash & mask;
+                    while (true) {
+                        uint32_t entry = slots[slot];
+                        if (entry == EMPTY) {
+                            slots[slot] = c;
+                            outIndices[c] = c;
+                            break;
+                        }
+                        if (hashes[entry] == hash && sameVertex(corners[entry], corners[c])) {
+                            outIndices[c] = entry;
+                            break;
+                        }
+                        slot = (slot + 1) & mask;
+                    }
+                }
+            }
+        });
+        
+        // First corners are always earlier than their duplicates, so their final index is already resolved
+        outVertices.reserve(cornerCount / 4);
+        for (size_t c = 0; c < cornerCount; c++) {
+            uint32_t first = outIndices[c];
+            if (first == c) {
+                outIndices[c] = static_cast<uint32_t>(outVertices.size());
+                outVertices.push_back(corners[c]);
+            } else {
+                outIndices[c] = outIndices[first];
+            }
+        }
+    }
+private:
+    static_assert(sizeof(Vertex) == 8 * sizeof(float), "VertexWelder hashes Vertex as 32 raw bytes; it must have no padding");
+    
+    static const uint32_t EMPTY = UINT32_MAX;
+    
+    static size_t tableCapacity(size_t maxEntries) {
+        // Power of two with load factor <= 0.5
+        return std::bit_ceil(std::max<size_t>(16, maxEntries * 2));
+    }
+    static bool sameVertex(const Vertex& a, const Vertex& b) {
+        return memcmp(&a, &b, sizeof(Vertex)) == 0;
+    }
+};
+
+// Post-transform vertex cache statistics for a triangle list, simulated with a FIFO cache of the given size
+// - ACMR: vertex shader invocations per triangle (0.5 is ideal for large regular meshes, 3.0 is worst)
+// - ATVR: vertex shader invocations per unique vertex (1.0 is ideal)
+struct VertexCacheStatistics {
+    float acmr;
+    float atvr;
+};
+inline VertexCacheStatistics analyzeVertexCache(const std::vector<uint32_t>& indices, size_t vertexCount, uint32_t cacheSize = 16) {
+    std::vector<uint32_t> insertedAt(vertexCount, 0); // Timestamp at which the vertex entered the FIFO; 0 = never
+    uint32_t timestamp = cacheSize + 1;
+    size_t misses = 0;
+    for (uint32_t index : indices) {
+        if (timestamp - insertedAt[index] > cacheSize) {
+            insertedAt[index] = timestamp++;
+            misses++;
+        }
+    }
+    size_t triangleCount = indices.size() / 3;
+    return {
+        triangleCount ? static_cast<float>(misses) / triangleCount : 0.0f,
+        vertexCount ? static_cast<float>(misses) / vertexCount : 0.0f
+    };
+}
+
+// Reorders triangles for post-transform vertex cache locality (Tom Forsyth, "Linear-Speed Vertex Cache Optimisation")
+inline void optimizeVertexCache(std::vector<uint32_t>& indices, size_t vertexCount) {
+    const int cacheSize = 32;
+    const size_t triangleCount = indices.size() / 3;
+    if (triangleCount == 0)
+        return;
+    
+    auto vertexScore = [](int cachePosition, uint32_t liveTriangles) {
+        if (liveTriangles == 0)
+            return -1.0f;
+        float score = 0.0f;
+        if (cachePosition >= 0) {
+            if (cachePosition < 3) {
+                score = 0.75f; // The last triangle's vertices; deliberately not the highest so strips don't always continue the same way
+            } else {
+                score = std::pow(1.0f - static_cast<float>(cachePosition - 3) / (cacheSize - 3), 1.5f);
+            }
+        }
+        return score + 2.0f / std::sqrt(static_cast<float>(liveTriangles)); // Favor finishing off vertices with few triangles left
+    };
+    
+    // Vertex -> adjacent triangle lists (CSR layout)
+    std::vector<uint32_t> liveTriangles(vertexCount, 0);
+    for (uint32_t index : indices) {
+        liveTriangles[index]++;
+    }
+    std::vector<uint32_t> adjacencyOffsets(vertexCount + 1, 0);
+    for (size_t v = 0; v < vertexCount; v++) {
+        adjacencyOffsets[v + 1] = adjacencyOffsets[v] + liveTriangles[v];
+    }
+    std::vector<uint32_t> adjacency(indices.size());
+    {
+        std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+        for (size_t t = 0; t < triangleCount; t++) {
+            for (int k = 0; k < 3; k++) {
+                adjacency[fill[indices[3 * t + k]]++] = static_cast<uint32_t>(t);
+            }
+        }
+    }
+    
+    std::vector<int> cachePosition(vertexCount, -1);
+    std::vector<float> scores(vertexCount);
+    for (size_t v = 0; v < vertexCount; v++) {
+        scores[v] = vertexScore(-1, liveTriangles[v]);
+    }
+    std::vector<bool> emitted(triangleCount, false);
+    
+    std::vector<uint32_t> output;
+    output.reserve(indices.size());
+    std::vector<uint32_t> cache, nextCache;
+    cache.reserve(cacheSize + 3);
+    nextCache.reserve(cacheSize + 3);
+    
+    size_t scanCursor = 0; // For finding a fresh start when nothing in the cache has live triangles
+    int64_t bestTriangle = -1;
+    for (size_t emittedCount = 0; emittedCount < triangleCount; emittedCount++) {
+        if (bestTriangle < 0) {
+            // Nothing in the cache has live triangles left; restart from the first unemitted triangle
+            while (scanCursor < triangleCount && emitted[scanCursor]) {
+                scanCursor++;
+            }
+            bestTriangle = static_cast<int64_t>(scanCursor);
+        }
+        uint32_t t = static_cast<uint32_t>(bestTriangle);
+        emitted[t] = true;
+        const uint32_t* tri = &indices[3 * t];
+        output.insert(output.end(), tri, tri + 3);
+        
+        // Remove the triangle from its vertices' live lists
+        for (int k = 0; k < 3; k++) {
+            uint32_t v = tri[k];
+            uint32_t* list = &adjacency[adjacencyOffsets[v]];
+            uint32_t count = liveTriangles[v];
+            for (uint32_t i = 0; i < count; i++) {
+                if (list[i] == t) {
+                    list[i] = list[count - 1];
+                    break;
+                }
+            }
+            liveTriangles[v]--;
+        }
+        
+        // Move the triangle's vertices to the front of the LRU cache
+        nextCache.assign(tri, tri + 3);
+        for (uint32_t v : cache) {
+            if (v != tri[0] && v != tri[1] && v != tri[2]) {
+                nextCache.push_back(v);
+            }
+        }
+        for (size_t i = cacheSize; i < nextCache.size(); i++) {
+            // Evicted
+            cachePosition[nextCache[i]] = -1;
+            scores[nextCache[i]] = vertexScore(-1, liveTriangles[nextCache[i]]);
+        }
+        if (nextCache.size() > static_cast<size_t>(cacheSize)) {
+            nextCache.resize(cacheSize);
+        }
+        std::swap(cache, nextCache);
+        
+        // Rescore cached vertices and their remaining triangles, tracking the best candidate
+        for (size_t i = 0; i < cache.size(); i++) {
+            cachePosition[cache[i]] = static_cast<int>(i);
+            scores[cache[i]] = vertexScore(static_cast<int>(i), liveTriangles[cache[i]]);
+        }
+        bestTriangle = -1;
+        float bestScore = -1.0f;
+        for (uint32_t v : cache) {
+            const uint32_t* list = &adjacency[adjacencyOffsets[v]];
+            for (uint32_t i = 0; i < liveTriangles[v]; i++) {
+                uint32_t candidate = list[i];
+                const uint32_t* candidateTri = &indices[3 * candidate];
+                float score = scores[candidateTri[0]] + scores[candidateTri[1]] + scores[candidateTri[2]];
+                if (score > bestScore) {
+                    bestScore = score;
+                    bestTriangle = candidate;
+                }
+            }
+        }
+    }
+    
+    indices.swap(output);
+}
+
+// Reorders clusters of a cache-optimized triangle list so that outward-facing clusters are drawn first (less overdraw)
+// - Clusters are split where the FIFO cache simulation restarts (a triangle with 3 misses), so cache efficiency is mostly kept
+// - Clusters are sorted by how far they face away from the mesh center, a view-independent occlusion heuristic
+inline void optimizeOverdraw(std::vector<uint32_t>& indices, const std::vector<Vertex>& vertices, uint32_t cacheSize = 16) {
+    const size_t triangleCount = indices.size() / 3;
+    if (triangleCount == 0)
+        return;
+    
+    // Cluster boundaries
+    std::vector<size_t> clusterStarts;
+    std::vector<uint32_t> insertedAt(vertices.size(), 0);
+    uint32_t timestamp = cacheSize + 1;
+    for (size_t t = 0; t < triangleCount; t++) {
+        int misses = 0;
+        for (int k = 0; k < 3; k++) {
+            uint32_t v = indices[3 * t + k];
+            if (timestamp - insertedAt[v] > cacheSize) {
+                insertedAt[v] = timestamp++;
+                misses++;
+            }
+        }
+        if (t == 0 || (misses == 3 && t - clusterStarts.back() >= 16)) {
+            clusterStarts.push_back(t);
+        }
+    }
+    clusterStarts.push_back(triangleCount);
+    
+    glm::vec3 meshCenter(0.0f);
+    for (const Vertex& vertex : vertices) {
+        meshCenter += vertex.pos;
+    }
+    meshCenter /= static_cast<float>(std::max<size_t>(1, vertices.size()));
+    
+    // Sort key: dot(cluster centroid - mesh center, area-weighted cluster normal)
+    size_t clusterCount = clusterStarts.size() - 1;
+    std::vector<float> sortKeys(clusterCount);
+    for (size_t c = 0; c < clusterCount; c++) {
+        glm::vec3 centroid(0.0f), normal(0.0f);
+        float area = 0.0f;
+        for (size_t t = clusterStarts[c]; t < clusterStarts[c + 1]; t++) {
+            const glm::vec3& p0 = vertices[indices[3 * t]].pos;
+            const glm::vec3& p1 = vertices[indices[3 * t + 1]].pos;
+            const glm::vec3& p2 = vertices[indices[3 * t + 2]].pos;
+            glm::vec3 n = glm::cross(p1 - p0, p2 - p0); // Length is twice the triangle area
+            float triangleArea = glm::length(n);
+            centroid += (p0 + p1 + p2) * (triangleArea / 3.0f);
+            normal += n;
+            area += triangleArea;
+        }
+        centroid = area > 0.0f ? centroid / area : vertices[indices[3 * clusterStarts[c]]].pos;
+        float normalLength = glm::length(normal);
+        sortKeys[c] = normalLength > 0.0f ? glm::dot(centroid - meshCenter, normal / normalLength) : 0.0f;
+    }
+    
+    std::vector<uint32_t> order(clusterCount);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&sortKeys](uint32_t a, uint32_t b) { return sortKeys[a] > sortKeys[b]; });
+    
+    std::vector<uint32_t> output;
+    output.reserve(indices.size());
+    for (uint32_t c : order) {
+        output.insert(output.end(), indices.begin() + 3 * clusterStarts[c], indices.begin() + 3 * clusterStarts[c + 1]);
+    }
+    indices.swap(output);
+}
+
+// Reorders vertices by first use in the index buffer (so vertex fetches walk memory roughly linearly) and remaps indices
+inline void optimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices) {
+    std::vector<uint32_t> remap(vertices.size(), UINT32_MAX);
+    std::vector<Vertex> output;
+    output.reserve(vertices.size());
+    for (uint32_t& index : indices) {
+        if (remap[index] == UINT32_MAX) {
+            remap[index] = static_cast<uint32_t>(output.size());
+            output.push_back(vertices[index]);
+        }
+        index = remap[index];
+    }
+    vertices.swap(output); // Vertices not referenced by any triangle are dropped
+}
+
+// Mesh simplification by quadric error metric edge collapse (Garland & Heckbert), for LOD chains
+// - Vertices are only removed, never moved or created, so every level indexes the original vertex array
+// - Vertices at the same position (UV seams: the welder keys on the whole Vertex) form a group that shares one quadric.
+//   A lone vertex collapses freely, or only along its edge when on an open border; a group of two seam vertices collapses
+//   only along the seam, both vertices together, so texture coordinates never stretch across it; other groups are locked
+// - Border and seam edges add quadrics of planes perpendicular to their triangles, so outlines are kept where possible
+// - Collapses are applied in passes, cheapest first; a collapse is skipped if a triangle around it already changed in the
+//   pass, or if it would flip a triangle. State persists between simplify() calls, so a chain of levels costs about as
+//   much as simplifying once to the coarsest level
+class MeshSimplifier {
+public:
+    MeshSimplifier(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices) : currentIndices(indices) {
+        const size_t vertexCount = vertices.size();
+        
+        // Positions normalized to the unit cube, so errors don't depend on the model's units
+        Aabb bounds = vertices.empty() ? Aabb{} : Aabb{vertices[0].pos, vertices[0].pos};
+        for (const Vertex& vertex : vertices) {
+            bounds.min = glm::min(bounds.min, vertex.pos);
+            bounds.max = glm::max(bounds.max, vertex.pos);
+        }
+        glm::vec3 extent = bounds.max - bounds.min;
+        scale = std::max({extent.x, extent.y, extent.z, 1e-20f});
+        positions.resize(vertexCount);
+        for (size_t i = 0; i < vertexCount; i++) {
+            positions[i] = (vertices[i].pos - bounds.min) / scale;
+        }
+        
+        // Position groups: group[v] is the group's first vertex, wedge[] links each group into a ring
+        std::vector<uint32_t> order(vertexCount);
+        std::iota(order.begin(), order.end(), 0);
+        auto lessPosition = [&vertices](uint32_t a, uint32_t b) {
+            const glm::vec3& p = vertices[a].pos;
+            const glm::vec3& q = vertices[b].pos;
+            return p.x != q.x ? p.x < q.x : p.y != q.y ? p.y < q.y : p.z < q.z;
+        };
+        std::sort(order.begin(), order.end(), lessPosition);
+        group.resize(vertexCount);
+        wedge.resize(vertexCount);
+        for (size_t i = 0; i < vertexCount; i++) {
+            uint32_t v = order[i];
+            if (i > 0 && vertices[order[i - 1]].pos == vertices[v].pos) {
+                uint32_t first = group[order[i - 1]];
+                group[v] = first;
+                wedge[v] = wedge[first];
+                wedge[first] = v;
+            } else {
+                group[v] = v;
+                wedge[v] = v;
+            }
+        }
+        
+        classify();
+        
+        // Quadrics of the triangles' planes, and of the planes through border and seam edges, per group
+        quadrics.assign(vertexCount, Quadric{});
+        for (size_t t = 0; t < currentIndices.size(); t += 3) {
+            const uint32_t* tri = &currentIndices[t];
+            glm::vec3 p0 = positions[tri[0]], p1 = positions[tri[1]], p2 = positions[tri[2]];
+            glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+            float area = glm::length(normal);
+            if (area == 0.0f)
+                continue;
+            normal /= area;
+            Quadric plane = Quadric::fromPlane(normal, -glm::dot(normal, p0), area);
+            for (int k = 0; k < 3; k++) {
+                quadrics[group[tri[k]]].add(plane);
+            }
+            for (int k = 0; k < 3; k++) {
+                uint32_t a = tri[k], b = tri[(k + 1) % 3];
+                if (openNext[a] != b)
+                    continue;
+                glm::vec3 edge = positions[b] - positions[a];
+                float length = glm::length(edge);
+                if (length == 0.0f)
+                    continue;
+                glm::vec3 edgeNormal = glm::normalize(glm::cross(edge, normal));
+                Quadric edgePlane = Quadric::fromPlane(edgeNormal, -glm::dot(edgeNormal, positions[a]), EDGE_WEIGHT * length * length);
+                quadrics[group[a]].add(edgePlane);
+                quadrics[group[b]].add(edgePlane);
+            }
+        }
+    }
+    
+    // Collapses edges until at most targetIndexCount indices remain, or no collapse below maxError (relative to the mesh
+    // extent) is left; returns the simplified triangle list
+    const std::vector<uint32_t>& simplify(size_t targetIndexCount, float maxError) {
+        const float maxQuadricError = maxError * maxError;
+        while (currentIndices.size() > targetIndexCount) {
+            size_t applied = collapsePass((currentIndices.size() - targetIndexCount) / 3, maxQuadricError);
+            if (applied == 0)
+                break;
+            classify(); // Borders and seams move as their edges collapse
+        }
+        return currentIndices;
+    }
+    
+    // Largest collapse error so far, in the mesh's units (distance from the original surface, as estimated by the quadrics)
+    float error() const {
+        return std::sqrt(maxCollapseError) * scale;
+    }
+    
+private:
+    enum Kind : uint8_t { Manifold, Border, Seam, Locked };
+    static constexpr float EDGE_WEIGHT = 10.0f;
+    
+    // Sum of squared distances to weighted planes: p^T A p + 2 b.p + c, with the summed weight to normalize by
+    struct Quadric {
+        double a00 = 0, a11 = 0, a22 = 0, a01 = 0, a02 = 0, a12 = 0;
+        double b0 = 0, b1 = 0, b2 = 0, c = 0;
+        double weight = 0;
+        
+        static Quadric fromPlane(glm::vec3 n, float d, float weight) {
+            Quadric q;
+            q.a00 = weight * n.x * n.x; q.a11 = weight * n.y * n.y; q.a22 = weight * n.z * n.z;
+            q.a01 = weight * n.x * n.y; q.a02 = weight * n.x * n.z; q.a12 = weight * n.y * n.z;
+            q.b0 = weight * n.x * d; q.b1 = weight * n.y * d; q.b2 = weight * n.z * d;
+            q.c = weight * d * d;
+            q.weight = weight;
+            return q;
+        }
+        void add(const Quadric& q) {
+            a00 += q.a00; a11 += q.a11; a22 += q.a22; a01 += q.a01; a02 += q.a02; a12 += q.a12;
+            b0 += q.b0; b1 += q.b1; b2 += q.b2; c += q.c;
+            weight += q.weight;
+        }
+        // Weighted mean squared distance of p to the planes
+        float evaluate(glm::vec3 p) const {
+            double x = p.x, y = p.y, z = p.z;
+            double r = a00 * x * x + a11 * y * y + a22 * z * z + 2 * (a01 * x * y + a02 * x * z + a12 * y * z)
+                     + 2 * (b0 * x + b1 * y + b2 * z) + c;
+            return weight > 0 ? static_cast<float>(std::fabs(r) / weight) : 0.0f;
+        }
+    };
+    struct Collapse {
+        uint32_t vertex;
+        uint32_t target;
+        float error;
+    };
+    
+    std::vector<uint32_t> currentIndices;
+    std::vector<glm::vec3> positions;
+    float scale = 1.0f;
+    std::vector<uint32_t> group;
+    std::vector<uint32_t> wedge;
+    std::vector<Quadric> quadrics; // By group
+    std::vector<Kind> kinds;
+    std::vector<uint32_t> openNext; // Target of the vertex's open (unpaired) half-edge, UINT32_MAX if none
+    std::vector<uint32_t> openPrev; // Source of the open half-edge ending at the vertex
+    std::vector<uint32_t> seamSibling; // The other live vertex of a Seam group
+    float maxCollapseError = 0.0f; // Quadric error (squared, normalized units)
+    
+    void classify() {
+        // Open half-edges: a->b without a matching b->a, in vertex (not position) terms, so seams count as open too
+        const size_t vertexCount = positions.size();
+        std::vector<uint64_t> halfEdges;
+        halfEdges.reserve(currentIndices.size());
+        for (size_t t = 0; t < currentIndices.size(); t += 3) {
+            for (int k = 0; k < 3; k++) {
+                halfEdges.push_back(uint64_t(currentIndices[t + k]) << 32 | currentIndices[t + (k + 1) % 3]);
+            }
+        }
+        std::sort(halfEdges.begin(), halfEdges.end());
+        
+        std::vector<uint32_t> openOut(vertexCount, 0), openIn(vertexCount, 0);
+        std::vector<uint8_t> live(vertexCount, 0);
+        openNext.assign(vertexCount, UINT32_MAX);
+        openPrev.assign(vertexCount, UINT32_MAX);
+        for (uint64_t halfEdge : halfEdges) {
+            uint32_t a = static_cast<uint32_t>(halfEdge >> 32), b = static_cast<uint32_t>(halfEdge);
+            live[a] = 1;
+            if (!std::binary_search(halfEdges.begin(), halfEdges.end(), uint64_t(b) << 32 | a)) {
+                openOut[a]++;
+                openIn[b]++;
+                openNext[a] = b;
+                openPrev[b] = a;
+            }
+        }
+        
+        kinds.assign(vertexCount, Locked);
+        seamSibling.assign(vertexCount, UINT32_MAX);
+        for (uint32_t v = 0; v < vertexCount; v++) {
+            if (!live[v])
+                continue;
+            uint32_t liveCount = 0, sibling = UINT32_MAX;
+            uint32_t w = v;
+            do {
+                if (live[w]) {
+                    liveCount++;
+                    if (w != v)
+                        sibling = w;
+                }
+                w = wedge[w];
+            } while (w != v);
+            
+            if (liveCount == 1) {
+                if (openOut[v] == 0 && openIn[v] == 0) {
+                    kinds[v] = Manifold;
+                } else if (openOut[v] == 1 && openIn[v] == 1) {
+                    kinds[v] = Border;
+                }
+            } else if (liveCount == 2 && openOut[v] == 1 && openIn[v] == 1 && openOut[sibling] == 1 && openIn[sibling] == 1
+                       && group[openNext[v]] == group[openPrev[sibling]] && group[openPrev[v]] == group[openNext[sibling]]) {
+                kinds[v] = Seam; // The two sides of the seam run in opposite directions
+                seamSibling[v] = sibling;
+            }
+        }
+    }
+    
+    bool canCollapse(uint32_t vertex, uint32_t target) const {
+        if (group[vertex] == group[target])
+            return false;
+        switch (kinds[vertex]) {
+        case Manifold:
+            return true;
+        case Border:
+        case Seam:
+            return target == openNext[vertex] || target == openPrev[vertex];
+        default:
+            return false;
+        }
+    }
+    
+    size_t collapsePass(size_t trianglesToRemove, float maxQuadricError) {
+        const size_t vertexCount = positions.size();
+        const size_t triangleCount = currentIndices.size() / 3;
+        
+        // Group -> triangles (CSR)
+        std::vector<uint32_t> adjacencyOffsets(vertexCount + 1, 0);
+        for (uint32_t index : currentIndices) {
+            adjacencyOffsets[group[index] + 1]++;
+        }
+        std::partial_sum(adjacencyOffsets.begin(), adjacencyOffsets.end(), adjacencyOffsets.begin());
+        std::vector<uint32_t> adjacency(currentIndices.size());
+        std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+        for (size_t i = 0; i < currentIndices.size(); i++) {
+            adjacency[fill[group[currentIndices[i]]]++] = static_cast<uint32_t>(i / 3);
+        }
+        
+        // Cheapest allowed direction of every edge
+        std::vector<Collapse> collapses;
+        collapses.reserve(currentIndices.size());
+        for (size_t t = 0; t < triangleCount; t++) {
+            for (int k = 0; k < 3; k++) {
+                uint32_t a = currentIndices[3 * t + k], b = currentIndices[3 * t + (k + 1) % 3];
+                bool forward = canCollapse(a, b), backward = canCollapse(b, a);
+                float forwardError = forward ? quadrics[group[a]].evaluate(positions[b]) : std::numeric_limits<float>::max();
+                float backwardError = backward ? quadrics[group[b]].evaluate(positions[a]) : std::numeric_limits<float>::max();
+                if (forward && forwardError <= backwardError) {
+                    collapses.push_back({a, b, forwardError});
+                } else if (backward) {
+                    collapses.push_back({b, a, backwardError});
+                }
+            }
+        }
+        std::sort(collapses.begin(), collapses.end(), [](const Collapse& x, const Collapse& y) { return x.error < y.error; });
+        
+        std::vector<uint32_t> collapseTo(vertexCount);
+        std::iota(collapseTo.begin(), collapseTo.end(), 0);
+        std::vector<uint8_t> touched(vertexCount, 0); // By group
+        size_t applied = 0, removed = 0;
+        for (const Collapse& collapse : collapses) {
+            if (removed >= trianglesToRemove || collapse.error > maxQuadricError)
+                break;
+            uint32_t vertexGroup = group[collapse.vertex], targetGroup = group[collapse.target];
+            if (touched[vertexGroup] || touched[targetGroup])
+                continue;
+            
+            // A seam collapses on both sides: the sibling moves to the target's vertex on its own side of the seam
+            uint32_t sibling = UINT32_MAX, siblingTarget = UINT32_MAX;
+            if (kinds[collapse.vertex] == Seam) {
+                sibling = seamSibling[collapse.vertex];
+                siblingTarget = collapse.target == openNext[collapse.vertex] ? openPrev[sibling] : openNext[sibling];
+                if (group[siblingTarget] != targetGroup)
+                    continue;
+            }
+            
+            if (flipsTriangle(vertexGroup, targetGroup, positions[collapse.target], adjacency, adjacencyOffsets))
+                continue;
+            
+            collapseTo[collapse.vertex] = collapse.target;
+            if (sibling != UINT32_MAX) {
+                collapseTo[sibling] = siblingTarget;
+            }
+            quadrics[targetGroup].add(quadrics[vertexGroup]);
+            maxCollapseError = std::max(maxCollapseError, collapse.error);
+            for (uint32_t i = adjacencyOffsets[vertexGroup]; i < adjacencyOffsets[vertexGroup + 1]; i++) {
+                const uint32_t* tri = &currentIndices[3 * adjacency[i]];
+                touched[group[tri[0]]] = touched[group[tri[1]]] = touched[group[tri[2]]] = 1;
+            }
+            applied++;
+            removed += kinds[collapse.vertex] == Border ? 1 : 2;
+        }
+        
+        // Remap, dropping triangles that became degenerate (two corners at one position)
+        size_t write = 0;
+        for (size_t t = 0; t < triangleCount; t++) {
+            uint32_t a = collapseTo[currentIndices[3 * t]], b = collapseTo[currentIndices[3 * t + 1]], c = collapseTo[currentIndices[3 * t + 2]];
+            if (group[a] == group[b] || group[b] == group[c] || group[a] == group[c])
+                continue;
+            currentIndices[write++] = a;
+            currentIndices[write++] = b;
+            currentIndices[write++] = c;
+        }
+        currentIndices.resize(write);
+        return applied;
+    }
+    
+    // Whether moving the vertex group to newPosition turns any of its triangles (other than those collapsing) over
+    bool flipsTriangle(uint32_t vertexGroup, uint32_t targetGroup, glm::vec3 newPosition, const std::vector<uint32_t>& adjacency,
+                       const std::vector<uint32_t>& adjacencyOffsets) const {
+        for (uint32_t i = adjacencyOffsets[vertexGroup]; i < adjacencyOffsets[vertexGroup + 1]; i++) {
+            const uint32_t* tri = &currentIndices[3 * adjacency[i]];
+            if (group[tri[0]] == targetGroup || group[tri[1]] == targetGroup || group[tri[2]] == targetGroup)
+                continue;
+            glm::vec3 p[3], q[3];
+            for (int k = 0; k < 3; k++) {
+                p[k] = positions[tri[k]];
+                q[k] = group[tri[k]] == vertexGroup ? newPosition : p[k];
+            }
+            glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+            glm::vec3 after = glm::cross(q[1] - q[0], q[2] - q[0]);
+            if (glm::dot(before, after) <= 0.0f)
+                return true;
+        }
+        return false;
+    }
+};
+
+// A simplified level of a mesh; level 0, the mesh itself, isn't one
+struct MeshLod {
+    std::vector<uint32_t> indices; // Into the mesh's vertices
+    float error; // MeshSimplifier::error(), in mesh units
+};
+
+// Parallel OBJ ingestion for large models
+// - The mapped file is split at line boundaries and chunks are parsed concurrently with tinyobjloader's own number and
+//   index parsers, then merged in file order into the attrib_t/shape_t layout tinyobj::LoadObj produces (bit-identical)
+// - Handles v/vn/vt, triangle f records with positive indices, and o/g/s/usemtl/mtllib state
+// - Anything else (polygons tinyobj would triangulate, relative or zero vertex indices, l/p/t/vw records) is reported
+//   through `unsupported` so the caller can fall back to tinyobj::LoadObj
+class ParallelObjParser {
+public:
+    static const size_t MIN_CHUNK_SIZE = 1 << 20; // Bytes; smaller files are parsed as a single chunk
+    
+    bool parse(const MappedFile& file, tinyobj::attrib_t& attrib, std::vector<tinyobj::shape_t>& shapes,
+               std::vector<tinyobj::material_t>& materials, std::string& warn, std::string& unsupported) {
+        attrib = tinyobj::attrib_t();
+        shapes.clear();
+        materials.clear();
+        
+        // Split into chunks that each start at the beginning of a line
+        const char* data = reinterpret_cast<const char*>(file.data);
+        const char* dataEnd = data + file.size;
+        size_t chunkCount = std::max<size_t>(1, std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()) * 4, file.size / MIN_CHUNK_SIZE));
+        std::vector<Chunk> chunks(chunkCount);
+        for (size_t c = 0; c < chunkCount; c++) {
+            const char* begin = data + file.size * c / chunkCount;
+            if (c > 0) {
+                begin = std::max(begin, chunks[c - 1].begin);
+                while (begin < dataEnd && begin[-1] != '\n') {
+                    begin++;
+                }
+            }
+            chunks[c].begin = begin;
+        }
+        for (size_t c = 0; c < chunkCount; c++) {
+            chunks[c].end = c + 1 < chunkCount ? chunks[c + 1].begin : dataEnd;
+        }
+        
+        parallelFor(chunkCount, 1, [&chunks](size_t begin, size_t end) {
+            for (size_t c = begin; c < end; c++) {
+                parseChunk(chunks[c]);
+            }
+        });
+        for (const Chunk& chunk : chunks) {
+            if (!chunk.unsupported.empty()) {
+                unsupported = chunk.unsupported;
+                return false;
+            }
+        }
+        
+        mergeAttributes(chunks, attrib);
+        mergeShapes(chunks, shapes, materials, warn);
+        return true;
+    }
+    
+private:
+    // State changes that affect faces after them, kept in file order relative to the chunk's faces
+    struct Event {
+        enum Kind { Group, Object, UseMaterial, MaterialLibrary, Smoothing } kind;
+        size_t faceIndex; // Number of faces in the chunk before this event
+        std::string text;
+        unsigned int smoothingId = 0;
+    };
+    struct Chunk {
+        const char* begin = nullptr;
+        const char* end = nullptr;
+        std::vector<tinyobj::real_t> vertices, vertexWeights, colors, normals, texcoords;
+        std::vector<tinyobj::index_t> corners; // 3 per triangle
+        std::vector<Event> events;
+        std::string unsupported;
+    };
+    
+    static void parseChunk(Chunk& chunk) {
+        // Mirrors the record handling of tinyobj::LoadObj; each line is copied so tinyobj's parsers stop at its terminator
+        tinyobj::warning_context context;
+        context.warn = nullptr;
+        context.line_number = 0;
+        std::string line;
+        const char* cursor = chunk.begin;
+        while (cursor < chunk.end) {
+            // Lines end with \n, \r\n or \r (same as tinyobj's safeGetline)
+            const char* lineEnd = cursor;
+            while (lineEnd < chunk.end && *lineEnd != '\n' && *lineEnd != '\r') {
+                lineEnd++;
+            }
+            line.assign(cursor, lineEnd);
+            cursor = lineEnd;
+            if (cursor < chunk.end) {
+                if (*cursor == '\r' && cursor + 1 < chunk.end && cursor[1] == '\n')
+                    cursor++;
+                cursor++;
+            }
+            
+            const char* token = line.c_str();
+            token += strspn(token, " \t");
+            if (token[0] == '\0' || token[0] == '#')
+                continue;
+            
+            if (token[0] == 'v' && IS_SPACE(token[1])) {
+                token += 2;
+                tinyobj::real_t x, y, z, r, g, b;
+                tinyobj::parseVertexWithColor(&x, &y, &z, &r, &g, &b, &token);
+                chunk.vertices.insert(chunk.vertices.end(), {x, y, z});
+                chunk.vertexWeights.push_back(r); // r = w, 1.0 when there's no w component
+                chunk.colors.insert(chunk.colors.end(), {r, g, b}); // LoadObj's default_vcols_fallback keeps colors for every vertex
+                continue;
+            }
+            if (token[0] == 'v' && token[1] == 'n' && IS_SPACE(token[2])) {
+                token += 3;
+                tinyobj::real_t x, y, z;
+                tinyobj::parseReal3(&x, &y, &z, &token);
+                chunk.normals.insert(chunk.normals.end(), {x, y, z});
+                continue;
+            }
+            if (token[0] == 'v' && token[1] == 't' && IS_SPACE(token[2])) {
+                token += 3;
+                tinyobj::real_t x, y;
+                tinyobj::parseReal2(&x, &y, &token);
+                chunk.texcoords.insert(chunk.texcoords.end(), {x, y});
+                continue;
+            }
+            if ((token[0] == 'v' && token[1] == 'w' && IS_SPACE(token[2])) || ((token[0] == 'l' || token[0] == 'p' || token[0] == 't') && IS_SPACE(token[1]))) {
+                chunk.unsupported = std::string("'") + std::string(token, strcspn(token, " \t")) + "' records";
+                return;
+            }
+            if (token[0] == 'f' && IS_SPACE(token[1])) {
+                token += 2;
+                token += strspn(token, " \t");
+                size_t cornerCount = 0;
+                while (!IS_NEW_LINE(token[0]) && token[0] != '#') {
+                    // Zero element counts make parseTriple reject relative indices, which need running counts across chunks
+                    tinyobj::vertex_index_t vi;
+                    if (cornerCount == 3 || !tinyobj::parseTriple(&token, 0, 0, 0, &vi, context)) {
+                        chunk.unsupported = cornerCount == 3 ? "non-triangle faces" : "relative or invalid face indices";
+                        return;
+                    }
+                    tinyobj::index_t index;
+                    index.vertex_index = vi.v_idx;
+                    index.normal_index = vi.vn_idx;
+                    index.texcoord_index = vi.vt_idx;
+                    chunk.corners.push_back(index);
+                    cornerCount++;
+                    token += strspn(token, " \t\r");
+                }
+                if (cornerCount != 3) {
+                    chunk.unsupported = "degenerate faces";
+                    return;
+                }
+                continue;
+            }
+            
+            size_t faceIndex = chunk.corners.size() / 3;
+            if (0 == strncmp(token, "usemtl", 6)) {
+                token += 6;
+                chunk.events.push_back({Event::UseMaterial, faceIndex, tinyobj::parseString(&token)});
+                continue;
+            }
+            if (0 == strncmp(token, "mtllib", 6) && IS_SPACE(token[6])) {
+                chunk.events.push_back({Event::MaterialLibrary, faceIndex, std::string(token + 7)});
+                continue;
+            }
+            if (token[0] == 'g' && IS_SPACE(token[1])) {
+                // Multiple group names are joined with spaces; names[0] is the 'g' itself
+                std::vector<std::string> names;
+                while (!IS_NEW_LINE(token[0]) && token[0] != '#') {
+                    names.push_back(tinyobj::parseString(&token));
+                    token += strspn(token, " \t\r");
+                }
+                std::string name;
+                for (size_t i = 1; i < names.size(); i++) {
+                    name += (i > 1 ? " " : "") + names[i];
+                }
+                chunk.events.push_back({Event::Group, faceIndex, name});
+                continue;
+            }
+            if (token[0] == 'o' && IS_SPACE(token[1])) {
+                chunk.events.push_back({Event::Object, faceIndex, std::string(token + 2)});
+                continue;
+            }
+            if (token[0] == 's' && IS_SPACE(token[1])) {
+                token += 2;
+                token += strspn(token, " \t");
+                if (token[0] == '\0' || token[0] == '\r' || token[1] == '\n')
+                    continue;
+                unsigned int smoothingId = 0;
+                if (!(strlen(token) >= 3 && token[0] == 'o' && token[1] == 'f' && token[2] == 'f')) {
+                    int id = tinyobj::parseInt(&token);
+                    smoothingId = id < 0 ? 0 : static_cast<unsigned int>(id);
+                }
+                Event event{Event::Smoothing, faceIndex, ""};
+                event.smoothingId = smoothingId;
+                chunk.events.push_back(event);
+                continue;
+            }
+            // Unknown records are ignored, as in tinyobj
+        }
+    }
+    
+    static void mergeAttributes(const std::vector<Chunk>& chunks, tinyobj::attrib_t& attrib) {
+        // Concatenate per-chunk attribute arrays in file order, copying chunks concurrently into their final offsets
+        auto concatenate = [&chunks](std::vector<tinyobj::real_t>& output, std::vector<tinyobj::real_t> Chunk::*member) {
+            std::vector<size_t> offsets(chunks.size() + 1, 0);
+            for (size_t c = 0; c < chunks.size(); c++) {
+                offsets[c + 1] = offsets[c] + (chunks[c].*member).size();
+            }
+            output.resize(offsets.back());
+            parallelFor(chunks.size(), 1, [&](size_t begin, size_t end) {
+                for (size_t c = begin; c < end; c++) {
+                    std::copy((chunks[c].*member).begin(), (chunks[c].*member).end(), output.begin() + offsets[c]);
+                }
+            });
+        };
+        concatenate(attrib.vertices, &Chunk::vertices);
+        concatenate(attrib.vertex_weights, &Chunk::vertexWeights);
+        concatenate(attrib.colors, &Chunk::colors);
+        concatenate(attrib.normals, &Chunk::normals);
+        concatenate(attrib.texcoords, &Chunk::texcoords);
+    }
+    
+    static void mergeShapes(const std::vector<Chunk>& chunks, std::vector<tinyobj::shape_t>& shapes,
+                            std::vector<tinyobj::material_t>& materials, std::string& warn) {
+        // Replays the o/g/s/usemtl/mtllib state in file order, appending faces to shapes the way LoadObj groups them
+        tinyobj::MaterialFileReader materialReader("");
+        std::map<std::string, int> materialMap;
+        std::set<std::string> materialFilenames;
+        int material = -1;
+        unsigned int smoothingId = 0;
+        std::string name;
+        tinyobj::shape_t shape;
+        
+        auto appendFaces = [&](const Chunk& chunk, size_t beginFace, size_t endFace) {
+            if (beginFace == endFace)
+                return;
+            size_t faceCount = endFace - beginFace;
+            shape.name = name;
+            shape.mesh.indices.insert(shape.mesh.indices.end(), chunk.corners.begin() + 3 * beginFace, chunk.corners.begin() + 3 * endFace);
+            shape.mesh.num_face_vertices.insert(shape.mesh.num_face_vertices.end(), faceCount, 3);
+            shape.mesh.material_ids.insert(shape.mesh.material_ids.end(), faceCount, material);
+            shape.mesh.smoothing_group_ids.insert(shape.mesh.smoothing_group_ids.end(), faceCount, smoothingId);
+        };
+        auto finishShape = [&]() {
+            if (!shape.mesh.indices.empty()) {
+                shapes.push_back(std::move(shape));
+            }
+            shape = tinyobj::shape_t();
+        };
+        
+        for (const Chunk& chunk : chunks) {
+            size_t face = 0;
+            for (const Event& event : chunk.events) {
+                appendFaces(chunk, face, event.faceIndex);
+                face = event.faceIndex;
+                switch (event.kind) {
+                    case Event::Group:
+                    case Event::Object:
+                        finishShape();
+                        name = event.text;
+                        break;
+                    case Event::Smoothing:
+                        smoothingId = event.smoothingId;
+                        break;
+                    case Event::UseMaterial: {
+                        auto it = materialMap.find(event.text);
+                        if (it == materialMap.end()) {
+                            warn += "material [ '" + event.text + "' ] not found in .mtl\n";
+                        }
+                        material = it != materialMap.end() ? it->second : -1;
+                        break;
+                    }
+                    case Event::MaterialLibrary: {
+                        std::vector<std::string> filenames;
+                        tinyobj::SplitString(event.text, ' ', '\\', filenames);
+                        bool found = false;
+                        for (const std::string& filename : filenames) {
+                            if (materialFilenames.count(filename) > 0) {
+                                found = true;
+                                continue;
+                            }
+                            std::string materialWarn, materialErr;
+                            if (materialReader(filename, &materials, &materialMap, &materialWarn, &materialErr)) {
+                                found = true;
+                                materialFilenames.insert(filename);
+                                break;
+                            }
+                            warn += materialWarn + materialErr;
+                        }
+                        if (!found) {
+                            warn += "Failed to load material file(s). Use default material.\n";
+                        }
+                        break;
+                    }
+                }
+            }
+            appendFaces(chunk, face, chunk.corners.size() / 3);
+        }
+        finishShape();
+    }
+};
+
+// Mesh cache file layout: header, then vertexCount Vertex structs, then indexCount uint32_t indices
+// - Bump MESH_CACHE_VERSION whenever loadModel() output changes for the same OBJ (e.g., Vertex layout, dedup rules)
+// - Vertices and indices are stored after optimizeMesh(); a cache written with a different OPTIMIZE_MESH is stale
+const uint32_t MESH_CACHE_MAGIC = 0x4853454D; // "MESH"
+const uint32_t MESH_CACHE_VERSION = 2;
+
+struct MeshCacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t sourceHash; // hashBytes() of the OBJ file contents
+    uint64_t sourceSize;
+    uint32_t vertexStride; // sizeof(Vertex) when the cache was written
+    uint32_t indexStride;
+    uint32_t optimized; // OPTIMIZE_MESH when the cache was written
+    uint32_t reserved;
+    uint64_t vertexCount;
+    uint64_t indexCount;
+};
+
+// Pipeline cache file layout: header, then dataSize bytes of vkGetPipelineCacheData() output
+// - The data itself starts with VkPipelineCacheHeaderVersionOne; the file header adds the driver version (which that lacks)
+//   and a hash, so caches from another device, driver or a damaged file are discarded before the driver sees them
+const uint32_t PIPELINE_CACHE_MAGIC = 0x45504950; // "PIPE"
+const uint32_t PIPELINE_CACHE_VERSION = 1;
+
+struct PipelineCacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t vendorID;
+    uint32_t deviceID;
+    uint32_t driverVersion;
+    uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+    uint64_t dataSize;
+    uint64_t dataHash; // hashBytes() of the data
+};
+
+// Texture container: KTX2 (Khronos texture 2.0) holding every mip level in its final Vulkan format
+// - Written by bakeTexture() (automatically on first start, or with --bake-texture) and uploaded with one vkCmdCopyBufferToImage
+// - The baked source file's hashBytes() is stored as key/value data, so the container is rebaked when the source changes
+// - Only 2D, single-layer, non-supercompressed files are produced and accepted
+const uint8_t KTX2_IDENTIFIER[12] = {0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n'};
+const char* const KTX2_SOURCE_HASH_KEY = "FVPsourceHash";
+
+struct Ktx2Header {
+    uint8_t identifier[12];
+    uint32_t vkFormat;
+    uint32_t typeSize;
+    uint32_t pixelWidth;
+    uint32_t pixelHeight;
+    uint32_t pixelDepth;
+    uint32_t layerCount;
+    uint32_t faceCount;
+    uint32_t levelCount;
+    uint32_t supercompressionScheme;
+    // Index
+    uint32_t dfdByteOffset;
+    uint32_t dfdByteLength;
+    uint32_t kvdByteOffset;
+    uint32_t kvdByteLength;
+    uint64_t sgdByteOffset;
+    uint64_t sgdByteLength;
+};
+static_assert(sizeof(Ktx2Header) == 80, "KTX2 header must match the file layout");
+
+struct Ktx2LevelIndex {
+    uint64_t byteOffset;
+    uint64_t byteLength;
+    uint64_t uncompressedByteLength;
+};
+
+// Texel block layout of the formats the container and uploader handle (RGBA8 is treated as 1x1 blocks)
+inline uint32_t textureBlockDimension(VkFormat format) {
+    return format == VK_FORMAT_R8G8B8A8_SRGB ? 1 : 4;
+}
+inline uint32_t textureBlockBytes(VkFormat format) {
+    switch (format) {
+        case VK_FORMAT_R8G8B8A8_SRGB: return 4;
+        case VK_FORMAT_BC1_RGB_SRGB_BLOCK: return 8;
+        case VK_FORMAT_BC7_SRGB_BLOCK: return 16;
+        default: return 0; // Unsupported
+    }
+}
+inline uint64_t textureLevelSize(VkFormat format, uint32_t width, uint32_t height) {
+    uint32_t dimension = textureBlockDimension(format);
+    return uint64_t((width + dimension - 1) / dimension) * ((height + dimension - 1) / dimension) * textureBlockBytes(format);
+}
+
+// One mip level of a texture being baked
+struct TextureLevel {
+    uint32_t width;
+    uint32_t height;
+    std::vector<uint8_t> data;
+};
+
+// Mip levels of a KTX2 file, pointing into its memory mapping
+struct TextureContainer {
+    VkFormat format = VK_FORMAT_UNDEFINED;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint64_t sourceHash = 0;
+    std::vector<Ktx2LevelIndex> levels; // Level 0 is the full-resolution image
+    
+    bool parse(const MappedFile& file) {
+        if (file.size < sizeof(Ktx2Header))
+            return false;
+        Ktx2Header header;
+        memcpy(&header, file.data, sizeof(header));
+        if (memcmp(header.identifier, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) != 0 ||
+            header.pixelDepth != 0 || header.layerCount > 1 || header.faceCount != 1 ||
+            header.levelCount == 0 || header.supercompressionScheme != 0 || textureBlockBytes(static_cast<VkFormat>(header.vkFormat)) == 0)
+            return false;
+        if (file.size < sizeof(Ktx2Header) + header.levelCount * sizeof(Ktx2LevelIndex))
+            return false;
+        
+        format = static_cast<VkFormat>(header.vkFormat);
+        width = header.pixelWidth;
+        height = header.pixelHeight;
+        levels.resize(header.levelCount);
+        memcpy(levels.data(), file.data + sizeof(Ktx2Header), header.levelCount * sizeof(Ktx2LevelIndex));
+        for (uint32_t level = 0; level < header.levelCount; level++) {
+            uint32_t levelWidth = std::max(1u, width >> level);
+            uint32_t levelHeight = std::max(1u, height >> level);
+            if (levels[level].byteLength != textureLevelSize(format, levelWidth, levelHeight) ||
+                levels[level].byteOffset % 4 != 0 || levels[level].byteOffset + levels[level].byteLength > file.size)
+                return false;
+        }
+        
+        // Key/value data: UInt32 length, then "key\0value", padded to 4 bytes
+        sourceHash = 0;
+        uint64_t kvdEnd = uint64_t(header.kvdByteOffset) + header.kvdByteLength;
+        for (uint64_t offset = header.kvdByteOffset; kvdEnd <= file.size && offset + 4 <= kvdEnd; ) {
+            uint32_t length;
+            memcpy(&length, file.data + offset, 4);
+            if (offset + 4 + length > kvdEnd)
+                break;
+            const char* entry = reinterpret_cast<const char*>(file.data + offset + 4);
+            size_t keyLength = strnlen(entry, length);
+            if (keyLength < length && strcmp(entry, KTX2_SOURCE_HASH_KEY) == 0) {
+                sourceHash = std::strtoull(std::string(entry + keyLength + 1, length - keyLength - 1).c_str(), nullptr, 16);
+            }
+            offset += 4 + ((length + 3) & ~3u);
+        }
+        return true;
+    }
+};
+
+// Data format descriptor (a single Khronos basic descriptor block) for the formats textureBlockBytes() knows
+inline std::vector<uint32_t> ktx2Descriptor(VkFormat format) {
+    if (format != VK_FORMAT_R8G8B8A8_SRGB) {
+        // Block-compressed: one sample covering the whole 4x4 block
+        const uint32_t blockSize = 24 + 16;
+        const uint32_t blockBytes = textureBlockBytes(format);
+        const uint32_t colorModel = format == VK_FORMAT_BC7_SRGB_BLOCK ? 134 : 128; // BC7 / BC1A
+        return {
+            4 + blockSize,
+            0,
+            2 | (blockSize << 16),
+            colorModel | (1 << 8) | (2 << 16),     // BT709 primaries, sRGB transfer
+            3 | (3 << 8),                          // texelBlockDimension = 4x4x1x1
+            blockBytes, 0,                         // bytesPlane0
+            (blockBytes * 8 - 1) << 16,            // bitOffset = 0, bitLength - 1, channelType = color
+            0, 0, 0xFFFFFFFF                       // samplePosition, sampleLower, sampleUpper
+        };
+    }
+    
+    const uint32_t sampleCount = 4;
+    const uint32_t blockSize = 24 + 16 * sampleCount;
+    std::vector<uint32_t> words = {
+        4 + blockSize,             // dfdTotalSize
+        0,                         // vendorId = Khronos, descriptorType = basic
+        2 | (blockSize << 16),     // versionNumber = 1.3, descriptorBlockSize
+        1 | (1 << 8) | (2 << 16),  // colorModel = RGBSDA, colorPrimaries = BT709, transferFunction = sRGB, flags = straight alpha
+        0,                         // texelBlockDimension = 1x1x1x1
+        4, 0                       // bytesPlane0 = 4
+    };
+    const uint32_t channels[sampleCount] = {0, 1, 2, 15}; // R, G, B, A
+    for (uint32_t sample = 0; sample < sampleCount; sample++) {
+        uint32_t qualifiers = channels[sample] == 15 ? 0x10 : 0; // Alpha is linear in sRGB formats
+        words.push_back((sample * 8) | (7 << 16) | ((channels[sample] | qualifiers) << 24)); // bitOffset, bitLength - 1, channelType
+        words.push_back(0);   // samplePosition
+        words.push_back(0);   // sampleLower
+        words.push_back(255); // sampleUpper
+    }
+    return words;
+}
+
+// Writes a KTX2 file (to a temporary file that is renamed over the destination), level 0 first in `levels`
+inline bool writeKtx2(const std::string& filename, VkFormat format, const std::vector<TextureLevel>& levels, uint64_t sourceHash) {
+    std::vector<uint32_t> dfd = ktx2Descriptor(format);
+    
+    std::vector<uint8_t> kvd;
+    auto addKeyValue = [&kvd](const std::string& key, const std::string& value) {
+        uint32_t length = static_cast<uint32_t>(key.size() + 1 + value.size() + 1);
+        kvd.insert(kvd.end(), reinterpret_cast<const uint8_t*>(&length), reinterpret_cast<const uint8_t*>(&length) + 4);
+        kvd.insert(kvd.end(), key.begin(), key.end());
+        kvd.push_back(0);
+        kvd.insert(kvd.end(), value.begin(), value.end());
+        kvd.push_back(0);
+        kvd.resize((kvd.size() + 3) & ~size_t(3), 0);
+    };
+    char hashText[17];
+    snprintf(hashText, sizeof(hashText), "%016llx", static_cast<unsigned long long>(sourceHash));
+    addKeyValue("KTXwriter", "FirstVulkanProgram texture baker");
+    addKeyValue(KTX2_SOURCE_HASH_KEY, hashText);
+    
+    Ktx2Header header{};
+    memcpy(header.identifier, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER));
+    header.vkFormat = format;
+    header.typeSize = 1;
+    header.pixelWidth = levels[0].width;
+    header.pixelHeight = levels[0].height;
+    header.faceCount = 1;
+    header.levelCount = static_cast<uint32_t>(levels.size());
+    header.dfdByteOffset = static_cast<uint32_t>(sizeof(Ktx2Header) + levels.size() * sizeof(Ktx2LevelIndex));
+    header.dfdByteLength = static_cast<uint32_t>(dfd.size() * sizeof(uint32_t));
+    header.kvdByteOffset = header.dfdByteOffset + header.dfdByteLength;
+    header.kvdByteLength = static_cast<uint32_t>(kvd.size());
+    
+    // Level data is stored smallest mip first, each level aligned to lcm(texel block size, 4)
+    const uint64_t alignment = std::max(4u, textureBlockBytes(format));
+    std::vector<Ktx2LevelIndex> levelIndex(levels.size());
+    uint64_t offset = header.kvdByteOffset + header.kvdByteLength;
+    for (size_t level = levels.size(); level-- > 0; ) {
+        offset = (offset + alignment - 1) & ~(alignment - 1);
+        levelIndex[level] = {offset, levels[level].data.size(), levels[level].data.size()};
+        offset += levels[level].data.size();
+    }
+    
+    std::string tempFilename = filename + ".tmp";
+    std::ofstream file(tempFilename, std::ios::binary | std::ios::trunc);
+    if (!file.is_open())
+        return false;
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(levelIndex.data()), levelIndex.size() * sizeof(Ktx2LevelIndex));
+    file.write(reinterpret_cast<const char*>(dfd.data()), dfd.size() * sizeof(uint32_t));
+    file.write(reinterpret_cast<const char*>(kvd.data()), kvd.size());
+    uint64_t written = header.kvdByteOffset + header.kvdByteLength;
+    for (size_t level = levels.size(); level-- > 0; ) {
+        const char padding[16] = {};
+        file.write(padding, levelIndex[level].byteOffset - written);
+        file.write(reinterpret_cast<const char*>(levels[level].data.data()), levels[level].data.size());
+        written = levelIndex[level].byteOffset + levels[level].data.size();
+    }
+    file.close();
+    
+    if (!file || std::rename(tempFilename.c_str(), filename.c_str()) != 0) {
+        std::remove(tempFilename.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Builds the full mip chain of an RGBA8 sRGB image on the CPU (for offline baking, and at runtime when the texture
+// format can't be blitted with linear filtering)
+// - Gamma-correct: color is filtered in linear space and re-encoded to sRGB; alpha is filtered as-is
+// - Each level is filtered from the previous 8-bit level, like blitting does; odd edges clamp
+// - Box: 2x2 average. Kaiser: separable 6-tap Kaiser-windowed sinc (sharper, keeps more detail in distant mips)
+// - Vectorized with AVX2 (when cpuHasAvx2()), SSE2 or NEON (one RGBA pixel per 128-bit vector), with a scalar fallback; rows
+//   are split across threads
+class MipGenerator {
+public:
+    enum Filter { Box, Kaiser };
+    
+    explicit MipGenerator(Filter filter = Box) : filter(filter) {
+        // Kaiser window (alpha = 4) over a sinc with half the source bandwidth, sampled at the 6 taps around the output center
+        const double pi = 3.14159265358979323846;
+        auto besselI0 = [](double x) {
+            double sum = 1.0, term = 1.0;
+            for (int k = 1; k < 32; k++) {
+                term *= (x / (2 * k)) * (x / (2 * k));
+                sum += term;
+            }
+            return sum;
+        };
+        double total = 0.0;
+        for (int k = 0; k < KAISER_TAPS; k++) {
+            double d = k - 2.5; // Distance from the output center (between source pixels 2x and 2x+1)
+            double sinc = std::sin(pi * d / 2) / (pi * d / 2);
+            double window = besselI0(4.0 * std::sqrt(1.0 - (d / 3.0) * (d / 3.0))) / besselI0(4.0);
+            kaiserWeights[k] = static_cast<float>(sinc * window);
+            total += kaiserWeights[k];
+        }
+        for (float& weight : kaiserWeights) {
+            weight = static_cast<float>(weight / total);
+        }
+    }
+    
+    void generate(const uint8_t* pixels, uint32_t width, uint32_t height, std::vector<TextureLevel>& levels) const {
+        levels.clear();
+        levels.push_back({width, height, std::vector<uint8_t>(pixels, pixels + size_t(width) * height * 4)});
+        while (levels.back().width > 1 || levels.back().height > 1) {
+            const TextureLevel& source = levels.back();
+            TextureLevel destination{std::max(1u, source.width / 2), std::max(1u, source.height / 2), {}};
+            destination.data.resize(size_t(destination.width) * destination.height * 4);
+            size_t minRowsPerThread = std::max<size_t>(1, 16384 / destination.width); // Keep at least ~16K output pixels per thread
+            parallelFor(destination.height, minRowsPerThread, [&](size_t rowBegin, size_t rowEnd) {
+                if (filter == Kaiser) {
+                    downsampleKaiser(source, destination, static_cast<uint32_t>(rowBegin), static_cast<uint32_t>(rowEnd));
+                } else {
+                    downsampleBox(source, destination, static_cast<uint32_t>(rowBegin), static_cast<uint32_t>(rowEnd));
+                }
+            });
+            levels.push_back(std::move(destination));
+        }
+    }
+    
+    static const char* instructionSet() {
+#if defined(AVX2_DISPATCH)
+        return cpuHasAvx2() ? "AVX2" : "SSE2";
+#elif defined(__SSE2__)
+        return "SSE2";
+#elif defined(__ARM_NEON)
+        return "NEON";
+#else
+        return "scalar";
+#endif
+    }
+    
+private:
+    static const int KAISER_TAPS = 6;
+    static const uint32_t KAISER_BLOCK_ROWS = 32; // Output rows per horizontal-pass block (bounds the temporary buffer)
+    
+    Filter filter;
+    float kaiserWeights[KAISER_TAPS];
+    
+    // Lookup tables shared by all generators
+    struct Tables {
+        float decode[512];       // [0, 256): sRGB byte -> linear; [256, 512): alpha byte -> [0, 1]
+        uint8_t encode[65536];   // Linear [0, 1] in 1/65535 steps -> sRGB byte
+        
+        Tables() {
+            for (int i = 0; i < 256; i++) {
+                float c = i / 255.0f;
+                decode[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+                decode[256 + i] = c;
+            }
+            for (int i = 0; i < 65536; i++) {
+                float c = i / 65535.0f;
+                c = c <= 0.0031308f ? c * 12.92f : 1.055f * std::pow(c, 1.0f / 2.4f) - 0.055f;
+                encode[i] = static_cast<uint8_t>(std::lround(std::clamp(c, 0.0f, 1.0f) * 255.0f));
+            }
+        }
+    };
+    static const Tables& tables() {
+        static const Tables instance;
+        return instance;
+    }
+    
+    // RGBA8 sRGB -> linear float RGBA
+    static void decodeRow(const uint8_t* source, uint32_t width, float* destination) {
+        const float* decode = tables().decode;
+        size_t count = size_t(width) * 4;
+        size_t i = 0;
+#if defined(AVX2_DISPATCH)
+        if (cpuHasAvx2()) {
+            i = decodeRowAvx2(source, count, decode, destination);
+        }
+#endif
+        for (; i < count; i += 4) {
+            destination[i + 0] = decode[source[i + 0]];
+            destination[i + 1] = decode[source[i + 1]];
+            destination[i + 2] = decode[source[i + 2]];
+            destination[i + 3] = decode[256 + source[i + 3]];
+        }
+    }
+    
+    // Linear float RGBA -> RGBA8 sRGB (values are clamped to [0, 1], since Kaiser lobes can overshoot)
+    static void encodeRow(const float* source, uint32_t width, uint8_t* destination) {
+        const uint8_t* encode = tables().encode;
+        size_t count = size_t(width) * 4;
+        size_t i = 0;
+#if defined(__AVX2__) || defined(__SSE2__)
+        const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+        const __m128 scale = _mm_setr_ps(65535.0f, 65535.0f, 65535.0f, 255.0f);
+        alignas(16) int32_t quantized[4];
+        for (; i < count; i += 4) {
+            __m128 value = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(source + i), zero), one);
+            _mm_store_si128(reinterpret_cast<__m128i*>(quantized), _mm_cvtps_epi32(_mm_mul_ps(value, scale))); // Rounds to nearest
+            destination[i + 0] = encode[quantized[0]];
+            destination[i + 1] = encode[quantized[1]];
+            destination[i + 2] = encode[quantized[2]];
+            destination[i + 3] = static_cast<uint8_t>(quantized[3]);
+        }
+#elif defined(__ARM_NEON)
+        const float32x4_t zero = vdupq_n_f32(0.0f), one = vdupq_n_f32(1.0f);
+        const float32x4_t scale = {65535.0f, 65535.0f, 65535.0f, 255.0f};
+        int32_t quantized[4];
+        for (; i < count; i += 4) {
+            float32x4_t value = vminq_f32(vmaxq_f32(vld1q_f32(source + i), zero), one);
+            vst1q_s32(quantized, vcvtnq_s32_f32(vmulq_f32(value, scale)));
+            destination[i + 0] = encode[quantized[0]];
+            destination[i + 1] = encode[quantized[1]];
+            destination[i + 2] = encode[quantized[2]];
+            destination[i + 3] = static_cast<uint8_t>(quantized[3]);
+        }
+#endif
+        for (; i < count; i += 4) {
+            for (int c = 0; c < 4; c++) {
+                float value = std::clamp(source[i + c], 0.0f, 1.0f);
+                destination[i + c] = c < 3 ? encode[std::lrint(value * 65535.0f)] : static_cast<uint8_t>(std::lrint(value * 255.0f));
+            }
+        }
+    }
+    
+    void downsampleBox(const TextureLevel& source, TextureLevel& destination, uint32_t rowBegin, uint32_t rowEnd) const {
+        std::vector<float> row0(size_t(source.width) * 4), row1(size_t(source.width) * 4), output(size_t(destination.width) * 4);
+        for (uint32_t y = rowBegin; y < rowEnd; y++) {
+            decodeRow(&source.data[size_t(std::min(2 * y, source.height - 1)) * source.width * 4], source.width, row0.data());
+            decodeRow(&source.data[size_t(std::min(2 * y + 1, source.height - 1)) * source.width * 4], source.width, row1.data());
+            
+            const float* a = row0.data();
+            const float* b = row1.data();
+            float* out = output.data();
+            uint32_t x = 0;
+            if (source.width >= 2) {
+#if defined(AVX2_DISPATCH)
+                if (cpuHasAvx2()) {
+                    x = downsampleBoxAvx2(a, b, destination.width, out);
+                }
+#endif
+#if defined(__AVX2__) || defined(__SSE2__)
+                const __m128 quarter4 = _mm_set1_ps(0.25f);
+                for (; x < destination.width; x++) {
+                    __m128 sum = _mm_add_ps(_mm_add_ps(_mm_loadu_ps(a + 8 * x), _mm_loadu_ps(a + 8 * x + 4)),
+                                            _mm_add_ps(_mm_loadu_ps(b + 8 * x), _mm_loadu_ps(b + 8 * x + 4)));
+                    _mm_storeu_ps(out + 4 * x, _mm_mul_ps(sum, quarter4));
+                }
+#elif defined(__ARM_NEON)
+                for (; x < destination.width; x++) {
+                    float32x4_t sum = vaddq_f32(vaddq_f32(vld1q_f32(a + 8 * x), vld1q_f32(a + 8 * x + 4)),
+                                                vaddq_f32(vld1q_f32(b + 8 * x), vld1q_f32(b + 8 * x + 4)));
+                    vst1q_f32(out + 4 * x, vmulq_n_f32(sum, 0.25f));
+                }
+#endif
+            }
+            for (; x < destination.width; x++) {
+                uint32_t x0 = std::min(2 * x, source.width - 1), x1 = std::min(2 * x + 1, source.width - 1);
+                for (int c = 0; c < 4; c++) {
+                    out[4 * x + c] = 0.25f * (a[4 * x0 + c] + a[4 * x1 + c] + b[4 * x0 + c] + b[4 * x1 + c]);
+                }
+            }
+            encodeRow(out, destination.width, &destination.data[size_t(y) * destination.width * 4]);
+        }
+    }
+    
+    // out = sum(weights[k] * rows[k]) over count float values
+    static void weightedSum(const float* const* rows, const float* weights, size_t count, float* out) {
+        size_t i = 0;
+#if defined(AVX2_DISPATCH)
+        if (cpuHasAvx2()) {
+            i = weightedSumAvx2(rows, weights, count, out);
+        }
+#endif
+#if defined(__AVX2__) || defined(__SSE2__)
+        for (; i + 4 <= count; i += 4) {
+            __m128 sum = _mm_mul_ps(_mm_loadu_ps(rows[0] + i), _mm_set1_ps(weights[0]));
+            for (int k = 1; k < KAISER_TAPS; k++) {
+                sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(rows[k] + i), _mm_set1_ps(weights[k])));
+            }
+            _mm_storeu_ps(out + i, sum);
+        }
+#elif defined(__ARM_NEON)
+        for (; i + 4 <= count; i += 4) {
+            float32x4_t sum = vmulq_n_f32(vld1q_f32(rows[0] + i), weights[0]);
+            for (int k = 1; k < KAISER_TAPS; k++) {
+                sum = vmlaq_n_f32(sum, vld1q_f32(rows[k] + i), weights[k]);
+            }
+            vst1q_f32(out + i, sum);
+        }
+#endif
+        for (; i < count; i++) {
+            float sum = 0.0f;
+            for (int k = 0; k < KAISER_TAPS; k++) {
+                sum += rows[k][i] * weights[k];
+            }
+            out[i] = sum;
+        }
+    }
+    
+#if defined(AVX2_DISPATCH)
+    // AVX2 kernels of decodeRow(), downsampleBox() and weightedSum(); each returns how far it got, for the caller's
+    // SSE2/scalar loops to finish
+    AVX2_TARGET static size_t decodeRowAvx2(const uint8_t* source, size_t count, const float* decode, float* destination) {
+        const __m256i alphaOffset = _mm256_setr_epi32(0, 0, 0, 256, 0, 0, 0, 256);
+        size_t i = 0;
+        for (; i + 8 <= count; i += 8) {
+            __m256i bytes = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(source + i)));
+            _mm256_storeu_ps(destination + i, _mm256_i32gather_ps(decode, _mm256_add_epi32(bytes, alphaOffset), 4));
+        }
+        return i;
+    }
+    AVX2_TARGET static uint32_t downsampleBoxAvx2(const float* a, const float* b, uint32_t width, float* out) {
+        // Two output pixels per iteration: [p0 p1] and [p2 p3] -> [p0+p1 | p2+p3]
+        const __m256 quarter = _mm256_set1_ps(0.25f);
+        uint32_t x = 0;
+        for (; x + 2 <= width; x += 2) {
+            __m256 left = _mm256_add_ps(_mm256_loadu_ps(a + 8 * x), _mm256_loadu_ps(b + 8 * x));
+            __m256 right = _mm256_add_ps(_mm256_loadu_ps(a + 8 * x + 8), _mm256_loadu_ps(b + 8 * x + 8));
+            __m256 sum = _mm256_add_ps(_mm256_permute2f128_ps(left, right, 0x20), _mm256_permute2f128_ps(left, right, 0x31));
+            _mm256_storeu_ps(out + 4 * x, _mm256_mul_ps(sum, quarter));
+        }
+        return x;
+    }
+    AVX2_TARGET static size_t weightedSumAvx2(const float* const* rows, const float* weights, size_t count, float* out) {
+        size_t i = 0;
+        for (; i + 8 <= count; i += 8) {
+            __m256 sum = _mm256_mul_ps(_mm256_loadu_ps(rows[0] + i), _mm256_set1_ps(weights[0]));
+            for (int k = 1; k < KAISER_TAPS; k++) {
+                sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_loadu_ps(rows[k] + i), _mm256_set1_ps(weights[k])));
+            }
+            _mm256_storeu_ps(out + i, sum);
+        }
+        return i;
+    }
+#endif
+    
+    void downsampleKaiser(const TextureLevel& source, TextureLevel& destination, uint32_t rowBegin, uint32_t rowEnd) const {
+        // Horizontal pass into a block of filtered source rows, then vertical pass per output row
+        // - Along an axis the source doesn't shrink (size 1), the filter degenerates to a copy
+        const uint32_t dstWidth = destination.width;
+        std::vector<float> decoded(size_t(source.width) * 4);
+        std::vector<float> horizontal(size_t(2 * KAISER_BLOCK_ROWS + KAISER_TAPS) * dstWidth * 4);
+        std::vector<float> output(size_t(dstWidth) * 4);
+        
+        // Pixel k of the horizontal taps for output column x is source column clamp(2x - 2 + k)
+        for (uint32_t blockBegin = rowBegin; blockBegin < rowEnd; blockBegin += KAISER_BLOCK_ROWS) {
+            uint32_t blockEnd = std::min(rowEnd, blockBegin + KAISER_BLOCK_ROWS);
+            int64_t firstRow = int64_t(2) * blockBegin - 2;
+            int64_t lastRow = int64_t(2) * blockEnd + 3; // Exclusive
+            for (int64_t row = firstRow; row < lastRow; row++) {
+                uint32_t sourceRow = static_cast<uint32_t>(std::clamp<int64_t>(row, 0, source.height - 1));
+                decodeRow(&source.data[size_t(sourceRow) * source.width * 4], source.width, decoded.data());
+                float* filtered = &horizontal[size_t(row - firstRow) * dstWidth * 4];
+                if (source.width == 1) {
+                    memcpy(filtered, decoded.data(), 4 * sizeof(float));
+                    continue;
+                }
+                for (uint32_t x = 0; x < dstWidth; x++) {
+                    const float* taps[KAISER_TAPS];
+                    for (int k = 0; k < KAISER_TAPS; k++) {
+                        taps[k] = &decoded[size_t(std::clamp<int64_t>(int64_t(2) * x - 2 + k, 0, source.width - 1)) * 4];
+                    }
+                    weightedSum(taps, kaiserWeights, 4, filtered + 4 * x);
+                }
+            }
+            for (uint32_t y = blockBegin; y < blockEnd; y++) {
+                const float* rows[KAISER_TAPS];
+                for (int k = 0; k < KAISER_TAPS; k++) {
+                    rows[k] = &horizontal[size_t(int64_t(2) * y - 2 + k - firstRow) * dstWidth * 4];
+                }
+                if (source.height == 1) {
+                    memcpy(output.data(), rows[2], output.size() * sizeof(float));
+                } else {
+                    weightedSum(rows, kaiserWeights, output.size(), output.data());
+                }
+                encodeRow(output.data(), dstWidth, &destination.data[size_t(y) * dstWidth * 4]);
+            }
+        }
+    }
+};
+
+// Block compression of RGBA8 sRGB mip levels into BC1 or BC7 (4x4 texel blocks; edge blocks replicate the last row/column)
+// - BC1: opaque RGB at 0.5 bytes/texel, 565 endpoints on the block's principal axis refined by least squares
+// - BC7: mode 6 only (single subset RGBA, 7-bit endpoints + p-bits, 16 interpolation steps) at 1 byte/texel
+// - Works on the sRGB-encoded values, since sRGB block formats interpolate before linearizing
+// - Block rows are encoded in parallel
+class BlockCompressor {
+public:
+    static void compress(const TextureLevel& level, VkFormat format, std::vector<uint8_t>& output) {
+        const uint32_t blocksX = (level.width + 3) / 4;
+        const uint32_t blocksY = (level.height + 3) / 4;
+        const uint32_t blockBytes = textureBlockBytes(format);
+        output.resize(size_t(blocksX) * blocksY * blockBytes);
+        parallelFor(blocksY, std::max<size_t>(1, 256 / blocksX), [&](size_t begin, size_t end) {
+            uint8_t block[64];
+            for (size_t blockY = begin; blockY < end; blockY++) {
+                for (uint32_t blockX = 0; blockX < blocksX; blockX++) {
+                    loadBlock(level, blockX, static_cast<uint32_t>(blockY), block);
+                    uint8_t* out = &output[(blockY * blocksX + blockX) * blockBytes];
+                    if (format == VK_FORMAT_BC7_SRGB_BLOCK) {
+                        encodeBC7(block, out);
+                    } else {
+                        encodeBC1(block, out);
+                    }
+                }
+            }
+        });
+    }
+    
+    // Decodes blocks written by compress() back to RGBA8 (BC7 mode 6 only), for quality measurement
+    static void decompress(const uint8_t* blocks, VkFormat format, uint32_t width, uint32_t height, std::vector<uint8_t>& pixels) {
+        const uint32_t blocksX = (width + 3) / 4;
+        const uint32_t blockBytes = textureBlockBytes(format);
+        pixels.resize(size_t(width) * height * 4);
+        uint8_t block[64];
+        for (uint32_t blockY = 0; blockY < (height + 3) / 4; blockY++) {
+            for (uint32_t blockX = 0; blockX < blocksX; blockX++) {
+                const uint8_t* in = &blocks[(size_t(blockY) * blocksX + blockX) * blockBytes];
+                if (format == VK_FORMAT_BC7_SRGB_BLOCK) {
+                    decodeBC7(in, block);
+                } else {
+                    decodeBC1(in, block);
+                }
+                for (uint32_t i = 0; i < 16; i++) {
+                    uint32_t x = blockX * 4 + i % 4, y = blockY * 4 + i / 4;
+                    if (x < width && y < height) {
+                        memcpy(&pixels[(size_t(y) * width + x) * 4], &block[4 * i], 4);
+                    }
+                }
+            }
+        }
+    }
+    
+    static bool isOpaque(const TextureLevel& level) {
+        for (size_t i = 3; i < level.data.size(); i += 4) {
+            if (level.data[i] != 255)
+                return false;
+        }
+        return true;
+    }
+    
+private:
+    static constexpr uint8_t BC7_WEIGHTS[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+    
+    static void loadBlock(const TextureLevel& level, uint32_t blockX, uint32_t blockY, uint8_t* block) {
+        for (uint32_t i = 0; i < 16; i++) {
+            uint32_t x = std::min(blockX * 4 + i % 4, level.width - 1);
+            uint32_t y = std::min(blockY * 4 + i / 4, level.height - 1);
+            memcpy(&block[4 * i], &level.data[(size_t(y) * level.width + x) * 4], 4);
+        }
+    }
+    
+    // Principal axis of the block's pixels (the first `channels` components), by power iteration on the covariance
+    // - Returns false for (nearly) uniform blocks
+    static bool principalAxis(const float (*pixels)[4], int channels, const float* mean, float* axis) {
+        float covariance[4][4] = {};
+        for (int i = 0; i < 16; i++) {
+            for (int a = 0; a < channels; a++) {
+                for (int b = 0; b < channels; b++) {
+                    covariance[a][b] += (pixels[i][a] - mean[a]) * (pixels[i][b] - mean[b]);
+                }
+            }
+        }
+        for (int c = 0; c < 4; c++) {
+            axis[c] = c < channels ? 1.0f : 0.0f;
+        }
+        for (int iteration = 0; iteration < 8; iteration++) {
+            float next[4] = {};
+            float length = 0.0f;
+            for (int a = 0; a < channels; a++) {
+                for (int b = 0; b < channels; b++) {
+                    next[a] += covariance[a][b] * axis[b];
+                }
+                length += next[a] * next[a];
+            }
+            if (length < 1e-8f)
+                return false;
+            length = 1.0f / std::sqrt(length);
+            for (int a = 0; a < channels; a++) {
+                axis[a] = next[a] * length;
+            }
+        }
+        return true;
+    }
+    
+    // Initial endpoints: the extreme projections on the principal axis
+    static void initialEndpoints(const float (*pixels)[4], int channels, float* endpoint0, float* endpoint1) {
+        float mean[4] = {};
+        for (int i = 0; i < 16; i++) {
+            for (int c = 0; c < channels; c++) {
+                mean[c] += pixels[i][c] / 16.0f;
+            }
+        }
+        float axis[4];
+        float minProjection = 0.0f, maxProjection = 0.0f;
+        if (principalAxis(pixels, channels, mean, axis)) {
+            minProjection = std::numeric_limits<float>::max();
+            maxProjection = -std::numeric_limits<float>::max();
+            for (int i = 0; i < 16; i++) {
+                float projection = 0.0f;
+                for (int c = 0; c < channels; c++) {
+                    projection += (pixels[i][c] - mean[c]) * axis[c];
+                }
+                minProjection = std::min(minProjection, projection);
+                maxProjection = std::max(maxProjection, projection);
+            }
+        }
+        for (int c = 0; c < channels; c++) {
+            endpoint0[c] = std::clamp(mean[c] + axis[c] * maxProjection, 0.0f, 255.0f);
+            endpoint1[c] = std::clamp(mean[c] + axis[c] * minProjection, 0.0f, 255.0f);
+        }
+    }
+    
+    // Least-squares endpoints for fixed interpolation weights (weight of endpoint0 per pixel); false if degenerate
+    static bool refineEndpoints(const float (*pixels)[4], int channels, const float* weights, float* endpoint0, float* endpoint1) {
+        float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+        float ap[4] = {}, bp[4] = {};
+        for (int i = 0; i < 16; i++) {
+            float a = weights[i], b = 1.0f - weights[i];
+            aa += a * a;
+            ab += a * b;
+            bb += b * b;
+            for (int c = 0; c < channels; c++) {
+                ap[c] += a * pixels[i][c];
+                bp[c] += b * pixels[i][c];
+            }
+        }
+        float determinant = aa * bb - ab * ab;
+        if (std::abs(determinant) < 1e-6f)
+            return false;
+        for (int c = 0; c < channels; c++) {
+            endpoint0[c] = std::clamp((ap[c] * bb - bp[c] * ab) / determinant, 0.0f, 255.0f);
+            endpoint1[c] = std::clamp((bp[c] * aa - ap[c] * ab) / determinant, 0.0f, 255.0f);
+        }
+        return true;
+    }
+    
+    // ---- BC1 ----
+    static uint16_t pack565(const float* color) {
+        uint32_t r = static_cast<uint32_t>(std::lround(color[0] * 31.0f / 255.0f));
+        uint32_t g = static_cast<uint32_t>(std::lround(color[1] * 63.0f / 255.0f));
+        uint32_t b = static_cast<uint32_t>(std::lround(color[2] * 31.0f / 255.0f));
+        return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+    }
+    static void unpack565(uint16_t color, int* rgb) {
+        int r = (color >> 11) & 31, g = (color >> 5) & 63, b = color & 31;
+        rgb[0] = (r << 3) | (r >> 2);
+        rgb[1] = (g << 2) | (g >> 4);
+        rgb[2] = (b << 3) | (b >> 2);
+    }
+    static void bc1Palette(uint16_t color0, uint16_t color1, int (*palette)[3]) {
+        unpack565(color0, palette[0]);
+        unpack565(color1, palette[1]);
+        for (int c = 0; c < 3; c++) {
+            palette[2][c] = (2 * palette[0][c] + palette[1][c] + 1) / 3;
+            palette[3][c] = (palette[0][c] + 2 * palette[1][c] + 1) / 3;
+        }
+    }
+    
+    // Picks the nearest palette entry per pixel for endpoints color0 > color1 (4-color mode); returns the squared error
+    static float bc1Indices(const float (*pixels)[4], uint16_t color0, uint16_t color1, uint32_t& indices) {
+        int palette[4][3];
+        bc1Palette(color0, color1, palette);
+        float totalError = 0.0f;
+        indices = 0;
+        for (int i = 0; i < 16; i++) {
+            float bestError = std::numeric_limits<float>::max();
+            uint32_t bestIndex = 0;
+            for (uint32_t entry = 0; entry < (color0 == color1 ? 1u : 4u); entry++) {
+                float error = 0.0f;
+                for (int c = 0; c < 3; c++) {
+                    float difference = pixels[i][c] - palette[entry][c];
+                    error += difference * difference;
+                }
+                if (error < bestError) {
+                    bestError = error;
+                    bestIndex = entry;
+                }
+            }
+            indices |= bestIndex << (2 * i);
+            totalError += bestError;
+        }
+        return totalError;
+    }
+    
+    static void encodeBC1(const uint8_t* block, uint8_t* out) {
+        float pixels[16][4];
+        for (int i = 0; i < 16; i++) {
+            for (int c = 0; c < 4; c++) {
+                pixels[i][c] = block[4 * i + c];
+            }
+        }
+        float endpoint0[4], endpoint1[4];
+        initialEndpoints(pixels, 3, endpoint0, endpoint1);
+        
+        const float entryWeights[4] = {1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f}; // Weight of color0 per palette entry
+        uint16_t bestColor0 = 0, bestColor1 = 0;
+        uint32_t bestIndices = 0;
+        float bestError = std::numeric_limits<float>::max();
+        for (int iteration = 0; iteration < 3; iteration++) {
+            uint16_t color0 = pack565(endpoint0), color1 = pack565(endpoint1);
+            if (color0 < color1) {
+                std::swap(color0, color1); // color0 > color1 selects 4-color mode
+            }
+            uint32_t indices;
+            float error = bc1Indices(pixels, color0, color1, indices);
+            if (error < bestError) {
+                bestError = error;
+                bestColor0 = color0;
+                bestColor1 = color1;
+                bestIndices = indices;
+            }
+            if (color0 == color1)
+                break;
+            
+            float weights[16];
+            for (int i = 0; i < 16; i++) {
+                weights[i] = entryWeights[(indices >> (2 * i)) & 3];
+            }
+            int palette[4][3];
+            bc1Palette(color0, color1, palette);
+            for (int c = 0; c < 3; c++) {
+                endpoint0[c] = static_cast<float>(palette[0][c]);
+                endpoint1[c] = static_cast<float>(palette[1][c]);
+            }
+            if (!refineEndpoints(pixels, 3, weights, endpoint0, endpoint1))
+                break;
+        }
+        
+        memcpy(out, &bestColor0, 2);
+        memcpy(out + 2, &bestColor1, 2);
+        memcpy(out + 4, &bestIndices, 4);
+    }
+    static void decodeBC1(const uint8_t* in, uint8_t* block) {
+        uint16_t color0, color1;
+        uint32_t indices;
+        memcpy(&color0, in, 2);
+        memcpy(&color1, in + 2, 2);
+        memcpy(&indices, in + 4, 4);
+        int palette[4][3];
+        bc1Palette(color0, color1, palette);
+        if (color0 <= color1) {
+            // 3-color mode (never written by encodeBC1): midpoint and black
+            for (int c = 0; c < 3; c++) {
+                palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+                palette[3][c] = 0;
+            }
+        }
+        for (int i = 0; i < 16; i++) {
+            const int* color = palette[(indices >> (2 * i)) & 3];
+            block[4 * i + 0] = static_cast<uint8_t>(color[0]);
+            block[4 * i + 1] = static_cast<uint8_t>(color[1]);
+            block[4 * i + 2] = static_cast<uint8_t>(color[2]);
+            block[4 * i + 3] = 255;
+        }
+    }
+    
+    // ---- BC7 mode 6 ----
+    // Quantizes a float RGBA endpoint to 7 bits per channel plus a shared p-bit (expanded value = q << 1 | p)
+    static void quantizeBC7(const float* endpoint, int pBit, int* quantized) {
+        for (int c = 0; c < 4; c++) {
+            quantized[c] = std::clamp(static_cast<int>(std::lround((endpoint[c] - pBit) / 2.0f)), 0, 127);
+        }
+    }
+    
+    static float bc7Indices(const float (*pixels)[4], const int* expanded0, const int* expanded1, uint8_t* indices) {
+        int palette[16][4];
+        for (int entry = 0; entry < 16; entry++) {
+            for (int c = 0; c < 4; c++) {
+                palette[entry][c] = ((64 - BC7_WEIGHTS[entry]) * expanded0[c] + BC7_WEIGHTS[entry] * expanded1[c] + 32) >> 6;
+            }
+        }
+        // Project onto the endpoint segment for an initial guess, then check the neighbouring entries
+        float direction[4], lengthSquared = 0.0f;
+        for (int c = 0; c < 4; c++) {
+            direction[c] = static_cast<float>(expanded1[c] - expanded0[c]);
+            lengthSquared += direction[c] * direction[c];
+        }
+        float totalError = 0.0f;
+        for (int i = 0; i < 16; i++) {
+            int guess = 0;
+            if (lengthSquared > 0.0f) {
+                float t = 0.0f;
+                for (int c = 0; c < 4; c++) {
+                    t += (pixels[i][c] - expanded0[c]) * direction[c];
+                }
+                t = std::clamp(t / lengthSquared, 0.0f, 1.0f) * 15.0f;
+                guess = static_cast<int>(std::lround(t));
+            }
+            float bestError = std::numeric_limits<float>::max();
+            for (int entry = std::max(0, guess - 1); entry <= std::min(15, guess + 1); entry++) {
+                float error = 0.0f;
+                for (int c = 0; c < 4; c++) {
+                    float difference = pixels[i][c] - palette[entry][c];
+                    error += difference * difference;
+                }
+                if (error < bestError) {
+                    bestError = error;
+                    indices[i] = static_cast<uint8_t>(entry);
+                }
+            }
+            totalError += bestError;
+        }
+        return totalError;
+    }
+    
+    static void encodeBC7(const uint8_t* block, uint8_t* out) {
+        float pixels[16][4];
+        for (int i = 0; i < 16; i++) {
+            for (int c = 0; c < 4; c++) {
+                pixels[i][c] = block[4 * i + c];
+            }
+        }
+        float endpoint0[4], endpoint1[4];
+        initialEndpoints(pixels, 4, endpoint0, endpoint1);
+        
+        int bestQuantized0[4] = {}, bestQuantized1[4] = {}, bestP0 = 0, bestP1 = 0;
+        uint8_t bestIndices[16] = {};
+        float bestError = std::numeric_limits<float>::max();
+        for (int iteration = 0; iteration < 3; iteration++) {
+            uint8_t indices[16];
+            for (int pBits = 0; pBits < 4; pBits++) {
+                int p0 = pBits & 1, p1 = pBits >> 1;
+                int quantized0[4], quantized1[4], expanded0[4], expanded1[4];
+                quantizeBC7(endpoint0, p0, quantized0);
+                quantizeBC7(endpoint1, p1, quantized1);
+                for (int c = 0; c < 4; c++) {
+                    expanded0[c] = (quantized0[c] << 1) | p0;
+                    expanded1[c] = (quantized1[c] << 1) | p1;
+                }
+                float error = bc7Indices(pixels, expanded0, expanded1, indices);
+                if (error < bestError) {
+                    bestError = error;
+                    memcpy(bestQuantized0, quantized0, sizeof(quantized0));
+                    memcpy(bestQuantized1, quantized1, sizeof(quantized1));
+                    bestP0 = p0;
+                    bestP1 = p1;
+                    memcpy(bestIndices, indices, sizeof(indices));
+                }
+            }
+            if (bestError == 0.0f)
+                break;
+            
+            float weights[16];
+            for (int i = 0; i < 16; i++) {
+                weights[i] = 1.0f - BC7_WEIGHTS[bestIndices[i]] / 64.0f;
+            }
+            if (!refineEndpoints(pixels, 4, weights, endpoint0, endpoint1))
+                break;
+        }
+        
+        // The anchor (pixel 0) index is stored with 3 bits, so its top bit must be 0: swap endpoints if needed
+        if (bestIndices[0] & 8) {
+            std::swap(bestQuantized0, bestQuantized1);
+            std::swap(bestP0, bestP1);
+            for (uint8_t& index : bestIndices) {
+                index = 15 - index;
+            }
+        }
+        
+        uint64_t bits[2] = {};
+        int position = 0;
+        auto write = [&bits, &position](uint64_t value, int count) {
+            for (int i = 0; i < count; i++, position++) {
+                bits[position / 64] |= ((value >> i) & 1) << (position % 64);
+            }
+        };
+        write(1 << 6, 7); // Mode 6
+        for (int c = 0; c < 4; c++) {
+            write(bestQuantized0[c], 7);
+            write(bestQuantized1[c], 7);
+        }
+        write(bestP0, 1);
+        write(bestP1, 1);
+        write(bestIndices[0], 3);
+        for (int i = 1; i < 16; i++) {
+            write(bestIndices[i], 4);
+        }
+        memcpy(out, bits, 16);
+    }
+    static void decodeBC7(const uint8_t* in, uint8_t* block) {
+        uint64_t bits[2];
+        memcpy(bits, in, 16);
+        int position = 0;
+        auto read = [&bits, &position](int count) {
+            uint32_t value = 0;
+            for (int i = 0; i < count; i++, position++) {
+                value |= static_cast<uint32_t>((bits[position / 64] >> (position % 64)) & 1) << i;
+            }
+            return value;
+        };
+        if (read(7) != (1 << 6)) {
+            memset(block, 0, 64); // Only mode 6 is produced by encodeBC7
+            return;
+        }
+        int expanded0[4], expanded1[4];
+        for (int c = 0; c < 4; c++) {
+            expanded0[c] = static_cast<int>(read(7)) << 1;
+            expanded1[c] = static_cast<int>(read(7)) << 1;
+        }
+        int p0 = static_cast<int>(read(1)), p1 = static_cast<int>(read(1));
+        for (int c = 0; c < 4; c++) {
+            expanded0[c] |= p0;
+            expanded1[c] |= p1;
+        }
+        for (int i = 0; i < 16; i++) {
+            uint32_t index = read(i == 0 ? 3 : 4);
+            for (int c = 0; c < 4; c++) {
+                block[4 * i + c] = static_cast<uint8_t>(((64 - BC7_WEIGHTS[index]) * expanded0[c] + BC7_WEIGHTS[index] * expanded1[c] + 32) >> 6);
+            }
+        }
+    }
+};
+
+// Texel format of a baked container
+// - BlockCompressed: BC1 for opaque textures (unless BC7_OPAQUE_TEXTURES), BC7 otherwise
+enum class TextureEncoding { Rgba8, Bc1, Bc7, BlockCompressed };
+
+// Source hash stored in a container, seeded with the bake settings so changing them also triggers a rebake
+// - Seeded with the format the encoding resolved to rather than the encoding, so a container baked offline as bc1/bc7
+//   matches the runtime's BlockCompressed check whenever it holds the format the runtime accepts
+inline uint64_t textureBakeHash(const void* source, size_t size, VkFormat format) {
+    const uint32_t settings[3] = {static_cast<uint32_t>(format), KAISER_MIP_FILTER, BC7_OPAQUE_TEXTURES};
+    return hashBytes(source, size, hashBytes(settings, sizeof(settings)));
+}
+
+// Decodes an image file, builds its mip chain, optionally block-compresses it and writes it as a KTX2 container
+inline bool bakeTexture(const std::string& sourceFilename, const std::string& containerFilename, TextureEncoding encoding = TextureEncoding::Rgba8) {
+    MappedFile source;
+    if (!source.open(sourceFilename)) {
+        std::cerr << "Failed to open texture source " << sourceFilename << std::endl;
+        return false;
+    }
+    int width, height, channels;
+    stbi_uc* pixels = stbi_load_from_memory(source.data, static_cast<int>(source.size), &width, &height, &channels, STBI_rgb_alpha);
+    if (!pixels) {
+        std::cerr << "Failed to decode texture source " << sourceFilename << std::endl;
+        return false;
+    }
+    std::vector<TextureLevel> levels;
+    MipGenerator(KAISER_MIP_FILTER ? MipGenerator::Kaiser : MipGenerator::Box).generate(pixels, static_cast<uint32_t>(width), static_cast<uint32_t>(height), levels);
+    stbi_image_free(pixels);
+    
+    VkFormat format = VK_FORMAT_R8G8B8A8_SRGB;
+    if (encoding == TextureEncoding::Bc1 || (encoding == TextureEncoding::BlockCompressed && !BC7_OPAQUE_TEXTURES && BlockCompressor::isOpaque(levels[0]))) {
+        format = VK_FORMAT_BC1_RGB_SRGB_BLOCK;
+    } else if (encoding != TextureEncoding::Rgba8) {
+        format = VK_FORMAT_BC7_SRGB_BLOCK;
+    }
+    if (format != VK_FORMAT_R8G8B8A8_SRGB) {
+        
+        // Compress every level, and report level 0's quality (PSNR over the channels the format stores)
+        auto startTime = std::chrono::high_resolution_clock::now();
+        std::vector<uint8_t> compressed, decompressed;
+        double squaredError = 0.0;
+        uint64_t pixelCount = 0;
+        for (TextureLevel& level : levels) {
+            pixelCount += uint64_t(level.width) * level.height;
+            BlockCompressor::compress(level, format, compressed);
+            if (&level == &levels[0]) {
+                BlockCompressor::decompress(compressed.data(), format, level.width, level.height, decompressed);
+                int channels = format == VK_FORMAT_BC1_RGB_SRGB_BLOCK ? 3 : 4;
+                for (size_t i = 0; i < decompressed.size(); i++) {
+                    if (int(i % 4) < channels) {
+                        double difference = double(decompressed[i]) - level.data[i];
+                        squaredError += difference * difference;
+                    }
+                }
+                squaredError /= double(level.width) * level.height * channels;
+            }
+            level.data.swap(compressed);
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count();
+        std::cout << "Compressed " << levels.size() << " levels to " << (format == VK_FORMAT_BC1_RGB_SRGB_BLOCK ? "BC1" : "BC7") << " in "
+                  << seconds * 1000.0 << " ms (" << double(pixelCount) / 1e6 / seconds << " MPixels/s), level 0 PSNR "
+                  << (squaredError > 0.0 ? 10.0 * std::log10(255.0 * 255.0 / squaredError) : std::numeric_limits<double>::infinity()) << " dB" << std::endl;
+    }
+    
+    if (!writeKtx2(containerFilename, format, levels, textureBakeHash(source.data, source.size, format))) {
+        std::cerr << "Failed to write texture container " << containerFilename << std::endl;
+        return false;
+    }
+    return true;
+}
+
+//const std::vector<Vertex> vertices = {
+//    // Top square
+//    {{-0.5f, -0.5f, 0.0f}, {1.0f, 0.0f, 0.0f}, {1.0f, 0.0f}},
+//    {{0.5f, -0.5f, 0.0f}, {0.0f, 1.0f, 0.0f}, {0.0f, 0.0f}},
+//    {{0.5f, 0.5f, 0.0f}, {0.0f, 0.0f, 1.0f}, {0.0f, 1.0f}},
+//    {{-0.5f, 0.5f, 0.0f}, {1.0f, 1.0f, 1.0f}, {1.0f, 1.0f}},
+//    // Bottom square
+//    {{-0.5f, -0.5f, -0.5f}, {1.0f, 0.0f, 0.0f}, {1.0f, 0.0f}},
+//    {{0.5f, -0.5f, -0.5f}, {0.0f, 1.0f, 0.0f}, {0.0f, 0.0f}},
+//    {{0.5f, 0.5f, -0.5f}, {0.0f, 0.0f, 1.0f}, {0.0f, 1.0f}},
+//    {{-0.5f, 0.5f, -0.5f}, {1.0f, 1.0f, 1.0f}, {1.0f, 1.0f}}
+//};
+//
+//const std::vector<uint16_t> indices = {
+//    // Top square
+//    0, 1, 2, 2, 3, 0,
+//    // Bottom square
+//    4, 5, 6, 6, 7, 4
+//};
+
+// A range of device memory handed out by DeviceMemoryAllocator
+struct Allocation {
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize offset = 0;
+    VkDeviceSize size = 0; // Requested size
+    void* mapped = nullptr; // Host pointer to the allocation's first byte, for host-visible memory types
+    uint32_t memoryType = 0;
+    uint32_t block = UINT32_MAX; // Index of the owning block, or UINT32_MAX for a dedicated allocation
+    uint32_t order = 0; // Buddy order (the range spans MIN_ALLOCATION << order bytes)
+};
+
+// Where an allocation may go: a memory type must have every required flag; among those, each preferred flag a type has
+// raises its score and each avoided flag lowers it
+struct MemoryUsage {
+    VkMemoryPropertyFlags required = 0;
+    VkMemoryPropertyFlags preferred = 0;
+    VkMemoryPropertyFlags avoided = 0;
+};
+// Static geometry, textures and attachments: the fastest device-local heap, but not its (often small) host-visible window
+const MemoryUsage MEMORY_USAGE_GPU_ONLY = {0, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT};
+// Staging buffers: written once by the CPU, read once by a copy
+const MemoryUsage MEMORY_USAGE_UPLOAD = {VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, 0, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT};
+// Uniform data: written by the CPU every frame and read directly by shaders
+const MemoryUsage MEMORY_USAGE_DYNAMIC = {VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, VK_MEMORY_PROPERTY_HOST_CACHED_BIT};
+// Attachments whose contents never leave the render pass (images created with VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT):
+// lazily allocated memory where the device has it (tile-based GPUs keep them in tile memory), plain device-local otherwise
+const MemoryUsage MEMORY_USAGE_TRANSIENT = {0, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT};
+
+// Sub-allocates device memory from large blocks per memory type, so the number of vkAllocateMemory calls stays far below
+// maxMemoryAllocationCount
+// - Blocks are BLOCK_SIZE (smaller on small heaps) and split with a buddy allocator: every range is a power of two and aligned
+//   to its size, which satisfies any (power-of-two) alignment requirement
+// - Buffers/linear images and optimal-tiling images never share a block, so bufferImageGranularity can't apply between neighbours
+// - Requests over half a block get a dedicated VkDeviceMemory, as does all lazily allocated memory (its commitment can only
+//   be queried per VkDeviceMemory, so each transient attachment needs its own to be measured)
+// - Host-visible memory is mapped once for the lifetime of its block
+// - Placement: memory types are ranked by MemoryUsage score; new device memory goes to the best-ranked type whose heap stays
+//   within budget (VK_EXT_memory_budget when enabled, otherwise 80% of the heap size minus our own usage)
+// - Not thread-safe; allocate and free on the thread that owns the device
+class DeviceMemoryAllocator {
+public:
+    enum ResourceKind { Linear, Optimal };
+    
+    static constexpr VkDeviceSize BLOCK_SIZE = VkDeviceSize(64) << 20;
+    static constexpr VkDeviceSize MIN_ALLOCATION = 256;
+    
+    struct HeapBudget {
+        VkDeviceSize usage = 0; // Process-wide with VK_EXT_memory_budget, otherwise this allocator's
+        VkDeviceSize budget = 0;
+        bool deviceLocal = false;
+    };
+    struct Statistics {
+        uint32_t blockCount = 0;
+        uint32_t dedicatedCount = 0;
+        uint32_t allocationCount = 0; // Sub-allocations
+        VkDeviceSize blockBytes = 0;
+        VkDeviceSize dedicatedBytes = 0;
+        VkDeviceSize usedBytes = 0; // Requested sizes of sub-allocations
+        VkDeviceSize roundedBytes = 0; // Sizes after rounding up to a power of two
+        VkDeviceSize freeBytes = 0;
+        VkDeviceSize largestFreeRange = 0;
+        uint32_t deviceAllocationCalls = 0;
+        uint32_t budgetFallbacks = 0; // Allocations placed in a lower-ranked memory type because the best heap was over budget
+        std::vector<HeapBudget> heaps;
+    };
+    
+    // getMemoryProperties2: vkGetPhysicalDeviceMemoryProperties2KHR when VK_EXT_memory_budget is enabled, else nullptr
+    void init(VkPhysicalDevice physicalDevice, VkDevice device, PFN_vkGetPhysicalDeviceMemoryProperties2KHR getMemoryProperties2) {
+        this->physicalDevice = physicalDevice;
+        this->device = device;
+        this->getMemoryProperties2 = getMemoryProperties2;
+        vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+        updateBudget();
+    }
+    
+    Allocation allocate(const VkMemoryRequirements& requirements, const MemoryUsage& usage, ResourceKind kind) {
+        std::vector<uint32_t> memoryTypes = rankMemoryTypes(requirements.memoryTypeBits, usage);
+        if (memoryTypes.empty()) {
+            throw std::runtime_error("Failed to find suitable memory type!");
+        }
+        
+        // Best-ranked type that fits its heap's budget; when every heap is over budget, the best-ranked type regardless
+        Allocation allocation;
+        for (uint32_t memoryType : memoryTypes) {
+            if (allocateFromType(requirements, memoryType, kind, true, allocation)) {
+                if (memoryType != memoryTypes[0]) {
+                    budgetFallbacks++;
+                }
+                return allocation;
+            }
+        }
+        if (!allocateFromType(requirements, memoryTypes[0], kind, false, allocation)) {
+            throw std::runtime_error("Failed to allocate device memory!");
+        }
+        return allocation;
+    }
+    
+    void free(Allocation& allocation) {
+        if (allocation.memory == VK_NULL_HANDLE)
+            return;
+        if (allocation.block == UINT32_MAX) {
+            freeDeviceMemory(allocation.memory, allocation.size, allocation.memoryType); // Implicitly unmaps
+            dedicatedBytes -= allocation.size;
+            dedicatedCount--;
+            allocation = Allocation{};
+            return;
+        }
+        
+        // Merge with the buddy while it is free
+        Block& block = blocks[allocation.block];
+        VkDeviceSize offset = allocation.offset;
+        uint32_t order = allocation.order;
+        while (order + 1 < block.freeRanges.size()) {
+            auto buddy = block.freeRanges[order].find(offset ^ (MIN_ALLOCATION << order));
+            if (buddy == block.freeRanges[order].end())
+                break;
+            block.freeRanges[order].erase(buddy);
+            offset &= ~(MIN_ALLOCATION << order);
+            order++;
+        }
+        block.freeRanges[order].insert(offset);
+        block.allocationCount--;
+        block.usedBytes -= allocation.size;
+        block.roundedBytes -= MIN_ALLOCATION << allocation.order;
+        
+        // Keep at most one empty block per memory type and kind, to absorb allocate/free cycles of staging buffers
+        if (block.allocationCount == 0) {
+            for (Block& other : blocks) {
+                if (&other != &block && other.memory != VK_NULL_HANDLE && other.allocationCount == 0 &&
+                    other.memoryType == block.memoryType && other.kind == block.kind) {
+                    releaseBlock(block);
+                    break;
+                }
+            }
+        }
+        allocation = Allocation{};
+    }
+    
+    // Frees every block (all resources using them must have been destroyed)
+    void destroy() {
+        for (Block& block : blocks) {
+            releaseBlock(block);
+        }
+        blocks.clear();
+    }
+    
+    // Refreshes the VK_EXT_memory_budget snapshot; called automatically every few device memory allocations
+    void updateBudget() {
+        if (!getMemoryProperties2)
+            return;
+        VkPhysicalDeviceMemoryBudgetPropertiesEXT budgetProperties{};
+        budgetProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+        VkPhysicalDeviceMemoryProperties2 properties{};
+        properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+        properties.pNext = &budgetProperties;
+        getMemoryProperties2(physicalDevice, &properties);
+        for (uint32_t heap = 0; heap < memoryProperties.memoryHeapCount; heap++) {
+            budgetSnapshot[heap] = {budgetProperties.heapUsage[heap], budgetProperties.heapBudget[heap]};
+            heapUsageAtSnapshot[heap] = heapUsage[heap];
+        }
+        deviceMemoryChangesSinceSnapshot = 0;
+    }
+    
+    VkMemoryPropertyFlags memoryTypeFlags(uint32_t memoryType) const {
+        return memoryProperties.memoryTypes[memoryType].propertyFlags;
+    }
+    
+    HeapBudget heapBudget(uint32_t heap) const {
+        HeapBudget budget;
+        budget.deviceLocal = memoryProperties.memoryHeaps[heap].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT;
+        if (getMemoryProperties2) {
+            // Driver-reported usage plus our own changes since the snapshot
+            int64_t change = int64_t(heapUsage[heap]) - int64_t(heapUsageAtSnapshot[heap]);
+            budget.usage = static_cast<VkDeviceSize>(std::max<int64_t>(0, int64_t(budgetSnapshot[heap].usage) + change));
+            budget.budget = budgetSnapshot[heap].budget;
+        } else {
+            budget.usage = heapUsage[heap];
+            budget.budget = memoryProperties.memoryHeaps[heap].size / 10 * 8;
+        }
+        return budget;
+    }
+    
+    Statistics statistics() const {
+        Statistics statistics;
+        for (const Block& block : blocks) {
+            if (block.memory == VK_NULL_HANDLE)
+                continue;
+            statistics.blockCount++;
+            statistics.allocationCount += block.allocationCount;
+            statistics.blockBytes += block.size;
+            statistics.usedBytes += block.usedBytes;
+            statistics.roundedBytes += block.roundedBytes;
+            statistics.freeBytes += block.size - block.roundedBytes;
+            for (uint32_t order = static_cast<uint32_t>(block.freeRanges.size()); order-- > 0; ) {
+                if (!block.freeRanges[order].empty()) {
+                    statistics.largestFreeRange = std::max(statistics.largestFreeRange, MIN_ALLOCATION << order);
+                    break;
+                }
+            }
+        }
+        statistics.dedicatedCount = dedicatedCount;
+        statistics.dedicatedBytes = dedicatedBytes;
+        statistics.deviceAllocationCalls = deviceAllocationCalls;
+        statistics.budgetFallbacks = budgetFallbacks;
+        for (uint32_t heap = 0; heap < memoryProperties.memoryHeapCount; heap++) {
+            statistics.heaps.push_back(heapBudget(heap));
+        }
+        return statistics;
+    }
+    
+private:
+    struct Block {
+        VkDeviceMemory memory = VK_NULL_HANDLE; // VK_NULL_HANDLE once released (the slot is reused)
+        VkDeviceSize size = 0;
+        uint32_t memoryType = 0;
+        ResourceKind kind = Linear;
+        void* mapped = nullptr;
+        std::vector<std::set<VkDeviceSize>> freeRanges; // Offsets of free ranges per order
+        uint32_t allocationCount = 0;
+        VkDeviceSize usedBytes = 0;
+        VkDeviceSize roundedBytes = 0;
+    };
+    
+    static constexpr uint32_t BUDGET_UPDATE_INTERVAL = 16; // Device memory allocations/frees between budget queries
+    
+    VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+    VkDevice device = VK_NULL_HANDLE;
+    PFN_vkGetPhysicalDeviceMemoryProperties2KHR getMemoryProperties2 = nullptr;
+    VkPhysicalDeviceMemoryProperties memoryProperties{};
+    std::vector<Block> blocks;
+    uint32_t dedicatedCount = 0;
+    VkDeviceSize dedicatedBytes = 0;
+    uint32_t deviceAllocationCalls = 0;
+    uint32_t budgetFallbacks = 0;
+    // Per-heap usage of this allocator, and the last VK_EXT_memory_budget snapshot
+    std::array<VkDeviceSize, VK_MAX_MEMORY_HEAPS> heapUsage{};
+    std::array<VkDeviceSize, VK_MAX_MEMORY_HEAPS> heapUsageAtSnapshot{};
+    std::array<HeapBudget, VK_MAX_MEMORY_HEAPS> budgetSnapshot{};
+    uint32_t deviceMemoryChangesSinceSnapshot = 0;
+    
+    // Memory types allowed by typeBits that have the required flags, best score first (ties keep the driver's order,
+    // which lists faster types first)
+    std::vector<uint32_t> rankMemoryTypes(uint32_t typeBits, const MemoryUsage& usage) const {
+        const VkMemoryPropertyFlags special = VK_MEMORY_PROPERTY_PROTECTED_BIT | VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT;
+        std::vector<std::pair<int, uint32_t>> scored;
+        for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
+            VkMemoryPropertyFlags flags = memoryProperties.memoryTypes[i].propertyFlags;
+            if (!(typeBits & (1u << i)) || (flags & usage.required) != usage.required ||
+                (flags & special & ~(usage.required | usage.preferred)))
+                continue;
+            int score = 4 * std::popcount(flags & usage.preferred) - 4 * std::popcount(flags & usage.avoided)
+                      - std::popcount(flags & ~(usage.required | usage.preferred | usage.avoided)); // Slightly prefer plain types
+            scored.emplace_back(-score, i);
+        }
+        std::stable_sort(scored.begin(), scored.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+        std::vector<uint32_t> memoryTypes;
+        for (const auto& candidate : scored) {
+            memoryTypes.push_back(candidate.second);
+        }
+        return memoryTypes;
+    }
+    
+    bool fitsBudget(uint32_t memoryType, VkDeviceSize size) {
+        if (getMemoryProperties2 && deviceMemoryChangesSinceSnapshot >= BUDGET_UPDATE_INTERVAL) {
+            updateBudget();
+        }
+        HeapBudget budget = heapBudget(memoryProperties.memoryTypes[memoryType].heapIndex);
+        return budget.usage + size <= budget.budget;
+    }
+    
+    // Sub-allocates from an existing block of the type, or creates a block (or a dedicated allocation) if the heap has room
+    bool allocateFromType(const VkMemoryRequirements& requirements, uint32_t memoryType, ResourceKind kind, bool respectBudget, Allocation& allocation) {
+        allocation = Allocation{};
+        allocation.size = requirements.size;
+        allocation.memoryType = memoryType;
+        VkDeviceSize blockSize = blockSizeFor(memoryType);
+        VkDeviceSize rangeSize = std::bit_ceil(std::max({requirements.size, requirements.alignment, MIN_ALLOCATION}));
+        bool lazilyAllocated = memoryProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT;
+        if (rangeSize > blockSize / 2 || lazilyAllocated) {
+            if (respectBudget && !fitsBudget(memoryType, requirements.size))
+                return false;
+            allocation.memory = allocateDeviceMemory(requirements.size, memoryType, &allocation.mapped);
+            if (allocation.memory == VK_NULL_HANDLE)
+                return false;
+            dedicatedBytes += requirements.size;
+            dedicatedCount++;
+            return true;
+        }
+        allocation.order = static_cast<uint32_t>(std::countr_zero(rangeSize / MIN_ALLOCATION));
+        
+        // First block of this type and kind with a free range of the order or larger; otherwise a new block
+        for (uint32_t blockIndex = 0; blockIndex < blocks.size(); blockIndex++) {
+            if (blocks[blockIndex].memoryType == memoryType && blocks[blockIndex].kind == kind && allocateFromBlock(blockIndex, allocation))
+                return true;
+        }
+        if (respectBudget && !fitsBudget(memoryType, blockSize))
+            return false;
+        uint32_t blockIndex = createBlock(memoryType, kind, blockSize);
+        return blockIndex != UINT32_MAX && allocateFromBlock(blockIndex, allocation);
+    }
+    
+    VkDeviceSize blockSizeFor(uint32_t memoryTypeIndex) const {
+        // Small heaps (e.g. 256 MB device-local host-visible windows) get proportionally smaller blocks
+        VkDeviceSize heapSize = memoryProperties.memoryHeaps[memoryProperties.memoryTypes[memoryTypeIndex].heapIndex].size;
+        return std::max(MIN_ALLOCATION * 16, std::min(BLOCK_SIZE, std::bit_floor(heapSize / 8)));
+    }
+    
+    VkDeviceMemory allocateDeviceMemory(VkDeviceSize size, uint32_t memoryTypeIndex, void** mapped) {
+        VkMemoryAllocateInfo allocateInfo{};
+        allocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        allocateInfo.allocationSize = size;
+        allocateInfo.memoryTypeIndex = memoryTypeIndex;
+        
+        VkDeviceMemory memory;
+        if (vkAllocateMemory(device, &allocateInfo, nullptr, &memory) != VK_SUCCESS)
+            return VK_NULL_HANDLE; // e.g. out of device memory; the caller tries the next memory type
+        deviceAllocationCalls++;
+        heapUsage[memoryProperties.memoryTypes[memoryTypeIndex].heapIndex] += size;
+        deviceMemoryChangesSinceSnapshot++;
+        
+        *mapped = nullptr;
+        if (memoryProperties.memoryTypes[memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+            vkMapMemory(device, memory, 0, VK_WHOLE_SIZE, 0, mapped); // "Persistent" mapping
+        }
+        return memory;
+    }
+    void freeDeviceMemory(VkDeviceMemory memory, VkDeviceSize size, uint32_t memoryTypeIndex) {
+        vkFreeMemory(device, memory, nullptr);
+        heapUsage[memoryProperties.memoryTypes[memoryTypeIndex].heapIndex] -= size;
+        deviceMemoryChangesSinceSnapshot++;
+    }
+    
+    // Takes a range of allocation.order from the block, splitting a larger free range if needed
+    bool allocateFromBlock(uint32_t blockIndex, Allocation& allocation) {
+        Block& block = blocks[blockIndex];
+        if (block.memory == VK_NULL_HANDLE)
+            return false;
+        uint32_t order = allocation.order;
+        while (order < block.freeRanges.size() && block.freeRanges[order].empty()) {
+            order++;
+        }
+        if (order >= block.freeRanges.size())
+            return false;
+        
+        // Lowest free offset first, keeping the upper halves of split ranges free
+        VkDeviceSize offset = *block.freeRanges[order].begin();
+        block.freeRanges[order].erase(block.freeRanges[order].begin());
+        while (order > allocation.order) {
+            order--;
+            block.freeRanges[order].insert(offset + (MIN_ALLOCATION << order));
+        }
+        block.allocationCount++;
+        block.usedBytes += allocation.size;
+        block.roundedBytes += MIN_ALLOCATION << allocation.order;
+        
+        allocation.memory = block.memory;
+        allocation.offset = offset;
+        allocation.block = blockIndex;
+        if (block.mapped) {
+            allocation.mapped = static_cast<uint8_t*>(block.mapped) + offset;
+        }
+        return true;
+    }
+    
+    uint32_t createBlock(uint32_t memoryTypeIndex, ResourceKind kind, VkDeviceSize size) {
+        Block block;
+        block.memory = allocateDeviceMemory(size, memoryTypeIndex, &block.mapped);
+        if (block.memory == VK_NULL_HANDLE)
+            return UINT32_MAX;
+        block.size = size;
+        block.memoryType = memoryTypeIndex;
+        block.kind = kind;
+        block.freeRanges.resize(std::countr_zero(size / MIN_ALLOCATION) + 1);
+        block.freeRanges.back().insert(0);
+        
+        // Reuse a released slot, so indices held by live allocations stay valid
+        for (uint32_t blockIndex = 0; blockIndex < blocks.size(); blockIndex++) {
+            if (blocks[blockIndex].memory == VK_NULL_HANDLE) {
+                blocks[blockIndex] = std::move(block);
+                return blockIndex;
+            }
+        }
+        blocks.push_back(std::move(block));
+        return static_cast<uint32_t>(blocks.size() - 1);
+    }
+    
+    void releaseBlock(Block& block) {
+        if (block.memory != VK_NULL_HANDLE) {
+            freeDeviceMemory(block.memory, block.size, block.memoryType);
+        }
+        block = Block{};
+    }
+};
+
+// Persistently mapped upload buffer that all staging data is sub-allocated from, in FIFO order
+// - Every submission that reads ring regions gets a serial number and a fence from a small pool; regions are reclaimed
+//   once every submission up to theirs has completed
+// - A region that is never submitted must be discarded, or it holds back everything allocated after it
+// - Not thread-safe; allocate and submit on the thread that owns the device
+class StagingRing {
+public:
+    struct Region {
+        VkDeviceSize offset = 0; // Into buffer()
+        VkDeviceSize size = 0;
+        uint8_t* data = nullptr;
+    };
+    struct Submission {
+        uint64_t serial = 0;
+        VkFence fence = VK_NULL_HANDLE; // For the vkQueueSubmit that reads the regions
+    };
+    struct Statistics {
+        VkDeviceSize size = 0;
+        VkDeviceSize uploadedBytes = 0;
+        VkDeviceSize peakUsage = 0;
+        uint32_t allocationCount = 0;
+        uint32_t submissionCount = 0;
+        uint32_t waitCount = 0; // Allocations that had to wait for the GPU to release space
+    };
+    
+    void init(VkDevice device, VkBuffer buffer, void* mapped, VkDeviceSize size) {
+        this->device = device;
+        ringBuffer = buffer;
+        ringData = static_cast<uint8_t*>(mapped);
+        ringSize = size;
+    }
+    VkBuffer buffer() const {
+        return ringBuffer;
+    }
+    
+    // Returns false when the ring has no room until in-flight submissions complete
+    bool tryAllocate(VkDeviceSize size, VkDeviceSize alignment, Region& region) {
+        reclaim();
+        size = std::max<VkDeviceSize>(size, 1);
+        VkDeviceSize offset = 0;
+        if (segments.empty()) {
+            head = 0;
+            if (size > ringSize)
+                return false;
+        } else {
+            // Live segments span [tail, head) when head > tail, otherwise [tail, end) + [0, head)
+            VkDeviceSize tail = segments.front().begin;
+            offset = (head + alignment - 1) / alignment * alignment;
+            if (head > tail && offset + size > ringSize) {
+                offset = 0; // Wrap; the bytes after head are skipped
+            }
+            VkDeviceSize limit = head > tail && offset > 0 ? ringSize : tail;
+            if (offset + size > limit)
+                return false;
+        }
+        segments.push_back({offset, offset + size, PENDING});
+        head = offset + size;
+        region = {offset, size, ringData + offset};
+        
+        VkDeviceSize tail = segments.front().begin;
+        peakUsage = std::max(peakUsage, head > tail ? head - tail : ringSize - tail + head);
+        uploadedBytes += size;
+        allocationCount++;
+        return true;
+    }
+    // Waits for in-flight submissions to release space when necessary
+    Region allocate(VkDeviceSize size, VkDeviceSize alignment) {
+        Region region;
+        while (!tryAllocate(size, alignment, region)) {
+            if (size > ringSize) {
+                throw std::runtime_error("Staging upload is larger than STAGING_RING_SIZE!");
+            }
+            if (inFlight.empty()) {
+                throw std::runtime_error("Staging ring is full of regions that haven't been submitted!");
+            }
+            vkWaitForFences(device, 1, &inFlight.front().fence, VK_TRUE, UINT64_MAX);
+            waitCount++;
+        }
+        return region;
+    }
+    
+    // Call right before vkQueueSubmit with the returned fence; the regions are reclaimed after that submission completes
+    Submission submit(const std::vector<Region>& regions) {
+        Submission submission;
+        submission.serial = ++submittedSerial;
+        if (!freeFences.empty()) {
+            submission.fence = freeFences.back();
+            freeFences.pop_back();
+        } else {
+            VkFenceCreateInfo fenceInfo{};
+            fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+            if (vkCreateFence(device, &fenceInfo, nullptr, &submission.fence) != VK_SUCCESS) {
+                throw std::runtime_error("Failed to create staging ring fence!");
+            }
+        }
+        inFlight.push_back(submission);
+        for (const Region& region : regions) {
+            findSegment(region).serial = submission.serial;
+        }
+        submissionCount++;
+        return submission;
+    }
+    // Releases a region that won't be submitted
+    void discard(const Region& region) {
+        findSegment(region).serial = 0;
+        reclaim();
+    }
+    bool isComplete(uint64_t serial) const {
+        return serial <= completedSerial;
+    }
+    void reclaim() {
+        while (!inFlight.empty() && vkGetFenceStatus(device, inFlight.front().fence) == VK_SUCCESS) {
+            completedSerial = inFlight.front().serial;
+            vkResetFences(device, 1, &inFlight.front().fence);
+            freeFences.push_back(inFlight.front().fence);
+            inFlight.pop_front();
+        }
+        while (!segments.empty() && segments.front().serial <= completedSerial) {
+            segments.pop_front();
+        }
+    }
+    
+    // Destroys the fences; the buffer belongs to the caller
+    void destroy() {
+        for (const Submission& submission : inFlight) {
+            vkDestroyFence(device, submission.fence, nullptr);
+        }
+        for (VkFence fence : freeFences) {
+            vkDestroyFence(device, fence, nullptr);
+        }
+        inFlight.clear();
+        freeFences.clear();
+        segments.clear();
+    }
+    
+    Statistics statistics() const {
+        return {ringSize, uploadedBytes, peakUsage, allocationCount, submissionCount, waitCount};
+    }
+    
+private:
+    static constexpr uint64_t PENDING = UINT64_MAX; // Serial of a segment that hasn't been submitted
+    struct Segment {
+        VkDeviceSize begin;
+        VkDeviceSize end;
+        uint64_t serial;
+    };
+    
+    VkDevice device = VK_NULL_HANDLE;
+    VkBuffer ringBuffer = VK_NULL_HANDLE;
+    uint8_t* ringData = nullptr;
+    VkDeviceSize ringSize = 0;
+    VkDeviceSize head = 0;
+    std::deque<Segment> segments; // Live regions in allocation order
+    std::deque<Submission> inFlight; // In submission order
+    std::vector<VkFence> freeFences;
+    uint64_t submittedSerial = 0;
+    uint64_t completedSerial = 0; // Every submission up to this serial has completed
+    VkDeviceSize uploadedBytes = 0;
+    VkDeviceSize peakUsage = 0;
+    uint32_t allocationCount = 0;
+    uint32_t submissionCount = 0;
+    uint32_t waitCount = 0;
+    
+    Segment& findSegment(const Region& region) {
+        for (Segment& segment : segments) {
+            if (segment.begin == region.offset && segment.serial == PENDING)
+                return segment;
+        }
+        throw std::runtime_error("Staging region was already submitted or discarded!");
+    }
+};
+
+// Records uploads into one transfer command buffer (plus one graphics command buffer for queue family ownership acquires
+// and graphics-only work like mip blits) and submits them together on flush()
+// - Each flush is one batch; its submissions signal increasing values on a timeline semaphore, which the graphics
+//   submissions wait on: the batch's own graphics part for the transfer part, and the next frame for the whole batch
+// - Resources written on the transfer queue are released to the graphics family with releaseBuffer()/releaseImage()
+// - Without timeline semaphore support, each submission waits for its queue to go idle instead
+// - With a single queue (SEPARATE_TRANSFER_QUEUE_FAMILY off), everything is recorded into the graphics command buffer
+class UploadBatcher {
+public:
+    struct Statistics {
+        uint32_t batchCount = 0;
+        uint32_t submissionCount = 0;
+        uint32_t stagingFlushes = 0; // Batches flushed early because the staging ring was full
+    };
+    
+    void init(VkDevice device, StagingRing* stagingRing, VkQueue graphicsQueue, VkCommandPool graphicsCommandPool, uint32_t graphicsFamily,
+              VkQueue transferQueue, VkCommandPool transferCommandPool, uint32_t transferFamily, bool timelineSemaphoreSupported) {
+        this->device = device;
+        this->stagingRing = stagingRing;
+        this->graphicsQueue = graphicsQueue;
+        this->graphicsCommandPool = graphicsCommandPool;
+        this->graphicsFamily = graphicsFamily;
+        this->transferQueue = transferQueue;
+        this->transferCommandPool = transferCommandPool;
+        this->transferFamily = transferFamily;
+        separateTransferQueue = transferQueue != VK_NULL_HANDLE && transferQueue != graphicsQueue;
+        if (!timelineSemaphoreSupported)
+            return;
+        
+        getSemaphoreCounterValue = (PFN_vkGetSemaphoreCounterValueKHR) vkGetDeviceProcAddr(device, "vkGetSemaphoreCounterValueKHR");
+        waitSemaphores = (PFN_vkWaitSemaphoresKHR) vkGetDeviceProcAddr(device, "vkWaitSemaphoresKHR");
+        VkSemaphoreTypeCreateInfoKHR typeInfo{};
+        typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR;
+        typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE_KHR;
+        typeInfo.initialValue = 0;
+        VkSemaphoreCreateInfo semaphoreInfo{};
+        semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+        semaphoreInfo.pNext = &typeInfo;
+        if (!getSemaphoreCounterValue || !waitSemaphores || vkCreateSemaphore(device, &semaphoreInfo, nullptr, &timeline) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to create upload timeline semaphore!");
+        }
+    }
+    
+    // Command buffers of the batch being recorded, begun on first use
+    VkCommandBuffer transferCommands() {
+        if (!separateTransferQueue)
+            return graphicsCommands();
+        if (recording.transfer == VK_NULL_HANDLE) {
+            recording.transfer = beginCommands(transferCommandPool);
+        }
+        return recording.transfer;
+    }
+    VkCommandBuffer graphicsCommands() {
+        if (recording.graphics == VK_NULL_HANDLE) {
+            recording.graphics = beginCommands(graphicsCommandPool);
+        }
+        return recording.graphics;
+    }
+    
+    // Staging space read by this batch; when the ring is full, the batch so far is flushed to free space (so record the
+    // commands that read each region before staging the next)
+    StagingRing::Region stage(VkDeviceSize size, VkDeviceSize alignment) {
+        StagingRing::Region region;
+        if (!stagingRing->tryAllocate(size, alignment, region)) {
+            if (!stagingRegions.empty()) {
+                flush();
+                stagingFlushes++;
+            }
+            region = stagingRing->allocate(size, alignment);
+        }
+        stagingRegions.push_back(region);
+        return region;
+    }
+    // Staging regions allocated directly from the ring that this batch's commands read
+    void readsStagingRegions(const std::vector<StagingRing::Region>& regions) {
+        stagingRegions.insert(stagingRegions.end(), regions.begin(), regions.end());
+    }
+    
+    // Make transfer writes available to the graphics queue: a release/acquire pair when the queues are separate
+    void releaseBuffer(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size, VkPipelineStageFlags dstStage, VkAccessFlags dstAccess) {
+        VkBufferMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        barrier.buffer = buffer;
+        barrier.offset = offset;
+        barrier.size = size;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.srcQueueFamilyIndex = separateTransferQueue ? transferFamily : VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = separateTransferQueue ? graphicsFamily : VK_QUEUE_FAMILY_IGNORED;
+        if (!separateTransferQueue) {
+            barrier.dstAccessMask = dstAccess;
+            vkCmdPipelineBarrier(graphicsCommands(), VK_PIPELINE_STAGE_TRANSFER_BIT, dstStage, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+            return;
+        }
+        barrier.dstAccessMask = 0; // Ignored for a release
+        vkCmdPipelineBarrier(transferCommands(), VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+        barrier.srcAccessMask = 0; // Ignored for an acquire
+        barrier.dstAccessMask = dstAccess;
+        vkCmdPipelineBarrier(graphicsCommands(), dstStage, dstStage, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+    }
+    void releaseImage(VkImage image, const VkImageSubresourceRange& range, VkImageLayout oldLayout, VkImageLayout newLayout, VkPipelineStageFlags dstStage, VkAccessFlags dstAccess) {
+        // The layout transition is part of both barriers (it happens once, between release and acquire)
+        VkImageMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.image = image;
+        barrier.subresourceRange = range;
+        barrier.oldLayout = oldLayout;
+        barrier.newLayout = newLayout;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.srcQueueFamilyIndex = separateTransferQueue ? transferFamily : VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = separateTransferQueue ? graphicsFamily : VK_QUEUE_FAMILY_IGNORED;
+        if (!separateTransferQueue) {
+            barrier.dstAccessMask = dstAccess;
+            vkCmdPipelineBarrier(graphicsCommands(), VK_PIPELINE_STAGE_TRANSFER_BIT, dstStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+            return;
+        }
+        barrier.dstAccessMask = 0;
+        vkCmdPipelineBarrier(transferCommands(), VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = dstAccess;
+        vkCmdPipelineBarrier(graphicsCommands(), dstStage, dstStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+    }
+    
+    // Submits the batch being recorded; returns the timeline value that signals its completion (the last submitted value
+    // when nothing was recorded)
+    uint64_t flush() {
+        reclaim();
+        if (recording.transfer == VK_NULL_HANDLE && recording.graphics == VK_NULL_HANDLE)
+            return submittedValue;
+        Batch batch = recording;
+        recording = {};
+        
+        // The staging ring fence goes on the submission that reads staging memory
+        VkFence stagingFence = stagingRegions.empty() ? VK_NULL_HANDLE : stagingRing->submit(stagingRegions).fence;
+        stagingRegions.clear();
+        uint64_t transferValue = 0;
+        if (batch.transfer != VK_NULL_HANDLE) {
+            transferValue = submit(transferQueue, batch.transfer, 0, stagingFence);
+            stagingFence = VK_NULL_HANDLE;
+        }
+        if (batch.graphics != VK_NULL_HANDLE) {
+            submit(graphicsQueue, batch.graphics, transferValue, stagingFence);
+        }
+        batch.value = submittedValue;
+        inFlight.push_back(batch);
+        batchCount++;
+        return batch.value;
+    }
+    
+    bool isComplete(uint64_t value) {
+        return value <= completedValue();
+    }
+    void wait(uint64_t value) {
+        if (timeline == VK_NULL_HANDLE || isComplete(value))
+            return;
+        VkSemaphoreWaitInfoKHR waitInfo{};
+        waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR;
+        waitInfo.semaphoreCount = 1;
+        waitInfo.pSemaphores = &timeline;
+        waitInfo.pValues = &value;
+        waitSemaphores(device, &waitInfo, UINT64_MAX);
+    }
+    // Frees the command buffers of completed batches
+    void reclaim() {
+        uint64_t completed = completedValue();
+        while (!inFlight.empty() && inFlight.front().value <= completed) {
+            Batch& batch = inFlight.front();
+            if (batch.transfer != VK_NULL_HANDLE) {
+                vkFreeCommandBuffers(device, transferCommandPool, 1, &batch.transfer);
+            }
+            if (batch.graphics != VK_NULL_HANDLE) {
+                vkFreeCommandBuffers(device, graphicsCommandPool, 1, &batch.graphics);
+            }
+            inFlight.pop_front();
+        }
+    }
+    
+    // Timeline value the next frame's graphics submit should wait on, or 0 when it has nothing new to wait for
+    uint64_t frameWaitValue() {
+        if (timeline == VK_NULL_HANDLE || submittedValue == frameWaitedValue)
+            return 0;
+        frameWaitedValue = submittedValue;
+        return submittedValue;
+    }
+    VkSemaphore timelineSemaphore() const {
+        return timeline;
+    }
+    
+    // Waits for every batch; call with the device idle or about to be destroyed
+    void destroy() {
+        wait(submittedValue);
+        reclaim();
+        if (timeline != VK_NULL_HANDLE) {
+            vkDestroySemaphore(device, timeline, nullptr);
+            timeline = VK_NULL_HANDLE;
+        }
+    }
+    
+    Statistics statistics() const {
+        return {batchCount, submissionCount, stagingFlushes};
+    }
+    
+private:
+    struct Batch {
+        VkCommandBuffer transfer = VK_NULL_HANDLE;
+        VkCommandBuffer graphics = VK_NULL_HANDLE;
+        uint64_t value = 0; // Timeline value of the batch's last submission
+    };
+    
+    VkDevice device = VK_NULL_HANDLE;
+    StagingRing* stagingRing = nullptr;
+    VkQueue graphicsQueue = VK_NULL_HANDLE;
+    VkCommandPool graphicsCommandPool = VK_NULL_HANDLE;
+    uint32_t graphicsFamily = 0;
+    VkQueue transferQueue = VK_NULL_HANDLE;
+    VkCommandPool transferCommandPool = VK_NULL_HANDLE;
+    uint32_t transferFamily = 0;
+    bool separateTransferQueue = false;
+    VkSemaphore timeline = VK_NULL_HANDLE; // VK_NULL_HANDLE without timeline semaphore support
+    PFN_vkGetSemaphoreCounterValueKHR getSemaphoreCounterValue = nullptr;
+    PFN_vkWaitSemaphoresKHR waitSemaphores = nullptr;
+    Batch recording;
+    std::vector<StagingRing::Region> stagingRegions; // Read by the batch being recorded
+    std::deque<Batch> inFlight;
+    uint64_t submittedValue = 0;
+    uint64_t frameWaitedValue = 0;
+    uint32_t batchCount = 0;
+    uint32_t submissionCount = 0;
+    uint32_t stagingFlushes = 0;
+    
+    VkCommandBuffer beginCommands(VkCommandPool commandPool) {
+        VkCommandBufferAllocateInfo allocateInfo{};
+        allocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocateInfo.commandPool = commandPool;
+        allocateInfo.commandBufferCount = 1;
+        VkCommandBuffer commandBuffer;
+        if (vkAllocateCommandBuffers(device, &allocateInfo, &commandBuffer) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to allocate upload command buffer!");
+        }
+        
+        VkCommandBufferBeginInfo beginInfo{};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        vkBeginCommandBuffer(commandBuffer, &beginInfo);
+        return commandBuffer;
+    }
+    // Submits one command buffer that signals the next timeline value, after waiting for waitValue (0: no wait)
+    uint64_t submit(VkQueue queue, VkCommandBuffer commandBuffer, uint64_t waitValue, VkFence fence) {
+        vkEndCommandBuffer(commandBuffer);
+        uint64_t signalValue = ++submittedValue;
+        
+        VkSubmitInfo submitInfo{};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &commandBuffer;
+        VkTimelineSemaphoreSubmitInfoKHR timelineInfo{};
+        VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT; // The acquire barriers' stages
+        if (timeline != VK_NULL_HANDLE) {
+            timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+            timelineInfo.waitSemaphoreValueCount = waitValue ? 1 : 0;
+            timelineInfo.pWaitSemaphoreValues = &waitValue;
+            timelineInfo.signalSemaphoreValueCount = 1;
+            timelineInfo.pSignalSemaphoreValues = &signalValue;
+            submitInfo.pNext = &timelineInfo;
+            submitInfo.waitSemaphoreCount = waitValue ? 1 : 0;
+            submitInfo.pWaitSemaphores = &timeline;
+            submitInfo.pWaitDstStageMask = &waitStage;
+            submitInfo.signalSemaphoreCount = 1;
+            submitInfo.pSignalSemaphores = &timeline;
+        }
+        if (vkQueueSubmit(queue, 1, &submitInfo, fence) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to submit upload batch!");
+        }
+        if (timeline == VK_NULL_HANDLE) {
+            vkQueueWaitIdle(queue);
+        }
+        submissionCount++;
+        return signalValue;
+    }
+    uint64_t completedValue() {
+        if (timeline == VK_NULL_HANDLE)
+            return submittedValue; // Every submission waited for its queue
+        uint64_t value = 0;
+        getSemaphoreCounterValue(device, timeline, &value);
+        return value;
+    }
+};
+
+// First-fit free list over a range of elements [0, capacity), for sub-allocating shared buffers
+// - Freed ranges are merged with their free neighbours, so the list only holds gaps between live ranges
+class RangeAllocator {
+public:
+    static constexpr uint32_t INVALID = UINT32_MAX;
+    
+    void init(uint32_t capacity) {
+        this->capacity = capacity;
+        freeRanges.clear();
+        if (capacity > 0) {
+            freeRanges[0] = capacity;
+        }
+        usedCount = 0;
+    }
+    
+    // Returns the first element of the range, or INVALID when no free range is large enough
+    uint32_t allocate(uint32_t count) {
+        if (count == 0)
+            return 0;
+        for (auto it = freeRanges.begin(); it != freeRanges.end(); ++it) {
+            if (it->second < count)
+                continue;
+            uint32_t offset = it->first;
+            uint32_t remaining = it->second - count;
+            freeRanges.erase(it);
+            if (remaining > 0) {
+                freeRanges[offset + count] = remaining;
+            }
+            usedCount += count;
+            return offset;
+        }
+        return INVALID;
+    }
+    void free(uint32_t offset, uint32_t count) {
+        if (count == 0)
+            return;
+        auto next = freeRanges.lower_bound(offset);
+        if (next != freeRanges.end() && next->first < offset + count) {
+            throw std::runtime_error("Range was already freed!");
+        }
+        uint32_t freedCount = count;
+        // Merge with the preceding free range, then with the following one
+        if (next != freeRanges.begin()) {
+            auto previous = std::prev(next);
+            if (previous->first + previous->second > offset) {
+                throw std::runtime_error("Range was already freed!");
+            }
+            if (previous->first + previous->second == offset) {
+                offset = previous->first;
+                count += previous->second;
+                freeRanges.erase(previous);
+            }
+        }
+        if (next != freeRanges.end() && offset + count == next->first) {
+            count += next->second;
+            freeRanges.erase(next);
+        }
+        freeRanges[offset] = count;
+        usedCount -= freedCount;
+    }
+    
+    uint32_t used() const {
+        return usedCount;
+    }
+    uint32_t largestFreeRange() const {
+        uint32_t largest = 0;
+        for (const auto& [offset, count] : freeRanges) {
+            largest = std::max(largest, count);
+        }
+        return largest;
+    }
+    size_t freeRangeCount() const {
+        return freeRanges.size();
+    }
+    
+private:
+    uint32_t capacity = 0;
+    uint32_t usedCount = 0;
+    std::map<uint32_t, uint32_t> freeRanges; // Offset -> count, non-adjacent
+};
+
+// One device-local vertex buffer and one index buffer that every mesh is sub-allocated from, so a whole scene is drawn
+// with a single vertex/index buffer bind and per-mesh vertexOffset/firstIndex
+// - All meshes share the vertex layout (vertexStride) and index type the buffers were created with; indices are relative
+//   to the mesh's firstVertex, so 16-bit indices work for any mesh with fewer than 65536 vertices
+// - Ranges are managed by free lists, so meshes can be added and removed at runtime without recreating the buffers;
+//   free() a mesh only once no submitted frame still draws it
+class GeometryBuffer {
+public:
+    // A level of detail: a range of the mesh's indices, into the same vertices as every other level
+    struct Lod {
+        uint32_t firstIndex = 0;
+        uint32_t indexCount = 0;
+        float error = 0.0f; // Simplification error in mesh units (see MeshSimplifier)
+    };
+    struct Mesh {
+        uint32_t firstVertex = 0;
+        uint32_t vertexCount = 0;
+        uint32_t firstIndex = 0;
+        uint32_t indexCount = 0; // Of every level together
+        MeshDequantization dequantization{}; // Vertex shader push constants for the mesh
+        Aabb bounds; // Object-space bounds of the vertices, for culling
+        uint32_t lodCount = 1;
+        Lod lods[MAX_MESH_LODS]; // Finest first; errors increase with the level
+    };
+    struct Statistics {
+        uint32_t meshCount = 0;
+        uint32_t vertexCapacity = 0;
+        uint32_t usedVertices = 0;
+        uint32_t largestFreeVertexRange = 0;
+        uint32_t indexCapacity = 0;
+        uint32_t usedIndices = 0;
+        uint32_t largestFreeIndexRange = 0;
+        size_t freeRangeCount = 0; // Vertex and index gaps together
+    };
+    
+    void init(VkBuffer vertexBuffer, VkDeviceSize vertexBufferSize, uint32_t vertexStride, VkBuffer indexBuffer, VkDeviceSize indexBufferSize, VkIndexType indexType) {
+        this->vertexBuffer = vertexBuffer;
+        this->vertexStride = vertexStride;
+        this->indexBuffer = indexBuffer;
+        this->indexType = indexType;
+        vertexCapacity = static_cast<uint32_t>(vertexBufferSize / vertexStride);
+        indexCapacity = static_cast<uint32_t>(indexBufferSize / indexStride());
+        vertexRanges.init(vertexCapacity);
+        indexRanges.init(indexCapacity);
+        meshCount = 0;
+    }
+    
+    // Reserves ranges for a mesh; returns false (reserving nothing) when either buffer has no large enough gap
+    bool allocate(uint32_t vertexCount, uint32_t indexCount, Mesh& mesh) {
+        if (indexType == VK_INDEX_TYPE_UINT16 && vertexCount >= 65536) {
+            throw std::runtime_error("Mesh has too many vertices for the geometry buffer's 16-bit indices!");
+        }
+        uint32_t firstVertex = vertexRanges.allocate(vertexCount);
+        if (firstVertex == RangeAllocator::INVALID)
+            return false;
+        uint32_t firstIndex = indexRanges.allocate(indexCount);
+        if (firstIndex == RangeAllocator::INVALID) {
+            vertexRanges.free(firstVertex, vertexCount);
+            return false;
+        }
+        mesh = Mesh{firstVertex, vertexCount, firstIndex, indexCount};
+        mesh.lods[0] = {firstIndex, indexCount, 0.0f}; // The caller splits the range into levels, if it has any
+        meshCount++;
+        return true;
+    }
+    void free(const Mesh& mesh) {
+        vertexRanges.free(mesh.firstVertex, mesh.vertexCount);
+        indexRanges.free(mesh.firstIndex, mesh.indexCount);
+        meshCount--;
+    }
+    
+    // Byte ranges of a mesh, for uploads
+    VkDeviceSize vertexOffset(const Mesh& mesh) const {
+        return VkDeviceSize(mesh.firstVertex) * vertexStride;
+    }
+    VkDeviceSize vertexSize(const Mesh& mesh) const {
+        return VkDeviceSize(mesh.vertexCount) * vertexStride;
+    }
+    VkDeviceSize indexOffset(const Mesh& mesh) const {
+        return VkDeviceSize(mesh.firstIndex) * indexStride();
+    }
+    VkDeviceSize indexSize(const Mesh& mesh) const {
+        return VkDeviceSize(mesh.indexCount) * indexStride();
+    }
+    uint32_t indexStride() const {
+        return indexType == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t);
+    }
+    VkIndexType getIndexType() const {
+        return indexType;
+    }
+    
+    // Binds both buffers once; every mesh is then drawn with draw()
+    void bind(VkCommandBuffer commandBuffer) const {
+        VkDeviceSize offset = 0;
+        vkCmdBindVertexBuffers(commandBuffer, 0, 1, &vertexBuffer, &offset);
+        vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, indexType);
+    }
+    void draw(VkCommandBuffer commandBuffer, const Mesh& mesh, uint32_t firstInstance = 0, uint32_t instanceCount = 1, uint32_t lod = 0) const {
+        const Lod& level = mesh.lods[lod];
+        vkCmdDrawIndexed(commandBuffer, level.indexCount, instanceCount, level.firstIndex, static_cast<int32_t>(mesh.firstVertex), firstInstance);
+    }
+    
+    Statistics statistics() const {
+        return {meshCount, vertexCapacity, vertexRanges.used(), vertexRanges.largestFreeRange(),
+                indexCapacity, indexRanges.used(), indexRanges.largestFreeRange(),
+                vertexRanges.freeRangeCount() + indexRanges.freeRangeCount()};
+    }
+    
+private:
+    VkBuffer vertexBuffer = VK_NULL_HANDLE;
+    VkBuffer indexBuffer = VK_NULL_HANDLE;
+    uint32_t vertexStride = 0;
+    VkIndexType indexType = VK_INDEX_TYPE_UINT32;
+    uint32_t vertexCapacity = 0;
+    uint32_t indexCapacity = 0;
+    RangeAllocator vertexRanges;
+    RangeAllocator indexRanges;
+    uint32_t meshCount = 0;
+};
+
+// Per-draw uniform data written into a persistently mapped buffer, which is bound as a VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC
+// at each draw's offset, so any number of draws share one descriptor set
+// - The buffer holds one segment per frame in flight; beginFrame() rewinds the frame's segment, which the GPU finished
+//   reading when the frame's fence signalled
+// - Offsets are aligned to minUniformBufferOffsetAlignment
+class DynamicUniformRing {
+public:
+    void init(VkBuffer buffer, void* mapped, VkDeviceSize frameSize, VkDeviceSize alignment) {
+        ringBuffer = buffer;
+        ringData = static_cast<uint8_t*>(mapped);
+        this->frameSize = frameSize;
+        this->alignment = alignment;
+        frameBegin = head = 0;
+    }
+    
+    void beginFrame(uint32_t frame) {
+        frameBegin = head = frame * frameSize;
+    }
+    // Copies data into the current frame's segment and returns its dynamic offset
+    uint32_t push(const void* data, VkDeviceSize size) {
+        VkDeviceSize offset = (head + alignment - 1) & ~(alignment - 1);
+        if (offset + size > frameBegin + frameSize) {
+            throw std::runtime_error("Dynamic uniform ring is full!");
+        }
+        memcpy(ringData + offset, data, static_cast<size_t>(size));
+        head = offset + size;
+        peakUsage = std::max(peakUsage, head - frameBegin);
+        return static_cast<uint32_t>(offset);
+    }
+    template<typename T>
+    uint32_t push(const T& data) {
+        return push(&data, sizeof(T));
+    }
+    
+    VkBuffer buffer() const {
+        return ringBuffer;
+    }
+    VkDeviceSize peakFrameUsage() const {
+        return peakUsage;
+    }
+    
+private:
+    VkBuffer ringBuffer = VK_NULL_HANDLE;
+    uint8_t* ringData = nullptr;
+    VkDeviceSize frameSize = 0;
+    VkDeviceSize alignment = 1;
+    VkDeviceSize frameBegin = 0;
+    VkDeviceSize head = 0;
+    VkDeviceSize peakUsage = 0;
+};
+
+// Per-instance data, read by the vertex shader from a storage buffer at gl_InstanceIndex
+struct InstanceData {
+    alignas(16) glm::mat4 model; // Applied before the draw's model matrix
+    alignas(16) glm::vec4 boundsMin; // Object-space bounds of the instance, for GPU culling (cull.comp)
+    alignas(16) glm::vec4 boundsMax;
+};
+
+// Instance transforms for instanced draws: a CPU copy, and one copy per frame in flight in a mapped storage buffer
+// - Draws select their instances with firstInstance/instanceCount; ranges are sub-allocated with a RangeAllocator
+// - set() only marks an instance dirty; sync() copies the instances changed since that frame's copy was last written,
+//   so unchanged instances cost nothing per frame
+class InstanceBuffer {
+public:
+    static const uint32_t IDENTITY = 0; // Reserved identity instance, for draws that aren't instanced
+    
+    struct Statistics {
+        uint32_t capacity = 0;
+        uint32_t usedInstances = 0;
+        uint32_t lastSyncCount = 0; // Instances copied by the last sync()
+        uint64_t syncedInstances = 0; // Instances copied by every sync()
+    };
+    
+    void init(VkBuffer buffer, void* mapped, uint32_t capacity, uint32_t frameCount) {
+        if (frameCount > 8) {
+            throw std::runtime_error("Instance buffer tracks at most 8 frames in flight!");
+        }
+        instanceBuffer = buffer;
+        instanceData = static_cast<InstanceData*>(mapped);
+        this->capacity = capacity;
+        allFrames = static_cast<uint8_t>((1u << frameCount) - 1);
+        instances.assign(capacity, InstanceData{glm::mat4(1.0f), glm::vec4(0.0f), glm::vec4(0.0f)});
+        dirtyFrames.assign(capacity, 0);
+        dirtyInstances.clear();
+        ranges.init(capacity);
+        set(ranges.allocate(1), InstanceData{glm::mat4(1.0f), glm::vec4(0.0f), glm::vec4(0.0f)}); // IDENTITY (culled with its object's mesh bounds)
+    }
+    
+    // Returns the first instance of the range, or RangeAllocator::INVALID when no free range is large enough
+    uint32_t allocate(uint32_t count) {
+        return ranges.allocate(count);
+    }
+    // The range's instances may be reused right away: each frame's copy is only rewritten by its own sync()
+    void free(uint32_t firstInstance, uint32_t count) {
+        ranges.free(firstInstance, count);
+    }
+    
+    void set(uint32_t index, const InstanceData& data) {
+        instances[index] = data;
+        if (dirtyFrames[index] == 0) {
+            dirtyInstances.push_back(index);
+        }
+        dirtyFrames[index] = allFrames;
+    }
+    const InstanceData& get(uint32_t index) const {
+        return instances[index];
+    }
+    // A frame's mapped copy, for writers that track their own stale instances (SceneGraph) instead of using set()
+    InstanceData* frameData(uint32_t frame) const {
+        return instanceData + size_t(frame) * capacity;
+    }
+    
+    // Brings a frame's copy up to date; call once its previous submission has completed
+    uint32_t sync(uint32_t frame) {
+        InstanceData* frameData = instanceData + size_t(frame) * capacity;
+        uint8_t frameBit = static_cast<uint8_t>(1u << frame);
+        uint32_t copied = 0;
+        size_t kept = 0;
+        for (uint32_t index : dirtyInstances) {
+            if (dirtyFrames[index] & frameBit) {
+                frameData[index] = instances[index];
+                dirtyFrames[index] &= ~frameBit;
+                copied++;
+            }
+            if (dirtyFrames[index] != 0) {
+                dirtyInstances[kept++] = index; // Still stale in another frame's copy
+            }
+        }
+        dirtyInstances.resize(kept);
+        lastSyncCount = copied;
+        syncedInstances += copied;
+        return copied;
+    }
+    
+    VkBuffer buffer() const {
+        return instanceBuffer;
+    }
+    VkDeviceSize frameOffset(uint32_t frame) const {
+        return frame * frameSize();
+    }
+    VkDeviceSize frameSize() const {
+        return VkDeviceSize(capacity) * sizeof(InstanceData);
+    }
+    Statistics statistics() const {
+        return {capacity, ranges.used(), lastSyncCount, syncedInstances};
+    }
+    
+private:
+    VkBuffer instanceBuffer = VK_NULL_HANDLE;
+    InstanceData* instanceData = nullptr; // frameCount copies of capacity instances
+    uint32_t capacity = 0;
+    uint8_t allFrames = 0;
+    std::vector<InstanceData> instances;
+    std::vector<uint8_t> dirtyFrames; // Bit per frame whose copy of the instance is stale
+    std::vector<uint32_t> dirtyInstances; // Instances with any dirtyFrames bit set
+    RangeAllocator ranges;
+    uint32_t lastSyncCount = 0;
+    uint64_t syncedInstances = 0;
+};
+
+// The six clip planes of a view-projection matrix (Gribb/Hartmann), in the space the matrix transforms from
+// - Planes point inwards and aren't normalized: only the sign of the distance is used
+// - Depth range is [0, 1] (GLM_FORCE_DEPTH_ZERO_TO_ONE), so the near plane is the third row alone
+struct Frustum {
+    glm::vec4 planes[6];
+    
+    static Frustum fromMatrix(const glm::mat4& matrix) {
+        glm::vec4 rows[4];
+        for (int i = 0; i < 4; i++) {
+            rows[i] = glm::vec4(matrix[0][i], matrix[1][i], matrix[2][i], matrix[3][i]);
+        }
+        return {{rows[3] + rows[0], rows[3] - rows[0], rows[3] + rows[1], rows[3] - rows[1], rows[2], rows[3] - rows[2]}};
+    }
+    
+    // Conservative: false only when the box is entirely outside one plane
+    bool intersects(const Aabb& box) const {
+        for (const glm::vec4& plane : planes) {
+            glm::vec3 farthest(plane.x > 0.0f ? box.max.x : box.min.x, plane.y > 0.0f ? box.max.y : box.min.y, plane.z > 0.0f ? box.max.z : box.min.z);
+            if (glm::dot(glm::vec3(plane), farthest) + plane.w < 0.0f)
+                return false;
+        }
+        return true;
+    }
+};
+
+// Frustum culling of instance bounds, indexed like the InstanceBuffer
+// - Bounds are stored as structure of arrays (one array per min/max component), so AVX2 (when cpuHasAvx2()), SSE2 or NEON
+//   test 8/4 boxes per plane with plain loads; each plane picks, for all boxes at once, the min or max array per axis from the sign of its normal
+// - Large ranges are split across the WorkerPool with parallelFor(); visible indices come out in order
+class FrustumCuller {
+public:
+    static const size_t MIN_PER_THREAD = 1 << 15; // Boxes; below this a thread costs more than it saves
+    
+    void init(uint32_t capacity) {
+        for (auto* component : {&minX, &minY, &minZ, &maxX, &maxY, &maxZ}) {
+            component->assign(capacity, 0.0f);
+        }
+        scratch.resize(capacity);
+        chunkVisible.resize(WorkerPool::shared().threadCount());
+    }
+    void setBounds(uint32_t index, const Aabb& bounds) {
+        minX[index] = bounds.min.x;
+        minY[index] = bounds.min.y;
+        minZ[index] = bounds.min.z;
+        maxX[index] = bounds.max.x;
+        maxY[index] = bounds.max.y;
+        maxZ[index] = bounds.max.z;
+    }
+    Aabb bounds(uint32_t index) const {
+        return {glm::vec3(minX[index], minY[index], minZ[index]), glm::vec3(maxX[index], maxY[index], maxZ[index])};
+    }
+    
+    // Writes the indices in [first, first + count) whose bounds intersect the frustum to visible; returns how many
+    uint32_t cull(const Frustum& frustum, uint32_t first, uint32_t count, uint32_t* visible, bool allowParallel = true) {
+        // Each chunk compacts into its own part of scratch and records its count, then the chunks are concatenated in order
+        size_t minPerThread = allowParallel ? MIN_PER_THREAD : count;
+        size_t chunkSize = parallelChunkSize(count, minPerThread);
+        if (chunkSize >= count)
+            return cullRange(frustum, first, first + count, visible);
+        parallelFor(count, minPerThread, [&](size_t begin, size_t end) {
+            chunkVisible[begin / chunkSize] = cullRange(frustum, first + static_cast<uint32_t>(begin), first + static_cast<uint32_t>(end), scratch.data() + begin);
+        });
+        uint32_t visibleCount = 0;
+        for (size_t begin = 0; begin < count; begin += chunkSize) {
+            uint32_t chunkCount = chunkVisible[begin / chunkSize];
+            memcpy(visible + visibleCount, scratch.data() + begin, chunkCount * sizeof(uint32_t));
+            visibleCount += chunkCount;
+        }
+        return visibleCount;
+    }
+    
+    static const char* instructionSet() {
+#if defined(AVX2_DISPATCH)
+        return cpuHasAvx2() ? "AVX2" : "SSE2";
+#elif defined(__SSE2__)
+        return "SSE2";
+#elif defined(__ARM_NEON)
+        return "NEON";
+#else
+        return "scalar";
+#endif
+    }
+    
+private:
+    std::vector<float> minX, minY, minZ, maxX, maxY, maxZ;
+    std::vector<uint32_t> scratch;
+    std::vector<uint32_t> chunkVisible; // Visible count per parallelFor() chunk, at most one chunk per pool thread
+    
+    uint32_t cullRange(const Frustum& frustum, uint32_t begin, uint32_t end, uint32_t* visible) const {
+        // Per plane, the arrays holding each axis' farthest corner along the plane normal
+        const float* farthest[6][3];
+        for (int p = 0; p < 6; p++) {
+            const glm::vec4& plane = frustum.planes[p];
+            farthest[p][0] = (plane.x > 0.0f ? maxX : minX).data();
+            farthest[p][1] = (plane.y > 0.0f ? maxY : minY).data();
+            farthest[p][2] = (plane.z > 0.0f ? maxZ : minZ).data();
+        }
+        
+        uint32_t visibleCount = 0;
+        uint32_t i = begin;
+#if defined(AVX2_DISPATCH)
+        if (cpuHasAvx2()) {
+            i = cullRangeAvx2(frustum, farthest, begin, end, visible, visibleCount);
+        }
+#endif
+#if defined(__AVX2__) || defined(__SSE2__)
+        for (; i + 4 <= end; i += 4) {
+            __m128 outside = _mm_setzero_ps();
+            for (int p = 0; p < 6; p++) {
+                const glm::vec4& plane = frustum.planes[p];
+                __m128 distance = _mm_mul_ps(_mm_loadu_ps(farthest[p][0] + i), _mm_set1_ps(plane.x));
+                distance = _mm_add_ps(distance, _mm_mul_ps(_mm_loadu_ps(farthest[p][1] + i), _mm_set1_ps(plane.y)));
+                distance = _mm_add_ps(distance, _mm_mul_ps(_mm_loadu_ps(farthest[p][2] + i), _mm_set1_ps(plane.z)));
+                distance = _mm_add_ps(distance, _mm_set1_ps(plane.w));
+                outside = _mm_or_ps(outside, _mm_cmplt_ps(distance, _mm_setzero_ps()));
+            }
+            for (uint32_t mask = ~static_cast<uint32_t>(_mm_movemask_ps(outside)) & 0xF; mask; mask &= mask - 1) {
+                visible[visibleCount++] = i + std::countr_zero(mask);
+            }
+        }
+#elif defined(__ARM_NEON)
+        for (; i + 4 <= end; i += 4) {
+            uint32x4_t outside = vdupq_n_u32(0);
+            for (int p = 0; p < 6; p++) {
+                const glm::vec4& plane = frustum.planes[p];
+                float32x4_t distance = vmulq_n_f32(vld1q_f32(farthest[p][0] + i), plane.x);
+                distance = vmlaq_n_f32(distance, vld1q_f32(farthest[p][1] + i), plane.y);
+                distance = vmlaq_n_f32(distance, vld1q_f32(farthest[p][2] + i), plane.z);
+                distance = vaddq_f32(distance, vdupq_n_f32(plane.w));
+                outside = vorrq_u32(outside, vcltq_f32(distance, vdupq_n_f32(0.0f)));
+            }
+            uint32_t lanes[4];
+            vst1q_u32(lanes, outside);
+            for (uint32_t lane = 0; lane < 4; lane++) {
+                if (!lanes[lane])
+                    visible[visibleCount++] = i + lane;
+            }
+        }
+#endif
+        for (; i < end; i++) {
+            bool inside = true;
+            for (int p = 0; p < 6 && inside; p++) {
+                const glm::vec4& plane = frustum.planes[p];
+                inside = farthest[p][0][i] * plane.x + farthest[p][1][i] * plane.y + farthest[p][2][i] * plane.z + plane.w >= 0.0f;
+            }
+            if (inside)
+                visible[visibleCount++] = i;
+        }
+        return visibleCount;
+    }
+    
+#if defined(AVX2_DISPATCH)
+    // AVX2 kernel of cullRange(): 8 boxes per iteration; returns how far it got, for the SSE2/scalar loops to finish
+    AVX2_TARGET static uint32_t cullRangeAvx2(const Frustum& frustum, const float* const (*farthest)[3], uint32_t begin, uint32_t end, uint32_t* visible, uint32_t& visibleCount) {
+        uint32_t i = begin;
+        for (; i + 8 <= end; i += 8) {
+            __m256 outside = _mm256_setzero_ps();
+            for (int p = 0; p < 6; p++) {
+                const glm::vec4& plane = frustum.planes[p];
+                __m256 distance = _mm256_mul_ps(_mm256_loadu_ps(farthest[p][0] + i), _mm256_set1_ps(plane.x));
+                distance = _mm256_add_ps(distance, _mm256_mul_ps(_mm256_loadu_ps(farthest[p][1] + i), _mm256_set1_ps(plane.y)));
+                distance = _mm256_add_ps(distance, _mm256_mul_ps(_mm256_loadu_ps(farthest[p][2] + i), _mm256_set1_ps(plane.z)));
+                distance = _mm256_add_ps(distance, _mm256_set1_ps(plane.w));
+                outside = _mm256_or_ps(outside, _mm256_cmp_ps(distance, _mm256_setzero_ps(), _CMP_LT_OQ));
+            }
+            for (uint32_t mask = ~static_cast<uint32_t>(_mm256_movemask_ps(outside)) & 0xFF; mask; mask &= mask - 1) {
+                visible[visibleCount++] = i + std::countr_zero(mask);
+            }
+        }
+        return i;
+    }
+#endif
+};
+
+// Transform hierarchy: position/rotation/scale and world matrices stored as structure of arrays, indexed by entity
+// - A parent always has a lower index than its children (create() only reuses a destroyed entity that comes after the
+//   new parent), so one forward pass visits every parent before its children:
+//   dirty flags propagate down and world matrices are recomputed without recursion or pointer chasing
+// - Setters only mark the entity dirty; update() recomputes the world matrices of dirty entities and their subtrees,
+//   LANES at a time (SSE2/NEON 4), and writes those with an instance straight into the frame's mapped InstanceBuffer
+//   copy (the instance's transform and bounds), plus their bounds into the FrustumCuller
+// - SSE2/NEON only: composeWorld() and transformBounds() are shared with the scalar path, so an AVX2 lane type would
+//   need -mavx2 rather than MipGenerator's runtime dispatch, and the build doesn't use it
+// - Like InstanceBuffer::sync(), the other frames' copies are brought up to date by their own update()
+// - Every array is sized by init(), so creating entities and updating them never allocates
+class SceneGraph {
+public:
+    static constexpr uint32_t NONE = UINT32_MAX; // No parent / no instance
+    
+    struct Statistics {
+        uint32_t entityCount = 0; // Including destroyed ones
+        uint32_t freeEntities = 0; // Destroyed, waiting to be reused by create()
+        uint32_t capacity = 0;
+        uint32_t lastWorldUpdates = 0; // World matrices recomputed by the last update()
+        uint32_t lastInstanceWrites = 0; // Instances written by the last update()
+        uint64_t instanceWrites = 0; // Instances written by every update()
+    };
+    
+    void init(uint32_t capacity, uint32_t frameCount) {
+        if (frameCount > 8) {
+            throw std::runtime_error("Scene graph tracks at most 8 frames in flight!");
+        }
+        this->capacity = capacity;
+        allFrames = static_cast<uint8_t>((1u << frameCount) - 1);
+        for (auto* component : {&positionX, &positionY, &positionZ, &rotationX, &rotationY, &rotationZ, &rotationW, &scaleX, &scaleY, &scaleZ}) {
+            component->assign(capacity, 0.0f);
+        }
+        // One extra slot, the parent of root entities: an identity world matrix that is never dirty
+        for (size_t component = 0; component < world.size(); component++) {
+            world[component].assign(capacity + 1, 0.0f);
+            world[component][capacity] = component % 4 == 0 ? 1.0f : 0.0f; // Diagonal at components 0, 4 and 8
+        }
+        parentSlots.assign(capacity, capacity);
+        instanceIndices.assign(capacity, NONE);
+        for (auto* component : {&boundsCenterX, &boundsCenterY, &boundsCenterZ, &boundsExtentX, &boundsExtentY, &boundsExtentZ}) {
+            component->assign(capacity, 0.0f);
+        }
+        dirty.assign(capacity + 1, 0);
+        frameDirty.assign(capacity, 0);
+        pendingEntities.clear();
+        pendingEntities.reserve(capacity);
+        freeEntities.clear();
+        freeEntities.reserve(capacity);
+        entityCount = 0;
+        firstDirty = NONE;
+    }
+    
+    uint32_t create(uint32_t parent = NONE, glm::vec3 position = glm::vec3(0.0f), glm::vec4 rotation = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f), glm::vec3 scale = glm::vec3(1.0f)) {
+        if (parent != NONE && parent >= entityCount) {
+            throw std::runtime_error("Scene graph parent doesn't exist!");
+        }
+        uint32_t entity;
+        auto reusable = std::find_if(freeEntities.begin(), freeEntities.end(), [parent](uint32_t freeEntity) { return parent == NONE || freeEntity > parent; });
+        if (reusable != freeEntities.end()) {
+            entity = *reusable;
+            freeEntities.erase(reusable);
+        } else {
+            if (entityCount == capacity) {
+                throw std::runtime_error("Scene graph is full!");
+            }
+            entity = entityCount++;
+        }
+        parentSlots[entity] = parent == NONE ? capacity : parent;
+        instanceIndices[entity] = NONE;
+        frameDirty[entity] = 0;
+        setTransform(entity, position, rotation, scale);
+        return entity;
+    }
+    // Removes the entities created last, from entity on (with any children they have)
+    void truncate(uint32_t entity) {
+        if (entity >= entityCount)
+            return;
+        std::fill(dirty.begin() + entity, dirty.begin() + entityCount, 0);
+        entityCount = entity;
+        if (firstDirty != NONE && firstDirty >= entityCount) {
+            firstDirty = NONE;
+        }
+        pendingEntities.erase(std::remove_if(pendingEntities.begin(), pendingEntities.end(), [this](uint32_t pending) { return pending >= entityCount; }), pendingEntities.end());
+        freeEntities.erase(std::remove_if(freeEntities.begin(), freeEntities.end(), [this](uint32_t freeEntity) { return freeEntity >= entityCount; }), freeEntities.end());
+    }
+    // Releases an entity (which must have no children) for create() to reuse; it becomes a root that is never dirty, so
+    // update() no longer recomputes it with its former parent's subtree
+    void destroy(uint32_t entity) {
+        for (uint32_t child = entity + 1; child < entityCount; child++) {
+            if (parentSlots[child] == entity) {
+                throw std::runtime_error("Scene graph entity still has children!");
+            }
+        }
+        parentSlots[entity] = capacity;
+        instanceIndices[entity] = NONE;
+        dirty[entity] = 0;
+        frameDirty[entity] = 0;
+        pendingEntities.erase(std::remove(pendingEntities.begin(), pendingEntities.end(), entity), pendingEntities.end());
+        freeEntities.push_back(entity); // Reserved by init(), so never reallocates
+    }
+    
+    // rotation is a unit quaternion (x, y, z, w); see rotation()
+    void setTransform(uint32_t entity, glm::vec3 position, glm::vec4 rotation, glm::vec3 scale) {
+        setPosition(entity, position);
+        setRotation(entity, rotation);
+        setScale(entity, scale);
+    }
+    void setPosition(uint32_t entity, glm::vec3 position) {
+        positionX[entity] = position.x;
+        positionY[entity] = position.y;
+        positionZ[entity] = position.z;
+        markDirty(entity);
+    }
+    void setRotation(uint32_t entity, glm::vec4 rotation) {
+        rotationX[entity] = rotation.x;
+        rotationY[entity] = rotation.y;
+        rotationZ[entity] = rotation.z;
+        rotationW[entity] = rotation.w;
+        markDirty(entity);
+    }
+    void setScale(uint32_t entity, glm::vec3 scale) {
+        scaleX[entity] = scale.x;
+        scaleY[entity] = scale.y;
+        scaleZ[entity] = scale.z;
+        markDirty(entity);
+    }
+    static glm::vec4 rotation(float angle, glm::vec3 axis) {
+        return glm::vec4(glm::normalize(axis) * std::sin(0.5f * angle), std::cos(0.5f * angle));
+    }
+    
+    // update() writes the entity's world matrix, and bounds transformed by it, to this InstanceBuffer index
+    void attachInstance(uint32_t entity, uint32_t instance, const Aabb& bounds) {
+        instanceIndices[entity] = instance;
+        glm::vec3 center = 0.5f * (bounds.min + bounds.max);
+        glm::vec3 extent = 0.5f * (bounds.max - bounds.min);
+        boundsCenterX[entity] = center.x;
+        boundsCenterY[entity] = center.y;
+        boundsCenterZ[entity] = center.z;
+        boundsExtentX[entity] = extent.x;
+        boundsExtentY[entity] = extent.y;
+        boundsExtentZ[entity] = extent.z;
+        markDirty(entity);
+    }
+    void detachInstance(uint32_t entity) {
+        instanceIndices[entity] = NONE;
+    }
+    
+    // Up to date as of the last update()
+    glm::mat4 worldMatrix(uint32_t entity) const {
+        if (entity == NONE) {
+            entity = capacity;
+        }
+        return glm::mat4(glm::vec4(world[0][entity], world[1][entity], world[2][entity], 0.0f),
+                         glm::vec4(world[3][entity], world[4][entity], world[5][entity], 0.0f),
+                         glm::vec4(world[6][entity], world[7][entity], world[8][entity], 0.0f),
+                         glm::vec4(world[9][entity], world[10][entity], world[11][entity], 1.0f));
+    }
+    
+    // Recomputes dirty subtrees and writes the frame's stale instances; call once the frame's previous submission has
+    // completed. culler may be null
+    void update(uint32_t frame, InstanceData* frameInstances, FrustumCuller* culler) {
+        uint8_t frameBit = static_cast<uint8_t>(1u << frame);
+        lastWorldUpdates = 0;
+        lastInstanceWrites = 0;
+        if (firstDirty != NONE) {
+            // Entities before the first dirty one can't be affected; batches start LANES-aligned for the loads
+            for (uint32_t begin = firstDirty - firstDirty % LANES; begin < entityCount; begin += LANES) {
+                uint32_t end = std::min(begin + LANES, entityCount);
+                uint32_t dirtyCount = 0;
+                bool parentsComputed = true; // No parent inside the batch, so every lane can be computed at once
+                for (uint32_t entity = begin; entity < end; entity++) {
+                    dirty[entity] |= dirty[parentSlots[entity]];
+                    dirtyCount += dirty[entity];
+                    parentsComputed &= parentSlots[entity] < begin || parentSlots[entity] == capacity;
+                }
+                if (dirtyCount == 0)
+                    continue;
+                if (dirtyCount == LANES && parentsComputed) {
+                    computeWorld(begin, frameInstances, culler);
+                } else {
+                    for (uint32_t entity = begin; entity < end; entity++) {
+                        if (!dirty[entity])
+                            continue;
+                        computeWorldScalar(entity);
+                        if (instanceIndices[entity] != NONE) {
+                            writeInstance(entity, frameInstances, culler);
+                        }
+                    }
+                }
+                for (uint32_t entity = begin; entity < end; entity++) {
+                    if (!dirty[entity] || instanceIndices[entity] == NONE)
+                        continue;
+                    if (frameDirty[entity] == 0 && allFrames != frameBit) {
+                        pendingEntities.push_back(entity); // Reserved by init(), so never reallocates
+                    }
+                    frameDirty[entity] = allFrames & ~frameBit;
+                }
+                lastWorldUpdates += dirtyCount;
+            }
+            std::fill(dirty.begin() + firstDirty, dirty.begin() + entityCount, 0);
+            firstDirty = NONE;
+        }
+        
+        // Instances written by earlier frames' updates that this frame's copy hasn't seen yet
+        size_t kept = 0;
+        for (uint32_t entity : pendingEntities) {
+            if ((frameDirty[entity] & frameBit) && instanceIndices[entity] != NONE) {
+                writeInstance(entity, frameInstances, nullptr);
+            }
+            frameDirty[entity] &= ~frameBit;
+            if (frameDirty[entity] != 0) {
+                pendingEntities[kept++] = entity;
+            }
+        }
+        pendingEntities.resize(kept);
+        instanceWrites += lastInstanceWrites;
+    }
+    
+    uint32_t size() const {
+        return entityCount;
+    }
+    Statistics statistics() const {
+        return {entityCount, static_cast<uint32_t>(freeEntities.size()), capacity, lastWorldUpdates, lastInstanceWrites, instanceWrites};
+    }
+    
+    static const char* instructionSet() {
+#if defined(__SSE2__)
+        return "SSE2";
+#elif defined(__ARM_NEON)
+        return "NEON";
+#else
+        return "scalar";
 #endif
+    }
+    
+private:
+#if defined(__SSE2__)
+    using Lanes = __m128;
+    static constexpr uint32_t LANES = 4;
+    static Lanes load(const float* source) { return _mm_loadu_ps(source); }
+    static Lanes broadcast(float value) { return _mm_set1_ps(value); }
+    static void store(float* destination, Lanes value) { _mm_storeu_ps(destination, value); }
+    static Lanes add(Lanes a, Lanes b) { return _mm_add_ps(a, b); }
+    static Lanes sub(Lanes a, Lanes b) { return _mm_sub_ps(a, b); }
+    static Lanes mul(Lanes a, Lanes b) { return _mm_mul_ps(a, b); }
+    static Lanes abs(Lanes a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+#elif defined(__ARM_NEON)
+    using Lanes = float32x4_t;
+    static constexpr uint32_t LANES = 4;
+    static Lanes load(const float* source) { return vld1q_f32(source); }
+    static Lanes broadcast(float value) { return vdupq_n_f32(value); }
+    static void store(float* destination, Lanes value) { vst1q_f32(destination, value); }
+    static Lanes add(Lanes a, Lanes b) { return vaddq_f32(a, b); }
+    static Lanes sub(Lanes a, Lanes b) { return vsubq_f32(a, b); }
+    static Lanes mul(Lanes a, Lanes b) { return vmulq_f32(a, b); }
+    static Lanes abs(Lanes a) { return vabsq_f32(a); }
+#else
+    static constexpr uint32_t LANES = 1;
+#endif
+    static float add(float a, float b) { return a + b; }
+    static float sub(float a, float b) { return a - b; }
+    static float mul(float a, float b) { return a * b; }
+    static float abs(float a) { return std::fabs(a); }
+    
+    // world = parent * translate(position) * rotate(rotation) * scale(scale), as 3x4 affine matrices (column-major);
+    // the diagonal uses w^2 + x^2 - y^2 - z^2 rather than 1 - 2(y^2 + z^2), which is the same for unit quaternions
+    template <typename T>
+    static void composeWorld(const T (&position)[3], const T (&rotation)[4], const T (&scale)[3], const T (&parent)[12], T (&result)[12]) {
+        T x = rotation[0], y = rotation[1], z = rotation[2], w = rotation[3];
+        T xx = mul(x, x), yy = mul(y, y), zz = mul(z, z), ww = mul(w, w);
+        T xy = mul(x, y), xz = mul(x, z), yz = mul(y, z), wx = mul(w, x), wy = mul(w, y), wz = mul(w, z);
+        T local[12] = {
+            mul(sub(add(ww, xx), add(yy, zz)), scale[0]), mul(add(add(xy, wz), add(xy, wz)), scale[0]), mul(add(sub(xz, wy), sub(xz, wy)), scale[0]),
+            mul(add(sub(xy, wz), sub(xy, wz)), scale[1]), mul(sub(add(ww, yy), add(xx, zz)), scale[1]), mul(add(add(yz, wx), add(yz, wx)), scale[1]),
+            mul(add(add(xz, wy), add(xz, wy)), scale[2]), mul(add(sub(yz, wx), sub(yz, wx)), scale[2]), mul(sub(add(ww, zz), add(xx, yy)), scale[2]),
+            position[0], position[1], position[2],
+        };
+        for (int column = 0; column < 4; column++) {
+            for (int row = 0; row < 3; row++) {
+                T value = add(add(mul(parent[row], local[3 * column]), mul(parent[3 + row], local[3 * column + 1])), mul(parent[6 + row], local[3 * column + 2]));
+                result[3 * column + row] = column == 3 ? add(value, parent[9 + row]) : value;
+            }
+        }
+    }
+    // Instance bounds: the local box (center/extent form) under the world matrix, like Aabb::transformed()
+    template <typename T>
+    static void transformBounds(const T (&world)[12], const T (&center)[3], const T (&extent)[3], T (&bounds)[6]) {
+        for (int row = 0; row < 3; row++) {
+            T worldCenter = add(add(add(mul(world[row], center[0]), mul(world[3 + row], center[1])), mul(world[6 + row], center[2])), world[9 + row]);
+            T worldExtent = add(add(mul(abs(world[row]), extent[0]), mul(abs(world[3 + row]), extent[1])), mul(abs(world[6 + row]), extent[2]));
+            bounds[row] = sub(worldCenter, worldExtent);
+            bounds[3 + row] = add(worldCenter, worldExtent);
+        }
+    }
+    // LANES consecutive entities, none the parent of another; their instances are written from the lanes directly
+    void computeWorld(uint32_t begin, InstanceData* frameInstances, FrustumCuller* culler) {
+#if defined(__SSE2__) || defined(__ARM_NEON)
+        Lanes position[3] = {load(&positionX[begin]), load(&positionY[begin]), load(&positionZ[begin])};
+        Lanes rotation[4] = {load(&rotationX[begin]), load(&rotationY[begin]), load(&rotationZ[begin]), load(&rotationW[begin])};
+        Lanes scale[3] = {load(&scaleX[begin]), load(&scaleY[begin]), load(&scaleZ[begin])};
+        // Siblings usually share their parent; otherwise gather the parents' matrices into lanes
+        Lanes parent[12];
+        bool sharedParent = std::all_of(&parentSlots[begin], &parentSlots[begin] + LANES, [&](uint32_t slot) { return slot == parentSlots[begin]; });
+        for (size_t component = 0; component < 12; component++) {
+            if (sharedParent) {
+                parent[component] = broadcast(world[component][parentSlots[begin]]);
+            } else {
+                alignas(32) float gathered[LANES];
+                for (uint32_t lane = 0; lane < LANES; lane++) {
+                    gathered[lane] = world[component][parentSlots[begin + lane]];
+                }
+                parent[component] = load(gathered);
+            }
+        }
+        Lanes result[12];
+        composeWorld(position, rotation, scale, parent, result);
+        for (size_t component = 0; component < 12; component++) {
+            store(&world[component][begin], result[component]);
+        }
+        if (std::all_of(&instanceIndices[begin], &instanceIndices[begin] + LANES, [](uint32_t instance) { return instance == NONE; }))
+            return;
+        
+        Lanes center[3] = {load(&boundsCenterX[begin]), load(&boundsCenterY[begin]), load(&boundsCenterZ[begin])};
+        Lanes extent[3] = {load(&boundsExtentX[begin]), load(&boundsExtentY[begin]), load(&boundsExtentZ[begin])};
+        Lanes bounds[6];
+        transformBounds(result, center, extent, bounds);
+        alignas(32) float matrices[12][LANES];
+        alignas(32) float laneBounds[6][LANES];
+        for (size_t component = 0; component < 12; component++) {
+            store(matrices[component], result[component]);
+        }
+        for (size_t component = 0; component < 6; component++) {
+            store(laneBounds[component], bounds[component]);
+        }
+        for (uint32_t lane = 0; lane < LANES; lane++) {
+            if (instanceIndices[begin + lane] != NONE) {
+                emitInstance(instanceIndices[begin + lane], &matrices[0][lane], &laneBounds[0][lane], LANES, frameInstances, culler);
+            }
+        }
+#else
+        computeWorldScalar(begin);
+        if (instanceIndices[begin] != NONE) {
+            writeInstance(begin, frameInstances, culler);
+        }
+#endif
+    }
+    void computeWorldScalar(uint32_t entity) {
+        float position[3] = {positionX[entity], positionY[entity], positionZ[entity]};
+        float rotation[4] = {rotationX[entity], rotationY[entity], rotationZ[entity], rotationW[entity]};
+        float scale[3] = {scaleX[entity], scaleY[entity], scaleZ[entity]};
+        float parent[12];
+        for (size_t component = 0; component < 12; component++) {
+            parent[component] = world[component][parentSlots[entity]];
+        }
+        float result[12];
+        composeWorld(position, rotation, scale, parent, result);
+        for (size_t component = 0; component < 12; component++) {
+            world[component][entity] = result[component];
+        }
+    }
+    void writeInstance(uint32_t entity, InstanceData* frameInstances, FrustumCuller* culler) {
+        float matrix[12];
+        for (size_t component = 0; component < 12; component++) {
+            matrix[component] = world[component][entity];
+        }
+        float center[3] = {boundsCenterX[entity], boundsCenterY[entity], boundsCenterZ[entity]};
+        float extent[3] = {boundsExtentX[entity], boundsExtentY[entity], boundsExtentZ[entity]};
+        float bounds[6];
+        transformBounds(matrix, center, extent, bounds);
+        emitInstance(instanceIndices[entity], matrix, bounds, 1, frameInstances, culler);
+    }
+    // matrix/bounds components are stride floats apart
+    void emitInstance(uint32_t instance, const float* matrix, const float* bounds, size_t stride, InstanceData* frameInstances, FrustumCuller* culler) {
+        // One write of the whole instance into the mapped (possibly write-combined) buffer
+        auto at = [stride](const float* components, size_t component) { return components[component * stride]; };
+        glm::vec3 boundsMin(at(bounds, 0), at(bounds, 1), at(bounds, 2));
+        glm::vec3 boundsMax(at(bounds, 3), at(bounds, 4), at(bounds, 5));
+        frameInstances[instance] = InstanceData{glm::mat4(glm::vec4(at(matrix, 0), at(matrix, 1), at(matrix, 2), 0.0f),
+                                                          glm::vec4(at(matrix, 3), at(matrix, 4), at(matrix, 5), 0.0f),
+                                                          glm::vec4(at(matrix, 6), at(matrix, 7), at(matrix, 8), 0.0f),
+                                                          glm::vec4(at(matrix, 9), at(matrix, 10), at(matrix, 11), 1.0f)),
+                                                glm::vec4(boundsMin, 0.0f), glm::vec4(boundsMax, 0.0f)};
+        if (culler) {
+            culler->setBounds(instance, {boundsMin, boundsMax});
+        }
+        lastInstanceWrites++;
+    }
+    void markDirty(uint32_t entity) {
+        dirty[entity] = 1;
+        firstDirty = std::min(firstDirty, entity);
+    }
+    
+    uint32_t capacity = 0;
+    uint32_t entityCount = 0;
+    uint32_t firstDirty = NONE; // Lowest dirty entity, or NONE when nothing changed since the last update()
+    uint8_t allFrames = 0;
+    std::vector<float> positionX, positionY, positionZ;
+    std::vector<float> rotationX, rotationY, rotationZ, rotationW;
+    std::vector<float> scaleX, scaleY, scaleZ;
+    std::array<std::vector<float>, 12> world; // 3x4 affine, column-major; slot capacity is the identity
+    std::vector<uint32_t> parentSlots; // Parent entity, or capacity for roots
+    std::vector<uint32_t> instanceIndices;
+    std::vector<float> boundsCenterX, boundsCenterY, boundsCenterZ; // Local bounds of the instance's mesh
+    std::vector<float> boundsExtentX, boundsExtentY, boundsExtentZ;
+    std::vector<uint8_t> dirty; // Changed, or below a changed entity, since the last update()
+    std::vector<uint8_t> frameDirty; // Bit per frame whose instance copy is stale
+    std::vector<uint32_t> pendingEntities; // Entities with any frameDirty bit set
+    std::vector<uint32_t> freeEntities; // Destroyed entities, reused by create()
+    uint32_t lastWorldUpdates = 0;
+    uint32_t lastInstanceWrites = 0;
+    uint64_t instanceWrites = 0;
+};
 
-const std::string SOURCE_PATH = "/Users/joshuayu/Documents/Programming/Vulkan/FirstVulkanProgram/FirstVulkanProgram/";
-
-VkResult CreateDebugUtilsMessengerEXT(VkInstance instance, const VkDebugUtilsMessengerCreateInfoEXT* pCreateInfo, const VkAllocationCallbacks* pAllocator, VkDebugUtilsMessengerEXT* pDebugMessenger) {
-    auto func = (PFN_vkCreateDebugUtilsMessengerEXT) vkGetInstanceProcAddr(instance, "vkCreateDebugUtilsMessengerEXT");
-    if (func)
-        return func(instance, pCreateInfo, pAllocator, pDebugMessenger);
-    else
-        return VK_ERROR_EXTENSION_NOT_PRESENT;
-}
-
-void DestroyDebugUtilsMessengerEXT(VkInstance instance, VkDebugUtilsMessengerEXT debugMessenger, const VkAllocationCallbacks* pAllocator) {
-    auto func = (PFN_vkDestroyDebugUtilsMessengerEXT) vkGetInstanceProcAddr(instance, "vkDestroyDebugUtilsMessengerEXT");
-    if (func)
-        func(instance, debugMessenger, pAllocator);
-}
+// Fragment shader output selected by shader.frag's DEBUG_VIEW specialization constant
+enum DebugView : uint32_t {
+    DEBUG_VIEW_TEXTURED,
+    DEBUG_VIEW_VERTEX_COLOR,
+    DEBUG_VIEW_TEX_COORD,
+    DEBUG_VIEW_COUNT
+};
 
-struct QueueFamilyIndices {
-    std::optional<uint32_t> graphicsFamily;
-    std::optional<uint32_t> transferFamily;
-    std::optional<uint32_t> presentFamily;
-    bool isComplete() {
-        if (SEPARATE_TRANSFER_QUEUE_FAMILY) {
-            return graphicsFamily.has_value() && presentFamily.has_value() && transferFamily.has_value();
-        } else {
-            return graphicsFamily.has_value() && presentFamily.has_value();
-        }
+// One graphics pipeline permutation; everything else about the pipeline is shared (see createGraphicsPipeline())
+struct PipelineKey {
+    VkPolygonMode polygonMode = VK_POLYGON_MODE_FILL; // LINE needs the fillModeNonSolid feature
+    DebugView debugView = DEBUG_VIEW_TEXTURED;
+    bool gpuDriven = false; // Per-draw data from the GpuObject and GPU draw list buffers instead of push constants (shader.vert's GPU_DRIVEN)
+    
+    uint64_t packed() const {
+        return uint64_t(polygonMode) << 32 | uint64_t(gpuDriven) << 31 | debugView;
+    }
+    bool operator==(const PipelineKey& other) const {
+        return packed() == other.packed();
     }
 };
 
-struct SwapchainSupportDetails {
-    VkSurfaceCapabilitiesKHR capabilities;
-    std::vector<VkSurfaceFormatKHR> formats;
-    std::vector<VkPresentModeKHR> presentModes;
+// Permutations compiled at startup, in parallel; the first is the fallback that is always available. Others are compiled
+// in the background the first time they are requested
+const std::vector<PipelineKey> STARTUP_PIPELINES = {
+    {VK_POLYGON_MODE_FILL, DEBUG_VIEW_TEXTURED},
+    {VK_POLYGON_MODE_LINE, DEBUG_VIEW_TEXTURED},
+    {VK_POLYGON_MODE_FILL, DEBUG_VIEW_TEXTURED, true},
 };
 
-struct Vertex {
-    glm::vec3 pos;
-    glm::vec3 color;
-    glm::vec2 texCoord;
+// Pipeline permutations compiled on a pool of worker threads (into the caller's shared VkPipelineCache) and handed out by key
+// - get() never blocks: it returns VK_NULL_HANDLE while a permutation is queued or compiling (queueing it on first use),
+//   so callers draw with a fallback permutation until it is ready
+// - The compile function runs concurrently on the workers; vkCreateGraphicsPipelines is safe to call from several threads,
+//   including with the same pipeline cache
+class PipelineLibrary {
+public:
+    using CompileFunction = std::function<VkPipeline(const PipelineKey&)>;
+    struct Statistics {
+        uint32_t compiledCount = 0;
+        uint32_t failedCount = 0;
+        double compileMs = 0.0; // Summed over workers
+    };
     
-    static VkVertexInputBindingDescription getBindingDescription() {
-        VkVertexInputBindingDescription bindingDescription{};
-        bindingDescription.binding = 0;
-        bindingDescription.stride = sizeof(Vertex);
-        bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-        
-        return bindingDescription;
+    void init(VkDevice device, CompileFunction compile, uint32_t threadCount) {
+        this->device = device;
+        this->compile = std::move(compile);
+        stopping = false;
+        for (uint32_t i = 0; i < threadCount; i++) {
+            workers.emplace_back([this] { run(); });
+        }
     }
     
-    static std::array<VkVertexInputAttributeDescription, 3> getAttributeDescriptions() {
-        std::array<VkVertexInputAttributeDescription, 3> attributeDescriptions{};
-        attributeDescriptions[0].binding = 0;
-        attributeDescriptions[0].location = 0;
-        attributeDescriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT;
-        attributeDescriptions[0].offset = offsetof(Vertex, pos);
-        
-        attributeDescriptions[1].binding = 0;
-        attributeDescriptions[1].location = 1;
-        attributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
-        attributeDescriptions[1].offset = offsetof(Vertex, color);
-        
-        attributeDescriptions[2].binding = 0;
-        attributeDescriptions[2].location = 2;
-        attributeDescriptions[2].format = VK_FORMAT_R32G32_SFLOAT;
-        attributeDescriptions[2].offset = offsetof(Vertex, texCoord);
-        
-        return attributeDescriptions;
+    void request(const PipelineKey& key) {
+        std::lock_guard<std::mutex> lock(mutex);
+        enqueue(key);
+    }
+    VkPipeline get(const PipelineKey& key) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto entry = entries.find(key.packed());
+        if (entry == entries.end()) {
+            enqueue(key);
+            return VK_NULL_HANDLE;
+        }
+        return entry->second.state == Ready ? entry->second.pipeline : VK_NULL_HANDLE;
+    }
+    // Blocks until the permutation is compiled (for startup); throws if its compilation failed
+    VkPipeline wait(const PipelineKey& key) {
+        std::unique_lock<std::mutex> lock(mutex);
+        enqueue(key);
+        Entry& entry = entries[key.packed()];
+        finished.wait(lock, [&entry] { return entry.state == Ready || entry.state == Failed; });
+        if (entry.state == Failed) {
+            throw std::runtime_error("Failed to create graphics pipeline: " + entry.error);
+        }
+        return entry.pipeline;
+    }
+    
+    // Joins the workers (dropping queued permutations) and destroys every pipeline; the device must be idle
+    void destroy() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+            queue.clear();
+        }
+        workAvailable.notify_all();
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+        workers.clear();
+        for (auto& [packed, entry] : entries) {
+            if (entry.pipeline != VK_NULL_HANDLE) {
+                vkDestroyPipeline(device, entry.pipeline, nullptr);
+            }
+        }
+        entries.clear();
+    }
+    
+    Statistics statistics() {
+        std::lock_guard<std::mutex> lock(mutex);
+        Statistics statistics;
+        for (const auto& [packed, entry] : entries) {
+            statistics.compiledCount += entry.state == Ready;
+            statistics.failedCount += entry.state == Failed;
+            statistics.compileMs += entry.compileMs;
+        }
+        return statistics;
+    }
+    
+private:
+    enum State { Queued, Compiling, Ready, Failed };
+    struct Entry {
+        State state = Queued;
+        VkPipeline pipeline = VK_NULL_HANDLE;
+        double compileMs = 0.0;
+        std::string error;
     };
     
-    // For use in unordered_map
-    bool operator==(const Vertex& other) const {
-        return pos == other.pos && color == other.color && texCoord == other.texCoord;
+    VkDevice device = VK_NULL_HANDLE;
+    CompileFunction compile;
+    std::mutex mutex; // Guards everything below
+    std::condition_variable workAvailable;
+    std::condition_variable finished;
+    std::unordered_map<uint64_t, Entry> entries; // By PipelineKey::packed()
+    std::deque<PipelineKey> queue;
+    std::vector<std::thread> workers;
+    bool stopping = false;
+    
+    // Called with the mutex held
+    void enqueue(const PipelineKey& key) {
+        if (entries.contains(key.packed()))
+            return;
+        entries[key.packed()] = Entry{};
+        queue.push_back(key);
+        workAvailable.notify_one();
+    }
+    
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            workAvailable.wait(lock, [this] { return stopping || !queue.empty(); });
+            if (stopping)
+                return;
+            PipelineKey key = queue.front();
+            queue.pop_front();
+            entries[key.packed()].state = Compiling;
+            
+            lock.unlock();
+            auto startTime = std::chrono::high_resolution_clock::now();
+            VkPipeline pipeline = VK_NULL_HANDLE;
+            std::string error;
+            try {
+                pipeline = compile(key);
+            } catch (const std::exception& e) {
+                error = e.what();
+            }
+            double compileMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count();
+            lock.lock();
+            
+            Entry& entry = entries[key.packed()];
+            entry.state = pipeline != VK_NULL_HANDLE ? Ready : Failed;
+            entry.pipeline = pipeline;
+            entry.compileMs = compileMs;
+            entry.error = error;
+            finished.notify_all();
+        }
     }
 };
 
-namespace std {
-    // For use in unordered_map
-    template<> struct hash<Vertex> {
-        size_t operator()(const Vertex& vertex) const {
-            return ((hash<glm::vec3>()(vertex.pos) ^
-                   (hash<glm::vec3>()(vertex.color) << 1)) >> 1) ^
-                   (hash<glm::vec2>()(vertex.texCoord) << 1);
+// Records a frame's draws into secondary command buffers on a pool of worker threads
+// - Each thread (the workers, and the calling thread as thread 0) has its own VkCommandPool per frame in flight: a pool,
+//   and the command buffers allocated from it, may only be used by one thread at a time
+// - record() resets the frame's pools, so it must only be called once per frame, after the frame's fence signalled
+// - [0, count) is split into chunkCount contiguous ranges, taken by whichever thread is free; the secondaries continue the
+//   caller's render pass and are returned in range order, for one vkCmdExecuteCommands
+class ParallelCommandRecorder {
+public:
+    using RecordFunction = std::function<void(VkCommandBuffer, size_t begin, size_t end)>;
+    
+    void init(VkDevice device, uint32_t queueFamily, uint32_t frameCount, uint32_t workerCount) {
+        this->device = device;
+        threads.resize(workerCount + 1);
+        for (ThreadState& thread : threads) {
+            thread.frames.resize(frameCount);
+            for (FramePool& framePool : thread.frames) {
+                VkCommandPoolCreateInfo poolInfo{};
+                poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+                poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT; // Re-recorded every frame; reset as a whole with vkResetCommandPool
+                poolInfo.queueFamilyIndex = queueFamily;
+                if (vkCreateCommandPool(device, &poolInfo, nullptr, &framePool.pool) != VK_SUCCESS) {
+                    throw std::runtime_error("Failed to create recording thread command pool!");
+                }
+            }
+        }
+        stopping = false;
+        for (uint32_t i = 1; i <= workerCount; i++) {
+            workers.emplace_back([this, i] { run(i); });
+        }
+    }
+    
+    uint32_t threadCount() const {
+        return static_cast<uint32_t>(threads.size());
+    }
+    
+    const std::vector<VkCommandBuffer>& record(uint32_t frame, const VkCommandBufferInheritanceInfo& inheritance, size_t count, uint32_t chunkCount, const RecordFunction& body) {
+        for (ThreadState& thread : threads) {
+            FramePool& framePool = thread.frames[frame];
+            vkResetCommandPool(device, framePool.pool, 0);
+            framePool.used = 0;
+        }
+        secondaries.assign(chunkCount, VK_NULL_HANDLE);
+        job = {frame, &inheritance, count, chunkCount, &body};
+        nextChunk = 0;
+        error = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            busyWorkers = static_cast<uint32_t>(workers.size());
+            generation++;
+        }
+        workAvailable.notify_all();
+        
+        recordChunks(0);
+        std::unique_lock<std::mutex> lock(mutex);
+        finished.wait(lock, [this] { return busyWorkers == 0; });
+        if (error) {
+            std::rethrow_exception(error);
         }
+        return secondaries;
+    }
+    
+    // Joins the workers and destroys the pools (freeing their command buffers); the device must be idle
+    void destroy() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        workAvailable.notify_all();
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+        workers.clear();
+        for (ThreadState& thread : threads) {
+            for (FramePool& framePool : thread.frames) {
+                vkDestroyCommandPool(device, framePool.pool, nullptr);
+            }
+        }
+        threads.clear();
+    }
+    
+private:
+    struct FramePool {
+        VkCommandPool pool = VK_NULL_HANDLE;
+        std::vector<VkCommandBuffer> commandBuffers; // Allocated as needed, reused every frame
+        uint32_t used = 0;
     };
-}
+    struct ThreadState {
+        std::vector<FramePool> frames;
+    };
+    struct Job {
+        uint32_t frame = 0;
+        const VkCommandBufferInheritanceInfo* inheritance = nullptr;
+        size_t count = 0;
+        uint32_t chunkCount = 0;
+        const RecordFunction* body = nullptr;
+    };
+    
+    VkDevice device = VK_NULL_HANDLE;
+    std::vector<ThreadState> threads; // Indexed by thread; 0 is the thread calling record()
+    std::vector<std::thread> workers;
+    std::vector<VkCommandBuffer> secondaries; // Of the current job, by chunk
+    Job job; // Written by record() before the workers are woken
+    std::atomic<uint32_t> nextChunk{0};
+    std::exception_ptr error; // First exception thrown by a RecordFunction
+    std::mutex mutex; // Guards everything below, and error
+    std::condition_variable workAvailable;
+    std::condition_variable finished;
+    uint64_t generation = 0; // Incremented per job
+    uint32_t busyWorkers = 0;
+    bool stopping = false;
+    
+    void run(uint32_t threadIndex) {
+        uint64_t seenGeneration = 0;
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            workAvailable.wait(lock, [this, seenGeneration] { return stopping || generation != seenGeneration; });
+            if (stopping)
+                return;
+            seenGeneration = generation;
+            lock.unlock();
+            recordChunks(threadIndex);
+            lock.lock();
+            if (--busyWorkers == 0) {
+                finished.notify_all();
+            }
+        }
+    }
+    
+    void recordChunks(uint32_t threadIndex) {
+        FramePool& framePool = threads[threadIndex].frames[job.frame];
+        for (uint32_t chunk = nextChunk++; chunk < job.chunkCount; chunk = nextChunk++) {
+            try {
+                if (framePool.used == framePool.commandBuffers.size()) {
+                    VkCommandBufferAllocateInfo allocateInfo{};
+                    allocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+                    allocateInfo.commandPool = framePool.pool;
+                    allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY; // Executed from a primary command buffer
+                    allocateInfo.commandBufferCount = 1;
+                    VkCommandBuffer commandBuffer;
+                    if (vkAllocateCommandBuffers(device, &allocateInfo, &commandBuffer) != VK_SUCCESS) {
+                        throw std::runtime_error("Failed to allocate secondary command buffer!");
+                    }
+                    framePool.commandBuffers.push_back(commandBuffer);
+                }
+                VkCommandBuffer commandBuffer = framePool.commandBuffers[framePool.used++];
+                
+                VkCommandBufferBeginInfo beginInfo{};
+                beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+                beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT; // Entirely inside the render pass
+                beginInfo.pInheritanceInfo = job.inheritance;
+                if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+                    throw std::runtime_error("Failed to begin recording secondary command buffer!");
+                }
+                size_t begin = job.count * chunk / job.chunkCount;
+                size_t end = job.count * (chunk + 1) / job.chunkCount;
+                (*job.body)(commandBuffer, begin, end);
+                if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+                    throw std::runtime_error("Failed to end recording secondary command buffer!");
+                }
+                secondaries[chunk] = commandBuffer;
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!error) {
+                    error = std::current_exception();
+                }
+            }
+        }
+    }
+};
 
-//const std::vector<Vertex> vertices = {
-//    // Top square
-//    {{-0.5f, -0.5f, 0.0f}, {1.0f, 0.0f, 0.0f}, {1.0f, 0.0f}},
-//    {{0.5f, -0.5f, 0.0f}, {0.0f, 1.0f, 0.0f}, {0.0f, 0.0f}},
-//    {{0.5f, 0.5f, 0.0f}, {0.0f, 0.0f, 1.0f}, {0.0f, 1.0f}},
-//    {{-0.5f, 0.5f, 0.0f}, {1.0f, 1.0f, 1.0f}, {1.0f, 1.0f}},
-//    // Bottom square
-//    {{-0.5f, -0.5f, -0.5f}, {1.0f, 0.0f, 0.0f}, {1.0f, 0.0f}},
-//    {{0.5f, -0.5f, -0.5f}, {0.0f, 1.0f, 0.0f}, {0.0f, 0.0f}},
-//    {{0.5f, 0.5f, -0.5f}, {0.0f, 0.0f, 1.0f}, {0.0f, 1.0f}},
-//    {{-0.5f, 0.5f, -0.5f}, {1.0f, 1.0f, 1.0f}, {1.0f, 1.0f}}
-//};
-//
-//const std::vector<uint16_t> indices = {
-//    // Top square
-//    0, 1, 2, 2, 3, 0,
-//    // Bottom square
-//    4, 5, 6, 6, 7, 4
-//};
+// Container mip levels that are still being streamed in (see HelloTriangleApplication::startTextureStreaming())
+// - The main thread hands out staging ring space level by level through requestedLevel, as the ring has room
+// - The worker thread copies levels from the mapped container into that space, next-finer level first, and publishes its
+//   progress through preparedLevel; all Vulkan calls stay on the main thread
+struct TextureStream {
+    struct Upload {
+        uint32_t baseLevel; // Levels [baseLevel, previous upload's baseLevel) are copied by this upload
+        uint64_t uploadValue; // UploadBatcher timeline value that signals the upload's completion
+    };
+    
+    MappedFile file;
+    std::vector<Ktx2LevelIndex> levels;
+    std::vector<StagingRing::Region> stagingRegions; // Per streamed level, assigned before the level is requested
+    std::thread worker;
+    std::atomic<uint32_t> requestedLevel{0}; // Levels >= requestedLevel have staging space
+    std::atomic<uint32_t> preparedLevel{0}; // Levels >= preparedLevel are in staging memory
+    std::atomic<bool> cancelled{false};
+    uint32_t submittedLevel = 0; // Levels >= submittedLevel have been submitted for upload
+    std::deque<Upload> uploads; // In submission order
+    std::chrono::high_resolution_clock::time_point startTime;
+    
+    void cancel() {
+        // Wakes the worker if it's waiting for staging space
+        cancelled = true;
+        requestedLevel = 0;
+        requestedLevel.notify_all();
+        if (worker.joinable())
+            worker.join();
+    }
+    ~TextureStream() {
+        cancel();
+    }
+};
 
+// Per-view data, in one uniform buffer per frame in flight
 struct UniformBufferObject {
     // Remember alignment requirements
     // - Scalars: N (= 4 bytes given 32-bit floats)
@@ -170,11 +4802,91 @@ struct UniformBufferObject {
     // - vec3, vec4: 4N
     // - Nested structs: Aligned by base of its members rounded up to a multiple of 16 bytes (4N)
     // - mat4: same as vec4
-    glm::vec2 foo;
+    alignas(16) glm::mat4 view;
+    alignas(16) glm::mat4 proj;
+};
+
+// Per-draw vertex shader push constants (96 of the 128 bytes every device supports)
+struct DrawPushConstants {
     alignas(16) glm::mat4 model;
-    glm::mat4 view; // good practice to be explicit and specify alignas(16) anyway
-    glm::mat4 proj; // good practice to be explicit and specify alignas(16) anyway
+    MeshDequantization dequantization;
+};
+
+// Per-draw data that doesn't belong in push constants, pushed into the DynamicUniformRing
+struct DrawUniforms {
+    alignas(16) glm::vec4 tint; // Multiplies the texture color
+};
+
+// A mesh placed in the scene
+struct RenderObject {
+    GeometryBuffer::Mesh mesh;
+    uint32_t entity = SceneGraph::NONE; // Its world matrix is the object's model matrix
+    glm::vec4 tint = glm::vec4(1.0f);
+    uint32_t firstInstance = InstanceBuffer::IDENTITY; // Range of the InstanceBuffer drawn with one instanced draw
+    uint32_t instanceCount = 1;
+};
+
+// A draw of the visible instances of a RenderObject, built each frame by cullObjects()
+// - firstInstance/instanceCount select entries of the frame's draw list, which hold the InstanceBuffer indices to draw
+// - Instances of one object at different levels of detail are separate draws
+struct VisibleDraw {
+    const RenderObject* object;
+    uint32_t firstInstance;
+    uint32_t instanceCount;
+    uint32_t lod = 0;
+};
+
+// Level of detail selection for the instances of an object, set up once per frame
+// - An instance's error in pixels is its level's error (mesh units), scaled by the instance's size relative to the mesh
+//   and by the object's model-view scale, over the view depth of the instance's nearest point, in pixels per unit at depth 1
+// - So the coarsest acceptable level is the last one with error <= errorScale * depth / instance size
+struct LodSelection {
+    glm::vec4 depthPlane; // View depth of an object-space point: dot(xyz, p) + w
+    float objectScale; // Object-space to view-space length scale (largest axis)
+    float errorScale;
+    
+    static LodSelection create(const glm::mat4& modelView, float pixelsPerUnit, const Aabb& meshBounds) {
+        LodSelection selection;
+        selection.depthPlane = -glm::vec4(modelView[0][2], modelView[1][2], modelView[2][2], modelView[3][2]); // The camera looks down -z
+        selection.objectScale = std::max({glm::length(glm::vec3(modelView[0])), glm::length(glm::vec3(modelView[1])), glm::length(glm::vec3(modelView[2]))});
+        float meshSize = glm::length(meshBounds.max - meshBounds.min);
+        selection.errorScale = LOD_PIXEL_ERROR * meshSize / std::max(selection.objectScale * pixelsPerUnit, 1e-20f);
+        return selection;
+    }
+    // Same test as cull.comp
+    uint32_t select(const GeometryBuffer::Mesh& mesh, glm::vec3 boundsMin, glm::vec3 boundsMax) const {
+        float size = glm::length(boundsMax - boundsMin);
+        float depth = glm::dot(glm::vec3(depthPlane), 0.5f * (boundsMin + boundsMax)) + depthPlane.w - 0.5f * size * objectScale;
+        float maxError = errorScale * std::max(depth, 0.0f) / std::max(size, 1e-20f);
+        uint32_t lod = mesh.lodCount - 1;
+        while (lod > 0 && mesh.lods[lod].error > maxError) {
+            lod--;
+        }
+        return lod;
+    }
+};
+
+// A RenderObject as seen by the GPU-driven path: written by cullObjects() each frame, read by cull.comp and shader.vert
+struct GpuObject {
+    alignas(16) glm::mat4 model; // World matrix of the object's entity
+    MeshDequantization dequantization;
+    alignas(16) glm::vec4 tint;
+    alignas(16) glm::vec4 frustumPlanes[6]; // In object space, like the instance bounds (see Frustum)
+    alignas(16) glm::vec4 boundsMin; // Mesh bounds, for objects drawn with the IDENTITY instance
+    alignas(16) glm::vec4 boundsMax;
+    alignas(16) glm::vec4 depthPlane; // LodSelection
+    float objectScale;
+    float lodErrorScale;
+    uint32_t lodCount; // 1 when LOD selection is off
+    int32_t vertexOffset;
+    uint32_t firstInstance;
+    uint32_t instanceCount;
+    uint32_t drawListOffset; // Each level's visible instances are written from drawListOffset + level * instanceCount in the GPU draw list
+    uint32_t padding;
+    alignas(16) glm::uvec4 lods[MAX_MESH_LODS]; // firstIndex, indexCount, error (float bits), unused
 };
+static_assert(sizeof(GpuObject) == 384 && offsetof(GpuObject, lods) % 16 == 0,
+              "GpuObject must match the std430 struct in cull.comp and shader.vert (which hardcode MAX_MESH_LODS = 6)");
 
 class HelloTriangleApplication {
 public:    
@@ -197,6 +4909,7 @@ public:
     }
     
     void run() {
+        startTime = std::chrono::high_resolution_clock::now();
         initWindow();
         initVulkan();
         mainLoop();
@@ -204,6 +4917,7 @@ public:
     }
 private:
     GLFWwindow *window;
+    std::chrono::high_resolution_clock::time_point startTime; // For the time-to-first-frame report
     // Instance
     VkInstance instance;
     VkDebugUtilsMessengerEXT debugMessenger;
@@ -216,17 +4930,28 @@ private:
     VkQueue transferQueue;
     std::vector<const char*> deviceExtensions = { VK_KHR_SWAPCHAIN_EXTENSION_NAME };
     bool portabilitySubsetExtSupported = false;
+    bool memoryBudgetExtSupported = false;
+    bool timelineSemaphoreExtSupported = false;
+    bool timelineSemaphoreSupported = false; // VK_KHR_timeline_semaphore enabled with its feature (checked in pickPhysicalDevice())
+    DeviceMemoryAllocator allocator; // All buffer and image memory
     // Swapchain
     VkSwapchainKHR swapchain;
     VkFormat swapchainImageFormat;
     VkExtent2D swapchainExtent;
+    VkPresentModeKHR swapchainPresentMode = VK_PRESENT_MODE_FIFO_KHR;
     std::vector<VkImage> swapchainImages;
     std::vector<VkImageView> swapchainImageViews;
     // Graphics pipeline
     VkRenderPass renderPass;
     VkDescriptorSetLayout descriptorSetLayout;
     VkPipelineLayout pipelineLayout;
-    VkPipeline graphicsPipeline;
+    VkShaderModule vertShaderModule;
+    VkShaderModule fragShaderModule;
+    PipelineLibrary pipelineLibrary; // Graphics pipeline permutations
+    PipelineKey pipelineKey; // Permutation to draw with (F1: wireframe, F2: debug view)
+    bool wireframeSupported = false; // fillModeNonSolid (checked in createLogicalDevice())
+    VkPipelineCache pipelineCache = VK_NULL_HANDLE;
+    bool pipelineCacheWarm = false; // Created from data saved by a previous run
     // Drawing
     std::vector<VkFramebuffer> swapchainFramebuffers;
     VkCommandPool graphicsCommandPool;
@@ -236,36 +4961,133 @@ private:
     std::vector<VkSemaphore> renderFinishedSemaphores;
     std::vector<VkFence> inFlightFences;
     uint32_t currentFrame = 0;
+    uint64_t frameNumber = 0; // Frames submitted so far
     bool framebufferResized = false;
-    // Vertex and index buffers
+    std::vector<std::pair<uint64_t, std::function<void()>>> deferredDestroys; // Run once frameNumber reaches the value (see deferDestroy())
+    // Uploads
+    VkBuffer stagingRingBuffer;
+    Allocation stagingRingAllocation;
+    StagingRing stagingRing;
+    UploadBatcher uploadBatcher; // Transfers recorded during loading (and streaming) and submitted together
+    // Vertex and index buffers, shared by every mesh
     VkBuffer vertexBuffer;
-    VkDeviceMemory vertexBufferMemory;
+    Allocation vertexBufferAllocation;
     VkBuffer indexBuffer;
-    VkDeviceMemory indexBufferMemory;
+    Allocation indexBufferAllocation;
+    GeometryBuffer geometry;
+    std::vector<GeometryBuffer::Mesh> meshes;
+    // Scene
+    std::vector<RenderObject> objects; // Drawn by recordCommandBuffer()
+    SceneGraph scene; // Transforms of the objects and the grid instances
+    uint32_t turntable = SceneGraph::NONE; // Parent of every RenderObject's entity; rotated by updateUniformBuffer()
+    uint32_t gridFirstEntity = 0; // First of the instance grid's entities, one per instance, in object space (see createScene())
+    uint32_t gridEntityCount = 0;
+    VkBuffer instanceStorageBuffer;
+    Allocation instanceStorageBufferAllocation;
+    InstanceBuffer instances; // Per-instance transforms of instanced objects
+    size_t instanceGridIndex = 0; // INSTANCE_GRID_COUNTS entry drawn (F3)
+    uint32_t instanceGridSide = 0; // Columns and rows of the current grid (see setInstanceGrid())
+    uint32_t instanceUpdateCursor = 0; // Next grid instance animateInstances() re-orients
+    // Culling
+    glm::mat4 viewProjection = glm::mat4(1.0f); // Set by updateUniformBuffer()
+    glm::mat4 viewMatrix = glm::mat4(1.0f); // Set by createScene(); the camera doesn't move
+    float lodPixelScale = 1.0f; // Pixels per unit of view-space size at depth 1; set by updateUniformBuffer()
+    bool lodEnabled = GENERATE_LODS; // F6 draws every instance at level 0
+    std::vector<uint8_t> instanceLods; // Per visible instance of the object being culled (see cullObject())
+    std::vector<uint32_t> lodSortScratch;
+    uint64_t drawnTriangles = 0; // At the selected LODs, summed over frames (benchmarkInstancing() measures the difference)
+    FrustumCuller instanceCuller; // Bounds of every instance in instances
+    VkBuffer drawListBuffer;
+    Allocation drawListBufferAllocation; // One list of InstanceBuffer indices per frame in flight, written by cullObjects()
+    std::vector<VisibleDraw> visibleDraws; // Drawn by recordCommandBuffer()
+    std::vector<uint32_t> cullScratch; // CPU culling output when verifying GPU culling
+    // GPU-driven rendering
+    bool drawIndirectCountExtSupported = false;
+    bool gpuDrivenSupported = false; // VK_KHR_draw_indirect_count, multiDrawIndirect, drawIndirectFirstInstance, a compute-capable graphics queue and shaders/cull.spv (checked in pickPhysicalDevice())
+    bool gpuDrivenEnabled = GPU_DRIVEN_RENDERING; // F4 switches to CPU culling and per-object draws
+    bool frameGpuDriven = false; // Path of the frame being recorded (see drawFrame())
+    PFN_vkCmdDrawIndexedIndirectCountKHR cmdDrawIndexedIndirectCount = nullptr;
+    VkDescriptorSetLayout cullDescriptorSetLayout;
+    VkPipelineLayout cullPipelineLayout;
+    VkPipeline cullInstancesPipeline = VK_NULL_HANDLE; // cull.comp, PASS = 0
+    VkPipeline buildDrawsPipeline = VK_NULL_HANDLE; // cull.comp, PASS = 1
+    struct GpuDrivenFrame {
+        VkBuffer objectBuffer = VK_NULL_HANDLE;
+        Allocation objectAllocation; // GpuObject per RenderObject, written by cullObjects()
+        VkBuffer drawListBuffer = VK_NULL_HANDLE;
+        Allocation drawListAllocation; // (instance, object) per visible instance, grouped by object and level; written by cull.comp
+        VkBuffer indirectBuffer = VK_NULL_HANDLE;
+        Allocation indirectAllocation; // VkDrawIndexedIndirectCommand per (object, level) with visible instances, written by cull.comp
+        VkBuffer countBuffer = VK_NULL_HANDLE;
+        Allocation countAllocation; // Draw count, then the visible instance count of each object's levels (MAX_MESH_LODS apart); read back by readGpuCullingResults()
+        VkDescriptorSet cullDescriptorSet;
+        uint32_t objectCount = 0;
+        uint32_t maxInstanceCount = 0; // Of any object; the width of the culling dispatch
+        uint64_t testedInstances = 0;
+        uint64_t expectedVisible = 0; // CPU culling result (VERIFY_GPU_CULLING)
+        std::vector<uint32_t> lodTriangles; // Per (object, level), indexed like the visible counts; 0 for levels not drawn
+        double cpuSeconds = 0.0;
+        bool pending = false; // Submitted with the GPU-driven path; results not read back yet
+    };
+    std::vector<GpuDrivenFrame> gpuDrivenFrames;
+    // Parallel command recording
+    ParallelCommandRecorder commandRecorder;
+    bool parallelRecordingEnabled = PARALLEL_COMMAND_RECORDING;
+    uint32_t recordingThreadLimit = UINT32_MAX; // Lowered by benchmarkCommandRecording()
+    std::vector<uint32_t> drawUniformOffsets; // Per visible draw; pushed on the main thread, since the DynamicUniformRing isn't thread-safe
+    double recordingSeconds = 0.0; // CPU time spent in recordCommandBuffer(), summed over frames
+    struct CullingReport {
+        uint32_t frames = 0;
+        uint64_t testedInstances = 0;
+        uint64_t visibleInstances = 0;
+        uint64_t triangles = 0; // Drawn, at the selected LODs
+        uint64_t lodInstances[MAX_MESH_LODS] = {}; // Visible instances drawn at each level
+        double seconds = 0.0;
+        std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+    } cullingReport;
     // Uniform buffers
     std::vector<VkBuffer> uniformBuffers;
-    std::vector<VkDeviceMemory> uniformBuffersMemory;
+    std::vector<Allocation> uniformBuffersAllocations;
     std::vector<void*> uniformBuffersMapped;
+    VkBuffer drawUniformBuffer;
+    Allocation drawUniformBufferAllocation;
+    DynamicUniformRing drawUniforms;
     VkDescriptorPool descriptorPool;
     std::vector<VkDescriptorSet> descriptorSets;
     // Texture
     uint32_t mipLevels;
+    uint32_t textureWidth = 0;
+    uint32_t textureHeight = 0;
+    VkFormat textureFormat = VK_FORMAT_R8G8B8A8_SRGB;
+    bool blockCompressionSupported = false; // BC1/BC7 can be sampled with linear filtering (checked in pickPhysicalDevice())
+    uint32_t residentMipLevel = 0; // Finest mip level uploaded so far; the image view starts at this level
+    TextureStream textureStream;
+    bool textureStreaming = false;
+    uint32_t textureDescriptorsDirty = 0; // Bit per frame in flight whose descriptor set still references a retired texture view
     VkImage textureImage;
-    VkDeviceMemory textureImageMemory;
+    Allocation textureImageAllocation;
     VkImageView textureImageView;
     VkSampler textureSampler;
     // Depth buffer
     VkImage depthImage;
-    VkDeviceMemory depthImageMemory;
+    Allocation depthImageAllocation;
     VkImageView depthImageView;
+    uint64_t transientAttachmentsReportFrame = UINT64_MAX; // drawFrame() reports the MSAA color/depth memory once this frame has been drawn
+    bool transientAttachmentsReported = false; // Once per run; swapchain recreation doesn't report again
     // Model
     std::vector<Vertex> vertices;
-    std::unordered_map<Vertex, uint32_t> uniqueVertices;
     std::vector<uint32_t> indices;
+    Aabb meshBounds; // Of vertices, computed by loadModel()
+    std::vector<MeshLod> meshLods; // Levels 1 and coarser of indices, computed by generateLods()
+    // Per-mesh GPU formats, chosen by selectMeshFormats()
+    bool useCompactVertices = false;
+    std::vector<CompactVertex> compactVertices;
+    MeshDequantization meshDequantization{};
+    VkIndexType indexType = VK_INDEX_TYPE_UINT32;
     // MSAA
     VkSampleCountFlagBits msaaSamples = VK_SAMPLE_COUNT_1_BIT;
     VkImage colorImage;
-    VkDeviceMemory colorImageMemory;
+    Allocation colorImageAllocation;
     VkImageView colorImageView;
     
     void initWindow() {
@@ -275,6 +5097,7 @@ private:
         glfwSetWindowUserPointer(window, this);
         glfwSetWindowSizeCallback(window, windowSizeCallback);
         glfwSetWindowIconifyCallback(window, windowIconifyCallback);
+        glfwSetKeyCallback(window, keyCallback);
     }
     void initVulkan() {
         // Instance
@@ -287,11 +5110,18 @@ private:
         // Swapchain
         createSwapchain();
         createSwapchainImageViews();
+        // Model (before the pipeline, whose vertex input depends on the mesh's vertex format)
+        loadModel(); // Includes optimizeMesh() when the mesh cache is cold
+        generateLods();
+        selectMeshFormats();
         // Pipeline
         createRenderPass(); // Render pass "description"
         createDescriptorSetLayout(); // Uniforms, samplers, etc.
+        createPipelineCache();
         createGraphicsPipeline();
+        createCullPipelines();
         createCommandPools();
+        createUploadBatcher();
         // Framebuffers and attachments
         createColorResources();
         createDepthResources();
@@ -300,50 +5130,189 @@ private:
         createTextureImage(); // Includes mipmap generation
         createTextureImageView();
         createTextureSampler();
-        // Buffers
-        loadModel();
-        createVertexBuffer();
-        createIndexBuffer();
+        // Scene and buffers
+        createScene();
+        createGeometryBuffers();
         createUniformBuffers();
+        createInstanceBuffer();
+        createGpuDrivenBuffers();
         // Descriptors
         createDescriptorPool();
         createDescriptorSets();
         // Command buffers and drawing
         createCommandBuffers();
         createSyncObjects();
+        
+        // Submit every load-time upload; the first frame waits for them on the GPU rather than the CPU waiting here
+        uploadBatcher.flush();
+        reportMemoryStatistics();
     }
     void mainLoop() {
+        if (BENCHMARK_INSTANCING) {
+            benchmarkInstancing();
+        }
+        if (BENCHMARK_COMMAND_RECORDING) {
+            benchmarkCommandRecording();
+        }
         while (!glfwWindowShouldClose(window)) {
             glfwPollEvents();
             drawFrame();
         }
         vkDeviceWaitIdle(device);
     }
+    void benchmarkInstancing() {
+        // Draw a grid of each INSTANCE_BENCHMARK_COUNTS size for a while and report the average frame time
+        // - Frame times are only uncapped with the mailbox present mode; with FIFO they bottom out at the refresh interval
+        const uint32_t warmupFrames = 30;
+        const uint32_t measuredFrames = 120;
+        std::cout << "Instancing benchmark (" << (swapchainPresentMode == VK_PRESENT_MODE_MAILBOX_KHR ? "mailbox" : "FIFO, vsync-limited")
+                  << ", up to " << INSTANCE_UPDATES_PER_FRAME << " instance updates per frame):" << std::endl;
+        for (uint32_t count : INSTANCE_BENCHMARK_COUNTS) {
+            setInstanceGrid(count);
+            for (uint32_t frame = 0; frame < warmupFrames && !glfwWindowShouldClose(window); frame++) {
+                glfwPollEvents();
+                drawFrame();
+            }
+            uint64_t writesBefore = scene.statistics().instanceWrites;
+            uint64_t trianglesBefore = drawnTriangles;
+            auto startTime = std::chrono::high_resolution_clock::now();
+            for (uint32_t frame = 0; frame < measuredFrames && !glfwWindowShouldClose(window); frame++) {
+                glfwPollEvents();
+                drawFrame();
+            }
+            double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count();
+            if (glfwWindowShouldClose(window))
+                break;
+            double triangles = double(drawnTriangles - trianglesBefore) / measuredFrames; // Visible, at the selected LODs
+            std::cout << "  " << count << " instances: " << 1000.0 * seconds / measuredFrames << " ms/frame, "
+                      << triangles * measuredFrames / seconds / 1e9 << " G triangles/s, "
+                      << double(scene.statistics().instanceWrites - writesBefore) / measuredFrames << " instances uploaded/frame" << std::endl;
+        }
+        setInstanceGrid(INSTANCE_GRID_COUNTS[instanceGridIndex]);
+    }
+    void benchmarkCommandRecording() {
+        // Draw RECORDING_BENCHMARK_DRAW_COUNTS copies of the model as separate objects (one draw each, CPU path) and report
+        // the average recordCommandBuffer() time with 1, 2, 4, ... recording threads
+        // - Measures CPU recording time only, so the present mode doesn't matter; 1 thread records inline into the primary
+        if (objects.empty() || commandRecorder.threadCount() < 2)
+            return;
+        const uint32_t warmupFrames = 30;
+        const uint32_t measuredFrames = 120;
+        setInstanceGrid(0); // Restored below; first, so the saved objects don't reference the grid's instances
+        std::vector<RenderObject> savedObjects = objects;
+        uint32_t savedEntityCount = scene.size(); // The copies' entities are created after it and removed below
+        bool savedGpuDrivenEnabled = gpuDrivenEnabled;
+        bool savedParallelRecordingEnabled = parallelRecordingEnabled;
+        gpuDrivenEnabled = false;
+        parallelRecordingEnabled = true;
+        
+        std::vector<uint32_t> threadCounts;
+        for (uint32_t threads = 1; threads < commandRecorder.threadCount(); threads *= 2) {
+            threadCounts.push_back(threads);
+        }
+        threadCounts.push_back(commandRecorder.threadCount());
+        std::cout << "Command recording benchmark (ms per frame, " << MIN_DRAWS_PER_RECORDING_THREAD << " draws per thread at least):" << std::endl;
+        for (uint32_t drawCount : RECORDING_BENCHMARK_DRAW_COUNTS) {
+            // A grid of small copies over the model's footprint, all in view
+            uint32_t side = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<double>(drawCount))));
+            float spacing = 2.0f / side;
+            objects.assign(drawCount, savedObjects.front());
+            scene.truncate(savedEntityCount);
+            for (uint32_t i = 0; i < drawCount; i++) {
+                glm::vec3 position((i % side + 0.5f) * spacing - 1.0f, (i / side + 0.5f) * spacing - 1.0f, 0.0f);
+                objects[i].entity = scene.create(turntable, position, glm::vec4(0.0f, 0.0f, 0.0f, 1.0f), glm::vec3(0.8f * spacing));
+                objects[i].tint = glm::vec4(0.5f + 0.5f * (i % 2), 1.0f, 0.5f + 0.5f * (i / side % 2), 1.0f);
+            }
+            std::cout << "  " << drawCount << " draws:";
+            double singleThreadMs = 0.0;
+            for (uint32_t threads : threadCounts) {
+                recordingThreadLimit = threads;
+                for (uint32_t frame = 0; frame < warmupFrames && !glfwWindowShouldClose(window); frame++) {
+                    glfwPollEvents();
+                    drawFrame();
+                }
+                recordingSeconds = 0.0;
+                for (uint32_t frame = 0; frame < measuredFrames && !glfwWindowShouldClose(window); frame++) {
+                    glfwPollEvents();
+                    drawFrame();
+                }
+                if (glfwWindowShouldClose(window))
+                    break;
+                double ms = 1000.0 * recordingSeconds / measuredFrames;
+                if (threads == 1) {
+                    singleThreadMs = ms;
+                }
+                std::cout << " " << threads << " thread" << (threads == 1 ? "" : "s") << " " << ms << " (" << singleThreadMs / ms << "x)" << (threads == threadCounts.back() ? "" : ",");
+            }
+            std::cout << std::endl;
+            if (glfwWindowShouldClose(window))
+                break;
+        }
+        
+        recordingThreadLimit = UINT32_MAX;
+        objects = savedObjects;
+        scene.truncate(savedEntityCount);
+        gpuDrivenEnabled = savedGpuDrivenEnabled;
+        parallelRecordingEnabled = savedParallelRecordingEnabled;
+        setInstanceGrid(INSTANCE_GRID_COUNTS[instanceGridIndex]);
+    }
     void cleanup() {
         cleanupSwapchain();
         
+        stopTextureStreaming();
+        runDeferredDestroys(UINT64_MAX);
+        
         vkDestroySampler(device, textureSampler, nullptr);
         vkDestroyImageView(device, textureImageView, nullptr);
         
         vkDestroyImage(device, textureImage, nullptr);
-        vkFreeMemory(device, textureImageMemory, nullptr);
+        allocator.free(textureImageAllocation);
         
         for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
             vkDestroyBuffer(device, uniformBuffers[i], nullptr);
-            vkFreeMemory(device, uniformBuffersMemory[i], nullptr);  // Free once buffer is no longer used (i.e., destroyed)
+            allocator.free(uniformBuffersAllocations[i]);  // Free once buffer is no longer used (i.e., destroyed)
+        }
+        vkDestroyBuffer(device, drawUniformBuffer, nullptr);
+        allocator.free(drawUniformBufferAllocation);
+        vkDestroyBuffer(device, instanceStorageBuffer, nullptr);
+        allocator.free(instanceStorageBufferAllocation);
+        vkDestroyBuffer(device, drawListBuffer, nullptr);
+        allocator.free(drawListBufferAllocation);
+        for (GpuDrivenFrame& gpuFrame : gpuDrivenFrames) {
+            vkDestroyBuffer(device, gpuFrame.objectBuffer, nullptr);
+            allocator.free(gpuFrame.objectAllocation);
+            vkDestroyBuffer(device, gpuFrame.drawListBuffer, nullptr);
+            allocator.free(gpuFrame.drawListAllocation);
+            vkDestroyBuffer(device, gpuFrame.indirectBuffer, nullptr);
+            allocator.free(gpuFrame.indirectAllocation);
+            vkDestroyBuffer(device, gpuFrame.countBuffer, nullptr);
+            allocator.free(gpuFrame.countAllocation);
         }
         
         vkDestroyDescriptorPool(device, descriptorPool, nullptr);
         
         vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
+        vkDestroyDescriptorSetLayout(device, cullDescriptorSetLayout, nullptr);
+        
+        uploadBatcher.destroy();
+        stagingRing.destroy();
+        vkDestroyBuffer(device, stagingRingBuffer, nullptr);
+        allocator.free(stagingRingAllocation);
         
         vkDestroyBuffer(device, indexBuffer, nullptr);
-        vkFreeMemory(device, indexBufferMemory, nullptr);  // Free once buffer is no longer used (i.e., destroyed)
+        allocator.free(indexBufferAllocation);  // Free once buffer is no longer used (i.e., destroyed)
         
         vkDestroyBuffer(device, vertexBuffer, nullptr);
-        vkFreeMemory(device, vertexBufferMemory, nullptr);  // Free once buffer is no longer used (i.e., destroyed)
+        allocator.free(vertexBufferAllocation);  // Free once buffer is no longer used (i.e., destroyed)
         
-        vkDestroyPipeline(device, graphicsPipeline, nullptr);
+        pipelineLibrary.destroy();
+        vkDestroyPipeline(device, cullInstancesPipeline, nullptr);
+        vkDestroyPipeline(device, buildDrawsPipeline, nullptr);
+        vkDestroyPipelineLayout(device, cullPipelineLayout, nullptr);
+        vkDestroyShaderModule(device, vertShaderModule, nullptr);
+        vkDestroyShaderModule(device, fragShaderModule, nullptr);
+        savePipelineCache();
+        vkDestroyPipelineCache(device, pipelineCache, nullptr);
         vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
         vkDestroyRenderPass(device, renderPass, nullptr);
         
@@ -353,8 +5322,11 @@ private:
             vkDestroySemaphore(device, imageAvailableSemaphores[i], nullptr);
         }
         
+        commandRecorder.destroy();
         vkDestroyCommandPool(device, graphicsCommandPool, nullptr);
         vkDestroyCommandPool(device, transferCommandPool, nullptr);
+        
+        allocator.destroy();
 
         vkDestroyDevice(device, nullptr);
         
@@ -376,14 +5348,37 @@ private:
         auto app = reinterpret_cast<HelloTriangleApplication*>(glfwGetWindowUserPointer(window));
         app->framebufferResized = true;
     }
+    static void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods) {
+        // Switch pipeline permutations; one that isn't compiled yet is compiled in the background (see recordCommandBuffer())
+        auto app = reinterpret_cast<HelloTriangleApplication*>(glfwGetWindowUserPointer(window));
+        if (action != GLFW_PRESS)
+            return;
+        if (key == GLFW_KEY_F1 && app->wireframeSupported) {
+            app->pipelineKey.polygonMode = app->pipelineKey.polygonMode == VK_POLYGON_MODE_FILL ? VK_POLYGON_MODE_LINE : VK_POLYGON_MODE_FILL;
+        } else if (key == GLFW_KEY_F2) {
+            app->pipelineKey.debugView = static_cast<DebugView>((app->pipelineKey.debugView + 1) % DEBUG_VIEW_COUNT);
+        } else if (key == GLFW_KEY_F3) {
+            app->instanceGridIndex = (app->instanceGridIndex + 1) % INSTANCE_GRID_COUNTS.size();
+            app->setInstanceGrid(INSTANCE_GRID_COUNTS[app->instanceGridIndex]);
+        } else if (key == GLFW_KEY_F4 && app->gpuDrivenSupported) {
+            app->gpuDrivenEnabled = !app->gpuDrivenEnabled;
+            std::cout << (app->gpuDrivenEnabled ? "GPU-driven culling and indirect draws" : "CPU culling and per-object draws") << std::endl;
+        } else if (key == GLFW_KEY_F5 && PARALLEL_COMMAND_RECORDING) {
+            app->parallelRecordingEnabled = !app->parallelRecordingEnabled;
+            std::cout << (app->parallelRecordingEnabled ? "Parallel" : "Single-threaded") << " command recording" << std::endl;
+        } else if (key == GLFW_KEY_F6 && GENERATE_LODS) {
+            app->lodEnabled = !app->lodEnabled;
+            std::cout << (app->lodEnabled ? "Per-instance LOD selection" : "Level 0 only") << std::endl;
+        }
+    }
     void cleanupSwapchain() {
         vkDestroyImageView(device, colorImageView, nullptr);
         vkDestroyImage(device, colorImage, nullptr);
-        vkFreeMemory(device, colorImageMemory, nullptr);
+        allocator.free(colorImageAllocation);
         
         vkDestroyImageView(device, depthImageView, nullptr);
         vkDestroyImage(device, depthImage, nullptr);
-        vkFreeMemory(device, depthImageMemory, nullptr);
+        allocator.free(depthImageAllocation);
         
         for (auto framebuffer : swapchainFramebuffers) {
             vkDestroyFramebuffer(device, framebuffer, nullptr);
@@ -549,10 +5544,29 @@ private:
         for (const auto& device : devices) {
             if (isDeviceSuitable(device)) {
                 physicalDevice = device;
+                queryOptionalExtensions();
                 if (portabilitySubsetExtSupported) {
                     deviceExtensions.push_back("VK_KHR_portability_subset");
                 }
+                if (memoryBudgetExtSupported) {
+                    deviceExtensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME); // Heap budgets for DeviceMemoryAllocator placement
+                }
+                gpuDrivenSupported = GPU_DRIVEN_RENDERING && drawIndirectCountExtSupported && checkGpuDrivenSupport();
+                // cull.comp is built separately by compile.sh; without it every frame culls on the CPU
+                struct stat shaderStat;
+                if (gpuDrivenSupported && stat((SOURCE_PATH + "shaders/cull.spv").c_str(), &shaderStat) != 0) {
+                    std::cout << "shaders/cull.spv not found (run compile.sh), culling on the CPU" << std::endl;
+                    gpuDrivenSupported = false;
+                }
+                if (gpuDrivenSupported) {
+                    deviceExtensions.push_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME); // vkCmdDrawIndexedIndirectCountKHR (see recordCommandBuffer())
+                }
+                timelineSemaphoreSupported = timelineSemaphoreExtSupported && checkTimelineSemaphoreSupport();
+                if (timelineSemaphoreSupported) {
+                    deviceExtensions.push_back(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME); // Upload batch completion (see UploadBatcher)
+                }
                 msaaSamples = getMaxUsableSampleCount(); // of the physical device (value is 4 for my laptop)
+                blockCompressionSupported = checkBlockCompressionSupport();
                 break;
             }
             // Can also rate device suitability based on its properties and pick the best one!
@@ -562,6 +5576,49 @@ private:
             throw std::runtime_error("Failed to find a suitable GPU!");
         }
     }
+    bool checkBlockCompressionSupport() {
+        // BC formats need the textureCompressionBC feature; also require linear filtering of the formats the baker writes
+        VkPhysicalDeviceFeatures supportedFeatures;
+        vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+        if (!supportedFeatures.textureCompressionBC)
+            return false;
+        
+        VkFormatFeatureFlags requiredFeatures = VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+        for (VkFormat format : {VK_FORMAT_BC1_RGB_SRGB_BLOCK, VK_FORMAT_BC7_SRGB_BLOCK}) {
+            VkFormatProperties formatProperties;
+            vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &formatProperties);
+            if ((formatProperties.optimalTilingFeatures & requiredFeatures) != requiredFeatures)
+                return false;
+        }
+        return true;
+    }
+    bool checkGpuDrivenSupport() {
+        // Indirect draws with a draw count above 1 need multiDrawIndirect, and cull.comp writes each draw's offset into the
+        // instance list as firstInstance, which needs drawIndirectFirstInstance; the culling dispatch runs on the graphics queue
+        VkPhysicalDeviceFeatures supportedFeatures;
+        vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+        
+        uint32_t queueFamilyCount = 0;
+        vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+        std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+        vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+        uint32_t graphicsFamily = findQueueFamilies(physicalDevice).graphicsFamily.value();
+        return supportedFeatures.multiDrawIndirect && supportedFeatures.drawIndirectFirstInstance && (queueFamilies[graphicsFamily].queueFlags & VK_QUEUE_COMPUTE_BIT);
+    }
+    bool checkTimelineSemaphoreSupport() {
+        // The extension alone doesn't enable timeline semaphores; the feature must be supported too
+        // - VK_KHR_get_physical_device_properties2 is always enabled on the instance (see createInstance())
+        auto getFeatures2 = (PFN_vkGetPhysicalDeviceFeatures2KHR) vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceFeatures2KHR");
+        if (!getFeatures2)
+            return false;
+        VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timelineFeatures{};
+        timelineFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+        VkPhysicalDeviceFeatures2KHR features{};
+        features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        features.pNext = &timelineFeatures;
+        getFeatures2(physicalDevice, &features);
+        return timelineFeatures.timelineSemaphore;
+    }
     bool isDeviceSuitable(VkPhysicalDevice device, bool print = false) {
         VkPhysicalDeviceProperties deviceProperties;
         vkGetPhysicalDeviceProperties(device, &deviceProperties);
@@ -635,12 +5692,31 @@ private:
         std::set<std::string> requiredExtensions(deviceExtensions.begin(), deviceExtensions.end());
         for (const auto& extension : availableExtensions) {
             requiredExtensions.erase(extension.extensionName);
+        }
+        
+        return requiredExtensions.empty();
+    }
+    void queryOptionalExtensions() {
+        // Optional extensions of the selected physicalDevice; pickPhysicalDevice() enables the ones it uses
+        uint32_t extensionCount = 0;
+        vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, nullptr);
+        std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+        vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, availableExtensions.data());
+        
+        for (const auto& extension : availableExtensions) {
             if (strcmp(extension.extensionName, "VK_KHR_portability_subset") == 0) {
                 portabilitySubsetExtSupported = true;
             }
+            if (strcmp(extension.extensionName, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME) == 0) {
+                memoryBudgetExtSupported = true;
+            }
+            if (strcmp(extension.extensionName, VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME) == 0) {
+                timelineSemaphoreExtSupported = true;
+            }
+            if (strcmp(extension.extensionName, VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME) == 0) {
+                drawIndirectCountExtSupported = true;
+            }
         }
-        
-        return requiredExtensions.empty();
     }
     SwapchainSupportDetails querySwapchainSupport(VkPhysicalDevice device) {
         SwapchainSupportDetails details;
@@ -705,10 +5781,22 @@ private:
         VkPhysicalDeviceFeatures deviceFeatures{};
         deviceFeatures.samplerAnisotropy = VK_TRUE; // When sampling images
         deviceFeatures.sampleRateShading = VK_TRUE; // Sample shading (for multisampling)
+        deviceFeatures.textureCompressionBC = blockCompressionSupported ? VK_TRUE : VK_FALSE; // BC1/BC7 texture containers
+        VkPhysicalDeviceFeatures supportedFeatures;
+        vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+        wireframeSupported = supportedFeatures.fillModeNonSolid;
+        deviceFeatures.fillModeNonSolid = supportedFeatures.fillModeNonSolid; // Wireframe pipeline permutations
+        deviceFeatures.multiDrawIndirect = gpuDrivenSupported ? VK_TRUE : VK_FALSE; // GPU-driven indirect draws
+        deviceFeatures.drawIndirectFirstInstance = gpuDrivenSupported ? VK_TRUE : VK_FALSE; // Nonzero firstInstance from cull.comp
+        
+        VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timelineFeatures{};
+        timelineFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+        timelineFeatures.timelineSemaphore = VK_TRUE;
         
         // Logical device create info (queues, features, extensions)
         VkDeviceCreateInfo createInfo{};
         createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+        createInfo.pNext = timelineSemaphoreSupported ? &timelineFeatures : nullptr;
         createInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
         createInfo.pQueueCreateInfos = queueCreateInfos.data();
         createInfo.pEnabledFeatures = &deviceFeatures;
@@ -726,16 +5814,21 @@ private:
         if (SEPARATE_TRANSFER_QUEUE_FAMILY) {
             vkGetDeviceQueue(device, indices.transferFamily.value(), 0, &transferQueue);
         }
+        
+        // VK_KHR_get_physical_device_properties2 is always enabled on the instance (see createInstance())
+        auto getMemoryProperties2 = (PFN_vkGetPhysicalDeviceMemoryProperties2KHR) vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceMemoryProperties2KHR");
+        allocator.init(physicalDevice, device, memoryBudgetExtSupported ? getMemoryProperties2 : nullptr);
     }
     
     // ================ createSwapchain() ================
-    void createSwapchain() {
+    void createSwapchain(VkSwapchainKHR oldSwapchain = VK_NULL_HANDLE) {
         // Query capabilities, surface formats, present modes of physical device
         SwapchainSupportDetails swapchainSupport = querySwapchainSupport(physicalDevice);
 
         // Pick surface format and present mode
         VkSurfaceFormatKHR surfaceFormat = chooseSwapSurfaceFormat(swapchainSupport.formats);
         VkPresentModeKHR presentMode = chooseSwapPresentMode(swapchainSupport.presentModes);
+        swapchainPresentMode = presentMode;
         
         // Determine image count and extent based on capabilities
         uint32_t imageCount = swapchainSupport.capabilities.minImageCount + 1;
@@ -777,7 +5870,7 @@ private:
         createInfo.presentMode = presentMode; // Want MAILBOX
         createInfo.clipped = VK_TRUE; // We don't care about pixels that are obscured (by other windows)
         
-        createInfo.oldSwapchain = VK_NULL_HANDLE;   // if swap chain becomes invalid/unoptimized (e.g., window is resized)
+        createInfo.oldSwapchain = oldSwapchain;   // When recreating (e.g., window is resized): lets the implementation reuse resources, and images already acquired from it can still be presented
         
         if (vkCreateSwapchainKHR(device, &createInfo, nullptr, &swapchain) != VK_SUCCESS) {
             throw std::runtime_error("Failed to create swap chain!");
@@ -854,7 +5947,7 @@ private:
         colorAttachment.format = swapchainImageFormat;
         colorAttachment.samples = msaaSamples; // Multi-sampling
         colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR; // Clear previous color from framebuffer before drawing
-        colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE; // Store rendered contents in memory
+        colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE; // Only the resolve attachment is kept, so the multisampled contents needn't be written to memory
         colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
         colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
         colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
@@ -865,7 +5958,7 @@ private:
         depthAttachment.format = findDepthFormat();
         depthAttachment.samples = msaaSamples; // Multi-sampling
         depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR; // Clear previous color from framebuffer before drawing
-        depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE; // Store rendered contents in memory
+        depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE; // Depth isn't used after the render pass
         depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
         depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
         depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
@@ -955,7 +6048,42 @@ private:
         samplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
         samplerLayoutBinding.pImmutableSamplers = nullptr;  // for image sampling
         
-        std::array<VkDescriptorSetLayoutBinding, 2> bindings = {uboLayoutBinding, samplerLayoutBinding};
+        // Per-draw UBO layout binding; bound at a different dynamic offset for each draw (the vertex shader passes the tint on)
+        VkDescriptorSetLayoutBinding drawUniformsLayoutBinding{};
+        drawUniformsLayoutBinding.binding = 2;
+        drawUniformsLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+        drawUniformsLayoutBinding.descriptorCount = 1;
+        drawUniformsLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+        drawUniformsLayoutBinding.pImmutableSamplers = nullptr;
+        
+        // Instance storage buffer layout binding; indexed with gl_InstanceIndex
+        VkDescriptorSetLayoutBinding instancesLayoutBinding{};
+        instancesLayoutBinding.binding = 3;
+        instancesLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        instancesLayoutBinding.descriptorCount = 1;
+        instancesLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+        instancesLayoutBinding.pImmutableSamplers = nullptr;
+        
+        // Draw list storage buffer layout binding; maps gl_InstanceIndex to the visible instance
+        VkDescriptorSetLayoutBinding drawListLayoutBinding{};
+        drawListLayoutBinding.binding = 4;
+        drawListLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        drawListLayoutBinding.descriptorCount = 1;
+        drawListLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+        drawListLayoutBinding.pImmutableSamplers = nullptr;
+        
+        // GPU-driven path layout bindings: per-object data and the draw list built by cull.comp
+        VkDescriptorSetLayoutBinding gpuObjectsLayoutBinding{};
+        gpuObjectsLayoutBinding.binding = 5;
+        gpuObjectsLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        gpuObjectsLayoutBinding.descriptorCount = 1;
+        gpuObjectsLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+        gpuObjectsLayoutBinding.pImmutableSamplers = nullptr;
+        VkDescriptorSetLayoutBinding gpuDrawListLayoutBinding = gpuObjectsLayoutBinding;
+        gpuDrawListLayoutBinding.binding = 6;
+        
+        std::array<VkDescriptorSetLayoutBinding, 7> bindings = {uboLayoutBinding, samplerLayoutBinding, drawUniformsLayoutBinding, instancesLayoutBinding, drawListLayoutBinding,
+                                                                gpuObjectsLayoutBinding, gpuDrawListLayoutBinding};
         VkDescriptorSetLayoutCreateInfo layoutInfo{};
         layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
         layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
@@ -966,37 +6094,253 @@ private:
         }
     }
     
+    // ================ createCullPipelines() ================
+    void createCullPipelines() {
+        // Compute pipelines of the GPU-driven path, both from cull.comp: PASS = 0 culls every object's instances into the
+        // draw list, PASS = 1 turns each object with visible instances into an indirect draw
+        std::array<VkDescriptorSetLayoutBinding, 5> bindings{};
+        for (uint32_t binding = 0; binding < bindings.size(); binding++) {
+            bindings[binding].binding = binding; // GpuObjects, instances, counts, draw list, indirect draws
+            bindings[binding].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            bindings[binding].descriptorCount = 1;
+            bindings[binding].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+            bindings[binding].pImmutableSamplers = nullptr;
+        }
+        VkDescriptorSetLayoutCreateInfo layoutInfo{};
+        layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+        layoutInfo.pBindings = bindings.data();
+        if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &cullDescriptorSetLayout) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to create culling descriptor set layout!");
+        }
+        
+        VkPushConstantRange pushConstantRange{};
+        pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        pushConstantRange.offset = 0;
+        pushConstantRange.size = sizeof(uint32_t); // Object count
+        VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+        pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        pipelineLayoutInfo.setLayoutCount = 1;
+        pipelineLayoutInfo.pSetLayouts = &cullDescriptorSetLayout;
+        pipelineLayoutInfo.pushConstantRangeCount = 1;
+        pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+        if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &cullPipelineLayout) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to create culling pipeline layout!");
+        }
+        
+        if (!gpuDrivenSupported) {
+            std::cout << "GPU-driven rendering " << (GPU_DRIVEN_RENDERING ? "unavailable (needs VK_KHR_draw_indirect_count, multiDrawIndirect, drawIndirectFirstInstance and cull.spv)" : "disabled")
+                      << ", culling on the CPU" << std::endl;
+            return;
+        }
+        cmdDrawIndexedIndirectCount = (PFN_vkCmdDrawIndexedIndirectCountKHR) vkGetDeviceProcAddr(device, "vkCmdDrawIndexedIndirectCountKHR");
+        
+        VkShaderModule cullShaderModule = createShaderModule(readFile(SOURCE_PATH + "shaders/cull.spv"));
+        for (uint32_t pass : {0u, 1u}) {
+            VkSpecializationMapEntry passEntry{};
+            passEntry.constantID = 0; // PASS in cull.comp
+            passEntry.offset = 0;
+            passEntry.size = sizeof(uint32_t);
+            VkSpecializationInfo specializationInfo{};
+            specializationInfo.mapEntryCount = 1;
+            specializationInfo.pMapEntries = &passEntry;
+            specializationInfo.dataSize = sizeof(pass);
+            specializationInfo.pData = &pass;
+            
+            VkComputePipelineCreateInfo pipelineInfo{};
+            pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+            pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+            pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+            pipelineInfo.stage.module = cullShaderModule;
+            pipelineInfo.stage.pName = "main";
+            pipelineInfo.stage.pSpecializationInfo = &specializationInfo;
+            pipelineInfo.layout = cullPipelineLayout;
+            VkPipeline& pipeline = pass == 0 ? cullInstancesPipeline : buildDrawsPipeline;
+            if (vkCreateComputePipelines(device, pipelineCache, 1, &pipelineInfo, nullptr, &pipeline) != VK_SUCCESS) {
+                throw std::runtime_error("Failed to create culling pipeline!");
+            }
+        }
+        vkDestroyShaderModule(device, cullShaderModule, nullptr);
+        std::cout << "GPU-driven rendering: compute culling and vkCmdDrawIndexedIndirectCount (F4 toggles CPU culling)" << std::endl;
+    }
+    
+    // ================ createPipelineCache() ================
+    void createPipelineCache() {
+        // Seed the pipeline cache with the data saved by savePipelineCache(), if it was written by this device and driver
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+        
+        MappedFile cacheFile;
+        const uint8_t* initialData = nullptr;
+        size_t initialDataSize = 0;
+        if (PIPELINE_CACHE_ENABLED && cacheFile.open(SOURCE_PATH + PIPELINE_CACHE_PATH) && cacheFile.size >= sizeof(PipelineCacheHeader)) {
+            PipelineCacheHeader header;
+            memcpy(&header, cacheFile.data, sizeof(header));
+            const uint8_t* data = cacheFile.data + sizeof(PipelineCacheHeader);
+            if (header.magic != PIPELINE_CACHE_MAGIC || header.version != PIPELINE_CACHE_VERSION
+                || header.vendorID != properties.vendorID || header.deviceID != properties.deviceID || header.driverVersion != properties.driverVersion
+                || memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) != 0) {
+                std::cout << "Pipeline cache is from another device or driver, starting cold." << std::endl;
+            } else if (cacheFile.size != sizeof(PipelineCacheHeader) + header.dataSize || hashBytes(data, header.dataSize) != header.dataHash) {
+                std::cout << "Pipeline cache is damaged, starting cold." << std::endl;
+            } else {
+                initialData = data;
+                initialDataSize = header.dataSize;
+            }
+        }
+        
+        VkPipelineCacheCreateInfo createInfo{};
+        createInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+        createInfo.initialDataSize = initialDataSize;
+        createInfo.pInitialData = initialData;
+        if (vkCreatePipelineCache(device, &createInfo, nullptr, &pipelineCache) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to create pipeline cache!");
+        }
+        pipelineCacheWarm = initialData != nullptr;
+    }
+    void savePipelineCache() {
+        // Write to a temporary file and rename it over the cache, so a crash mid-write never leaves a corrupt cache behind
+        if (!PIPELINE_CACHE_ENABLED)
+            return;
+        size_t dataSize = 0;
+        vkGetPipelineCacheData(device, pipelineCache, &dataSize, nullptr);
+        std::vector<uint8_t> data(dataSize);
+        if (dataSize == 0 || vkGetPipelineCacheData(device, pipelineCache, &dataSize, data.data()) != VK_SUCCESS)
+            return;
+        
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+        PipelineCacheHeader header{};
+        header.magic = PIPELINE_CACHE_MAGIC;
+        header.version = PIPELINE_CACHE_VERSION;
+        header.vendorID = properties.vendorID;
+        header.deviceID = properties.deviceID;
+        header.driverVersion = properties.driverVersion;
+        memcpy(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE);
+        header.dataSize = dataSize;
+        header.dataHash = hashBytes(data.data(), dataSize);
+        
+        std::string filename = SOURCE_PATH + PIPELINE_CACHE_PATH;
+        std::string tempFilename = filename + ".tmp";
+        std::ofstream file(tempFilename, std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) {
+            std::cerr << "Failed to write pipeline cache " << filename << std::endl; // Not fatal; next start compiles pipelines again
+            return;
+        }
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(data.data()), dataSize);
+        file.close();
+        
+        if (!file || std::rename(tempFilename.c_str(), filename.c_str()) != 0) {
+            std::cerr << "Failed to write pipeline cache " << filename << std::endl;
+            std::remove(tempFilename.c_str());
+        }
+    }
+    
     // ================ createGraphicsPipeline() ================
     void createGraphicsPipeline() {
+        // Create what every permutation shares, then have pipelineLibrary compile the startup permutations in parallel
+        // - Only the default permutation is waited for; the rest finish in the background while loading continues
+        
         // ===== Shader modules =====
-        auto vertShaderCode = readFile(SOURCE_PATH + "shaders/vert.spv");
+        auto vertShaderCode = readFile(SOURCE_PATH + (useCompactVertices ? "shaders/vert_compact.spv" : "shaders/vert.spv"));
         auto fragShaderCode = readFile(SOURCE_PATH + "shaders/frag.spv");
         
-        VkShaderModule vertShaderModule = createShaderModule(vertShaderCode);
-        VkShaderModule fragShaderModule = createShaderModule(fragShaderCode);
+        vertShaderModule = createShaderModule(vertShaderCode);
+        fragShaderModule = createShaderModule(fragShaderCode);
+        
+        // ===== Pipeline layout =====
+        // For descriptor set layouts (and push constants)
+        VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+        pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        pipelineLayoutInfo.setLayoutCount = 1;
+        pipelineLayoutInfo.pSetLayouts = &descriptorSetLayout;  // uniform buffer, image sampler
+        VkPushConstantRange pushConstantRange{};
+        pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+        pushConstantRange.offset = 0;
+        pushConstantRange.size = sizeof(DrawPushConstants);
+        pipelineLayoutInfo.pushConstantRangeCount = 1;
+        pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;  // Model matrix and CompactVertex dequantization
+        
+        if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &pipelineLayout) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to create pipeline layout!");
+        }
+        
+        // ===== Permutations =====
+        uint32_t threadCount = std::max(2u, std::thread::hardware_concurrency()) - 1;
+        pipelineLibrary.init(device, [this](const PipelineKey& key) { return compileGraphicsPipeline(key); }, threadCount);
+        
+        auto startTime = std::chrono::high_resolution_clock::now();
+        uint32_t queuedCount = 0;
+        for (const PipelineKey& key : STARTUP_PIPELINES) {
+            if ((key.polygonMode == VK_POLYGON_MODE_FILL || wireframeSupported) && (!key.gpuDriven || gpuDrivenSupported)) {
+                pipelineLibrary.request(key);
+                queuedCount++;
+            }
+        }
+        pipelineLibrary.wait(STARTUP_PIPELINES[0]);
+        std::cout << "Default graphics pipeline ready in " << std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count()
+                  << " ms (" << (pipelineCacheWarm ? "warm" : "cold") << " pipeline cache), " << queuedCount << " startup permutations on "
+                  << threadCount << " threads" << std::endl;
+    }
+    VkPipeline compileGraphicsPipeline(const PipelineKey& key) {
+        // Runs on pipelineLibrary's workers: only reads state that is fixed before the library is initialized
+        
+        // ===== Shader stages =====
+        // Specialization constants select the permutation's shader variant
+        VkSpecializationMapEntry debugViewEntry{};
+        debugViewEntry.constantID = 0; // DEBUG_VIEW in shader.frag
+        debugViewEntry.offset = 0;
+        debugViewEntry.size = sizeof(uint32_t);
+        uint32_t debugView = key.debugView;
+        VkSpecializationInfo fragSpecializationInfo{};
+        fragSpecializationInfo.mapEntryCount = 1;
+        fragSpecializationInfo.pMapEntries = &debugViewEntry;
+        fragSpecializationInfo.dataSize = sizeof(debugView);
+        fragSpecializationInfo.pData = &debugView;
+        
+        VkSpecializationMapEntry gpuDrivenEntry{};
+        gpuDrivenEntry.constantID = 1; // GPU_DRIVEN in shader.vert
+        gpuDrivenEntry.offset = 0;
+        gpuDrivenEntry.size = sizeof(VkBool32);
+        VkBool32 gpuDriven = key.gpuDriven;
+        VkSpecializationInfo vertSpecializationInfo{};
+        vertSpecializationInfo.mapEntryCount = 1;
+        vertSpecializationInfo.pMapEntries = &gpuDrivenEntry;
+        vertSpecializationInfo.dataSize = sizeof(gpuDriven);
+        vertSpecializationInfo.pData = &gpuDriven;
         
         VkPipelineShaderStageCreateInfo vertShaderStageInfo{};
         vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
         vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
         vertShaderStageInfo.module = vertShaderModule;
         vertShaderStageInfo.pName = "main"; // function in shader to invoke
-        vertShaderStageInfo.pSpecializationInfo = nullptr;  // for (optional) optimizations
+        vertShaderStageInfo.pSpecializationInfo = &vertSpecializationInfo;  // for (optional) optimizations
         
         VkPipelineShaderStageCreateInfo fragShaderStageInfo{};
         fragShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
         fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
         fragShaderStageInfo.module = fragShaderModule;
         fragShaderStageInfo.pName = "main"; // function in shader to invoke
-        fragShaderStageInfo.pSpecializationInfo = nullptr;  // for (optional) optimizations
+        fragShaderStageInfo.pSpecializationInfo = &fragSpecializationInfo;  // for (optional) optimizations
         
         VkPipelineShaderStageCreateInfo shaderStages[] = {vertShaderStageInfo, fragShaderStageInfo};
         
         // ===== Fixed-function states =====
         
         // --- Vertex input ---
-        // Vertex attribute binding and format
-        auto bindingDescription = Vertex::getBindingDescription();
-        auto attributeDescriptions = Vertex::getAttributeDescriptions();
+        // Vertex attribute binding and format (depends on the mesh's vertex format)
+        VkVertexInputBindingDescription bindingDescription;
+        std::vector<VkVertexInputAttributeDescription> attributeDescriptions;
+        if (useCompactVertices) {
+            bindingDescription = CompactVertex::getBindingDescription();
+            auto descriptions = CompactVertex::getAttributeDescriptions();
+            attributeDescriptions.assign(descriptions.begin(), descriptions.end());
+        } else {
+            bindingDescription = Vertex::getBindingDescription();
+            auto descriptions = Vertex::getAttributeDescriptions();
+            attributeDescriptions.assign(descriptions.begin(), descriptions.end());
+        }
         VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
         vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
         vertexInputInfo.vertexBindingDescriptionCount = 1;
@@ -1051,7 +6395,7 @@ private:
         rasterizationInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
         rasterizationInfo.depthClampEnable = VK_FALSE; // Don't clamp, discard
         rasterizationInfo.rasterizerDiscardEnable = VK_FALSE; // Yes, please rasterize
-        rasterizationInfo.polygonMode = VK_POLYGON_MODE_FILL; // Fill, line, point
+        rasterizationInfo.polygonMode = key.polygonMode; // Fill, line, point
         rasterizationInfo.lineWidth = 1.0f;
         rasterizationInfo.cullMode = VK_CULL_MODE_BACK_BIT;
         rasterizationInfo.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE; // glm::perspective flips y coordinate!
@@ -1107,19 +6451,6 @@ private:
         colorBlendInfo.blendConstants[2] = 0.0f;
         colorBlendInfo.blendConstants[3] = 0.0f;
         
-        // ===== Pipeline layout =====
-        // For descriptor set layouts (and push constants)
-        VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
-        pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-        pipelineLayoutInfo.setLayoutCount = 1;
-        pipelineLayoutInfo.pSetLayouts = &descriptorSetLayout;  // uniform buffer, image sampler
-        pipelineLayoutInfo.pushConstantRangeCount = 0;
-        pipelineLayoutInfo.pPushConstantRanges = nullptr;
-        
-        if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &pipelineLayout) != VK_SUCCESS) {
-            throw std::runtime_error("Failed to create pipeline layout!");
-        }
-        
         // ===== Graphics pipeline =====
         VkGraphicsPipelineCreateInfo graphicsPipelineInfo{};
         graphicsPipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
@@ -1143,12 +6474,11 @@ private:
         graphicsPipelineInfo.basePipelineHandle = VK_NULL_HANDLE; // If creating a pipeline derivative
         graphicsPipelineInfo.basePipelineIndex = -1; // If creating a pipeline derivative
         
-        if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &graphicsPipelineInfo, nullptr, &graphicsPipeline) != VK_SUCCESS) {
+        VkPipeline pipeline;
+        if (vkCreateGraphicsPipelines(device, pipelineCache, 1, &graphicsPipelineInfo, nullptr, &pipeline) != VK_SUCCESS) {
             throw std::runtime_error("Failed to create graphics pipeline!");
         }
-        
-        vkDestroyShaderModule(device, vertShaderModule, nullptr);
-        vkDestroyShaderModule(device, fragShaderModule, nullptr);
+        return pipeline;
     }
     VkShaderModule createShaderModule(const std::vector<char>& code) {
         // Create a shader module from a string of code
@@ -1219,6 +6549,30 @@ private:
                 throw std::runtime_error("Failed to create command pool!");
             }
         }
+        
+        // Recording threads for the CPU path's draws, with their own command pools (see recordCommandBuffer())
+        if (PARALLEL_COMMAND_RECORDING) {
+            uint32_t workerCount = std::max(2u, std::thread::hardware_concurrency()) - 1;
+            commandRecorder.init(device, queueFamilyIndices.graphicsFamily.value(), MAX_FRAMES_IN_FLIGHT, workerCount);
+            std::cout << "Command recording: up to " << commandRecorder.threadCount() << " threads (F5 toggles)" << std::endl;
+        }
+    }
+    
+    // ================ createUploadBatcher() ================
+    void createUploadBatcher() {
+        // One persistently mapped upload buffer for the lifetime of the device, instead of a staging buffer per upload
+        createBuffer(STAGING_RING_SIZE, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, MEMORY_USAGE_UPLOAD, stagingRingBuffer, stagingRingAllocation);
+        stagingRing.init(device, stagingRingBuffer, stagingRingAllocation.mapped, STAGING_RING_SIZE);
+        
+        // Copies are recorded for the transfer queue (when separate) and submitted in batches
+        QueueFamilyIndices queueFamilies = findQueueFamilies(physicalDevice);
+        if (SEPARATE_TRANSFER_QUEUE_FAMILY) {
+            uploadBatcher.init(device, &stagingRing, graphicsQueue, graphicsCommandPool, queueFamilies.graphicsFamily.value(),
+                               transferQueue, transferCommandPool, queueFamilies.transferFamily.value(), timelineSemaphoreSupported);
+        } else {
+            uploadBatcher.init(device, &stagingRing, graphicsQueue, graphicsCommandPool, queueFamilies.graphicsFamily.value(),
+                               VK_NULL_HANDLE, VK_NULL_HANDLE, 0, timelineSemaphoreSupported);
+        }
     }
     
     // ================ createColorResources() ================
@@ -1229,7 +6583,8 @@ private:
         VkFormat colorFormat = swapchainImageFormat;
         
         // Create image and image view
-        createImage(swapchainExtent.width, swapchainExtent.height, 1, msaaSamples, colorFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, colorImage, colorImageMemory);
+        // - Transient: cleared, drawn and resolved within the render pass, so it can live in lazily allocated memory
+        createImage(swapchainExtent.width, swapchainExtent.height, 1, msaaSamples, colorFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, MEMORY_USAGE_TRANSIENT, colorImage, colorImageAllocation);
         colorImageView = createImageView(colorImage, colorFormat, VK_IMAGE_ASPECT_COLOR_BIT, 1);
     }
     
@@ -1242,11 +6597,44 @@ private:
         VkFormat format = findDepthFormat();
         
         // Create image and image view
-        createImage(swapchainExtent.width, swapchainExtent.height, 1, msaaSamples, VK_FORMAT_D32_SFLOAT, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, depthImage, depthImageMemory);
+        // - Transient like the color image: cleared and discarded within the render pass
+        createImage(swapchainExtent.width, swapchainExtent.height, 1, msaaSamples, format, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT | VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, MEMORY_USAGE_TRANSIENT, depthImage, depthImageAllocation);
         depthImageView = createImageView(depthImage, format, VK_IMAGE_ASPECT_DEPTH_BIT, 1);
         
-        // Transition out of _UNDEFINED layout
-        transitionImageLayout(depthImage, format, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, 1);
+        // No transition out of _UNDEFINED layout needed: the render pass does it (initialLayout), and never reads the old contents
+        
+        // Lazily allocated memory is only committed as frames are drawn, so report once the first frame using the attachments is done
+        if (!transientAttachmentsReported) {
+            transientAttachmentsReportFrame = frameNumber + MAX_FRAMES_IN_FLIGHT;
+        }
+    }
+    void reportTransientAttachments() {
+        // Memory backing the MSAA color and depth attachments at the current resolution and sample count
+        transientAttachmentsReported = true;
+        auto megabytes = [](VkDeviceSize bytes) { return bytes / 1024.0 / 1024.0; };
+        VkDeviceSize reserved = colorImageAllocation.size + depthImageAllocation.size;
+        std::cout << "Transient attachments " << swapchainExtent.width << "x" << swapchainExtent.height << " " << msaaSamples << "x MSAA: color "
+                  << megabytes(colorImageAllocation.size) << " MB + depth " << megabytes(depthImageAllocation.size) << " MB";
+        
+        bool colorLazy = allocator.memoryTypeFlags(colorImageAllocation.memoryType) & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT;
+        bool depthLazy = allocator.memoryTypeFlags(depthImageAllocation.memoryType) & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT;
+        if (!colorLazy && !depthLazy) {
+            std::cout << ", fully allocated (no lazily allocated memory type)" << std::endl;
+            return;
+        }
+        // Each lazily allocated attachment has its own VkDeviceMemory (see DeviceMemoryAllocator), so its commitment is its own
+        auto commitment = [this](const Allocation& allocation, bool lazy) {
+            VkDeviceSize committed = allocation.size;
+            if (lazy) {
+                vkGetDeviceMemoryCommitment(device, allocation.memory, &committed);
+            }
+            return committed;
+        };
+        VkDeviceSize colorCommitted = commitment(colorImageAllocation, colorLazy);
+        VkDeviceSize depthCommitted = commitment(depthImageAllocation, depthLazy);
+        VkDeviceSize committed = colorCommitted + depthCommitted;
+        std::cout << ", committed: color " << megabytes(colorCommitted) << " MB + depth " << megabytes(depthCommitted) << " MB ("
+                  << megabytes(reserved > committed ? reserved - committed : 0) << " MB saved by lazy allocation)" << std::endl;
     }
     VkFormat findDepthFormat() {
         return findSupportedFormat(
@@ -1275,51 +6663,374 @@ private:
     
     // ================ createTextureImage() ================
     void createTextureImage() {
+        auto startTime = std::chrono::high_resolution_clock::now();
+        bool fromContainer = TEXTURE_CONTAINER_ENABLED && loadTextureContainer();
+        if (!fromContainer) {
+            loadTexturePng();
+        }
+        auto endTime = std::chrono::high_resolution_clock::now();
+        std::cout << "Loaded texture " << (fromContainer ? "(KTX2 container)" : "(PNG decode)") << " in "
+                  << std::chrono::duration<double, std::milli>(endTime - startTime).count() << " ms" << std::endl;
+        reportTextureMemory();
+        
+        if (BENCHMARK_MIP_GENERATION) {
+            benchmarkMipGeneration();
+        }
+    }
+    void reportTextureMemory() {
+        // Compare the texture's allocation with an RGBA8 image of the same size (created only to query its requirements)
+        // - Sampling footprint: bytes fetched per texel, which bounds texture bandwidth for a given number of texel fetches
+        VkMemoryRequirements memoryRequirements;
+        vkGetImageMemoryRequirements(device, textureImage, &memoryRequirements);
+        
+        const char* formatName = textureFormat == VK_FORMAT_BC1_RGB_SRGB_BLOCK ? "BC1" : textureFormat == VK_FORMAT_BC7_SRGB_BLOCK ? "BC7" : "RGBA8";
+        double bytesPerTexel = double(textureBlockBytes(textureFormat)) / (textureBlockDimension(textureFormat) * textureBlockDimension(textureFormat));
+        std::cout << "Texture memory: " << memoryRequirements.size / 1024.0 / 1024.0 << " MB " << formatName;
+        if (textureFormat != VK_FORMAT_R8G8B8A8_SRGB) {
+            VkImageCreateInfo imageInfo{};
+            imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+            imageInfo.imageType = VK_IMAGE_TYPE_2D;
+            imageInfo.extent = {textureWidth, textureHeight, 1};
+            imageInfo.mipLevels = mipLevels;
+            imageInfo.arrayLayers = 1;
+            imageInfo.format = VK_FORMAT_R8G8B8A8_SRGB;
+            imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+            imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+            imageInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+            imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+            imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+            VkImage probeImage;
+            if (vkCreateImage(device, &imageInfo, nullptr, &probeImage) == VK_SUCCESS) {
+                VkMemoryRequirements probeRequirements;
+                vkGetImageMemoryRequirements(device, probeImage, &probeRequirements);
+                vkDestroyImage(device, probeImage, nullptr);
+                std::cout << " vs " << probeRequirements.size / 1024.0 / 1024.0 << " MB RGBA8 ("
+                          << 100.0 * (1.0 - double(memoryRequirements.size) / probeRequirements.size) << "% saved)";
+            }
+        }
+        std::cout << ", sampling footprint " << bytesPerTexel << " bytes/texel (RGBA8: 4)" << std::endl;
+    }
+    void benchmarkMipGeneration() {
+        // MipGenerator throughput (source MPixels/s for the whole chain) on synthetic 1024x1024 and 4096x4096 images
+        for (uint32_t size : {1024u, 4096u}) {
+            std::vector<uint8_t> pixels(size_t(size) * size * 4);
+            for (size_t i = 0; i < pixels.size(); i++) {
+                pixels[i] = static_cast<uint8_t>((i * 2654435761u) >> 13); // Noise, so nothing is trivially uniform
+            }
+            for (MipGenerator::Filter filter : {MipGenerator::Box, MipGenerator::Kaiser}) {
+                MipGenerator generator(filter);
+                std::vector<TextureLevel> levels;
+                generator.generate(pixels.data(), size, size, levels); // Warm up tables and allocations
+                
+                const int iterations = size <= 1024 ? 10 : 2;
+                auto start = std::chrono::high_resolution_clock::now();
+                for (int i = 0; i < iterations; i++) {
+                    generator.generate(pixels.data(), size, size, levels);
+                }
+                double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count() / iterations;
+                std::cout << "Mip generation " << size << "x" << size << " " << (filter == MipGenerator::Kaiser ? "Kaiser" : "box")
+                          << " (" << MipGenerator::instructionSet() << ", " << std::max(1u, std::thread::hardware_concurrency()) << " threads): "
+                          << seconds * 1000.0 << " ms, " << double(size) * size / 1e6 / seconds << " MPixels/s" << std::endl;
+            }
+        }
+    }
+    bool loadTextureContainer() {
+        // Upload every mip level from the KTX2 container with a single copy, rebaking it first if the PNG has changed
+        // - Block-compressed (BC1/BC7) container when the device supports it, RGBA8 otherwise
+        
+        bool compress = COMPRESS_TEXTURES && blockCompressionSupported;
+        const std::string& containerPath = compress ? TEXTURE_CONTAINER_BC_PATH : TEXTURE_CONTAINER_PATH;
+        TextureEncoding encoding = compress ? TextureEncoding::BlockCompressed : TextureEncoding::Rgba8;
+        
+        // A BlockCompressed bake picks BC1 or BC7 per texture, so either is accepted (BC1 only while opaque textures use it)
+        auto acceptedFormat = [compress](VkFormat format) {
+            if (!compress)
+                return format == VK_FORMAT_R8G8B8A8_SRGB;
+            return format == VK_FORMAT_BC7_SRGB_BLOCK || (format == VK_FORMAT_BC1_RGB_SRGB_BLOCK && !BC7_OPAQUE_TEXTURES);
+        };
+        
+        MappedFile source;
+        source.open(SOURCE_PATH + TEXTURE_PATH);
+        MappedFile file;
+        TextureContainer container;
+        bool valid = file.open(SOURCE_PATH + containerPath) && container.parse(file)
+                     && (!source.data || (acceptedFormat(container.format) && container.sourceHash == textureBakeHash(source.data, source.size, container.format)));
+        if (!valid) {
+            if (!source.data || !bakeTexture(SOURCE_PATH + TEXTURE_PATH, SOURCE_PATH + containerPath, encoding))
+                return false;
+            std::cout << "Baked " << containerPath << " from " << TEXTURE_PATH << std::endl;
+            if (!file.open(SOURCE_PATH + containerPath) || !container.parse(file))
+                return false;
+        }
+        if (container.format != VK_FORMAT_R8G8B8A8_SRGB && !blockCompressionSupported)
+            return false; // e.g. a block-compressed container copied from another machine
+        
+        if (STREAM_TEXTURES && std::max(container.width, container.height) > STREAMING_INITIAL_SIZE && textureStream.file.open(SOURCE_PATH + containerPath)) {
+            startTextureStreaming(container);
+            return true;
+        }
+        
+        // Levels are stored smallest first, so [smallest level offset, level 0 end) covers all image data
+        uint64_t dataBegin = container.levels.back().byteOffset;
+        uint64_t dataEnd = container.levels[0].byteOffset + container.levels[0].byteLength;
+        std::vector<VkDeviceSize> levelOffsets;
+        for (const Ktx2LevelIndex& level : container.levels) {
+            levelOffsets.push_back(level.byteOffset - dataBegin);
+        }
+        uploadTextureLevels(container.format, container.width, container.height, file.data + dataBegin, dataEnd - dataBegin, levelOffsets);
+        return true;
+    }
+    void uploadTextureLevels(VkFormat format, uint32_t width, uint32_t height, const uint8_t* levelData, VkDeviceSize size, const std::vector<VkDeviceSize>& levelOffsets) {
+        // Create the texture image and upload all of its (already generated) mip levels with a single copy
+        mipLevels = static_cast<uint32_t>(levelOffsets.size());
+        textureWidth = width;
+        textureHeight = height;
+        textureFormat = format;
+        
+        // No TRANSFER_SRC usage; mips aren't blitted
+        createImage(width, height, mipLevels, VK_SAMPLE_COUNT_1_BIT, format, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, MEMORY_USAGE_GPU_ONLY, textureImage, textureImageAllocation);
+        transitionImageLayout(textureImage, format, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, mipLevels);
+        
+        // Stage and copy level by level, so a full staging ring only flushes the batch between levels
+        for (uint32_t level = 0; level < mipLevels; level++) {
+            VkDeviceSize levelSize = (level + 1 < mipLevels ? levelOffsets[level + 1] : size) - levelOffsets[level];
+            StagingRing::Region stagingRegion = uploadBatcher.stage(levelSize, 16);
+            memcpy(stagingRegion.data, levelData + levelOffsets[level], static_cast<size_t>(levelSize));
+            copyBufferToImage(stagingRing.buffer(), textureImage, {textureLevelRegion(level, stagingRegion.offset)});
+        }
+        
+        transitionImageLayout(textureImage, format, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, mipLevels);
+    }
+    VkBufferImageCopy textureLevelRegion(uint32_t level, VkDeviceSize bufferOffset) {
+        // Copy of a whole texture mip level from tightly packed buffer data
+        VkBufferImageCopy region{};
+        region.bufferOffset = bufferOffset;
+        region.bufferRowLength = 0;
+        region.bufferImageHeight = 0;
+        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.imageSubresource.mipLevel = level;
+        region.imageSubresource.baseArrayLayer = 0;
+        region.imageSubresource.layerCount = 1;
+        region.imageOffset = {0, 0, 0};
+        region.imageExtent = {std::max(1u, textureWidth >> level), std::max(1u, textureHeight >> level), 1};
+        return region;
+    }
+    void startTextureStreaming(const TextureContainer& container) {
+        // Upload the coarse mips (up to STREAMING_INITIAL_SIZE) now, and leave the finer ones to a worker thread and updateTextureStreaming()
+        // - The image view only covers resident levels (sampler minLod alone would leave levels in TRANSFER_DST layout inside the view)
+        TextureStream& stream = textureStream;
+        stream.startTime = std::chrono::high_resolution_clock::now();
+        stream.levels = container.levels;
+        
+        mipLevels = static_cast<uint32_t>(container.levels.size());
+        textureWidth = container.width;
+        textureHeight = container.height;
+        textureFormat = container.format;
+        uint32_t initialLevel = 0;
+        while (initialLevel + 1 < mipLevels && std::max(textureWidth >> initialLevel, textureHeight >> initialLevel) > STREAMING_INITIAL_SIZE) {
+            initialLevel++;
+        }
+        
+        createImage(textureWidth, textureHeight, mipLevels, VK_SAMPLE_COUNT_1_BIT, textureFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, MEMORY_USAGE_GPU_ONLY, textureImage, textureImageAllocation);
+        transitionImageLayout(textureImage, textureFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, mipLevels);
+        
+        // Initial levels: stored smallest first, so [smallest level offset, initial level end) is contiguous
+        uint64_t dataBegin = container.levels.back().byteOffset;
+        uint64_t dataEnd = container.levels[initialLevel].byteOffset + container.levels[initialLevel].byteLength;
+        StagingRing::Region stagingRegion = uploadBatcher.stage(dataEnd - dataBegin, 16);
+        memcpy(stagingRegion.data, stream.file.data + dataBegin, static_cast<size_t>(dataEnd - dataBegin));
+        
+        std::vector<VkBufferImageCopy> regions;
+        for (uint32_t level = initialLevel; level < mipLevels; level++) {
+            regions.push_back(textureLevelRegion(level, stagingRegion.offset + container.levels[level].byteOffset - dataBegin));
+        }
+        copyBufferToImage(stagingRing.buffer(), textureImage, regions);
+        transitionImageLayout(textureImage, textureFormat, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, mipLevels - initialLevel, initialLevel);
+        residentMipLevel = initialLevel;
+        
+        // Streamed levels: staged through the ring one level at a time (see updateTextureStreaming())
+        for (uint32_t level = 0; level < initialLevel; level++) {
+            if (container.levels[level].byteLength > STAGING_RING_SIZE) {
+                throw std::runtime_error("Texture level is larger than STAGING_RING_SIZE!");
+            }
+        }
+        stream.stagingRegions.assign(initialLevel, {});
+        stream.requestedLevel = initialLevel;
+        stream.preparedLevel = initialLevel;
+        stream.submittedLevel = initialLevel;
+        stream.cancelled = false;
+        stream.worker = std::thread([&stream, initialLevel] {
+            for (uint32_t level = initialLevel; level-- > 0; ) {
+                // Wait for the main thread to assign the level's staging space
+                for (uint32_t requested = stream.requestedLevel.load(std::memory_order_acquire); requested > level && !stream.cancelled;
+                     requested = stream.requestedLevel.load(std::memory_order_acquire)) {
+                    stream.requestedLevel.wait(requested, std::memory_order_acquire);
+                }
+                if (stream.cancelled)
+                    return;
+                const Ktx2LevelIndex& index = stream.levels[level];
+                memcpy(stream.stagingRegions[level].data, stream.file.data + index.byteOffset, static_cast<size_t>(index.byteLength));
+                stream.preparedLevel.store(level, std::memory_order_release);
+            }
+        });
+        textureStreaming = true;
+    }
+    void updateTextureStreaming() {
+        // Called by drawFrame() after waiting for the current frame's fence
+        // 1. Reclaim staging space from completed uploads, and hand the worker space for further levels while the ring has room
+        // 2. Submit an upload batch for the levels the worker has prepared since the last call
+        // 3. Retire finished uploads: move the view's base level down (the acquire on the graphics queue precedes the next frame)
+        // 4. Point this frame's descriptor set at the current view (its previous use has completed)
+        TextureStream& stream = textureStream;
+        stagingRing.reclaim();
+        if (textureStreaming) {
+            for (uint32_t level = stream.requestedLevel.load(); level > 0; level--) {
+                if (!stagingRing.tryAllocate(stream.levels[level - 1].byteLength, 16, stream.stagingRegions[level - 1]))
+                    break;
+                stream.requestedLevel.store(level - 1, std::memory_order_release);
+                stream.requestedLevel.notify_one();
+            }
+            
+            uint32_t preparedLevel = stream.preparedLevel.load(std::memory_order_acquire);
+            if (preparedLevel < stream.submittedLevel) {
+                std::vector<VkBufferImageCopy> regions;
+                std::vector<StagingRing::Region> stagingRegions;
+                for (uint32_t level = preparedLevel; level < stream.submittedLevel; level++) {
+                    regions.push_back(textureLevelRegion(level, stream.stagingRegions[level].offset));
+                    stagingRegions.push_back(stream.stagingRegions[level]);
+                }
+                uploadBatcher.readsStagingRegions(stagingRegions);
+                copyBufferToImage(stagingRing.buffer(), textureImage, regions);
+                uploadBatcher.releaseImage(textureImage, {VK_IMAGE_ASPECT_COLOR_BIT, preparedLevel, stream.submittedLevel - preparedLevel, 0, 1},
+                                           VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                                           VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+                
+                TextureStream::Upload upload{preparedLevel, uploadBatcher.flush()};
+                stream.uploads.push_back(upload);
+                stream.submittedLevel = preparedLevel;
+            }
+            
+            uint32_t residentLevel = residentMipLevel;
+            while (!stream.uploads.empty() && uploadBatcher.isComplete(stream.uploads.front().uploadValue)) {
+                residentLevel = stream.uploads.front().baseLevel;
+                stream.uploads.pop_front();
+            }
+            if (residentLevel != residentMipLevel) {
+                residentMipLevel = residentLevel;
+                VkImageView retiredView = textureImageView;
+                deferDestroy([this, retiredView] { vkDestroyImageView(device, retiredView, nullptr); });
+                createTextureImageView();
+                textureDescriptorsDirty = (1u << MAX_FRAMES_IN_FLIGHT) - 1;
+            }
+            
+            if (residentMipLevel == 0) {
+                stopTextureStreaming();
+                std::cout << "Texture streaming finished "
+                          << std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - stream.startTime).count()
+                          << " ms after it started (" << mipLevels << " levels resident)" << std::endl;
+            }
+        }
+        
+        if (textureDescriptorsDirty & (1u << currentFrame)) {
+            updateTextureDescriptor(currentFrame);
+            textureDescriptorsDirty &= ~(1u << currentFrame);
+        }
+    }
+    void stopTextureStreaming() {
+        // Join the worker and release the streaming resources; with uploads still pending, waits for the device first
+        if (!textureStreaming)
+            return;
+        TextureStream& stream = textureStream;
+        uint32_t requestedLevel = stream.requestedLevel;
+        stream.cancel();
+        if (!stream.uploads.empty()) {
+            vkDeviceWaitIdle(device);
+        }
+        for (uint32_t level = requestedLevel; level < stream.submittedLevel; level++) {
+            stagingRing.discard(stream.stagingRegions[level]); // Staged (or being staged) but never submitted
+        }
+        stream.uploads.clear();
+        stagingRing.reclaim();
+        stream.file.close();
+        textureStreaming = false;
+    }
+    void deferDestroy(std::function<void()> destroy) {
+        // Destroy a resource once every frame in flight that may still use it has completed (run by drawFrame(), or by cleanup())
+        deferredDestroys.emplace_back(frameNumber + MAX_FRAMES_IN_FLIGHT, std::move(destroy));
+    }
+    void runDeferredDestroys(uint64_t completedFrame) {
+        // Run the destroys due by completedFrame (UINT64_MAX: all of them, once the device is idle)
+        auto due = std::partition(deferredDestroys.begin(), deferredDestroys.end(), [completedFrame](const auto& deferredDestroy) { return deferredDestroy.first > completedFrame; });
+        for (auto it = due; it != deferredDestroys.end(); ++it) {
+            it->second();
+        }
+        deferredDestroys.erase(due, deferredDestroys.end());
+    }
+    void loadTexturePng() {
+        // Fallback: decode the PNG and generate mips on the GPU (or on the CPU when the format can't be blitted)
+        
         // Load image data from file
         int texWidth, texHeight, texChannels;
-        stbi_uc* pixels = stbi_load((SOURCE_PATH + "textures/viking_room.png").c_str(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
+        stbi_uc* pixels = stbi_load((SOURCE_PATH + TEXTURE_PATH).c_str(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
         VkDeviceSize imageSize = texWidth * texHeight * 4;
         
         if (!pixels) {
             throw std::runtime_error("Failed to load texture image!");
         }
         
+        // Blitting mips needs blit source/destination support and linear filtering for the optimal-tiling format
+        VkFormatProperties formatProperties;
+        vkGetPhysicalDeviceFormatProperties(physicalDevice, VK_FORMAT_R8G8B8A8_SRGB, &formatProperties);
+        VkFormatFeatureFlags blitFeatures = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+        if (CPU_MIPMAPS || (formatProperties.optimalTilingFeatures & blitFeatures) != blitFeatures) {
+            std::vector<TextureLevel> levels;
+            MipGenerator(KAISER_MIP_FILTER ? MipGenerator::Kaiser : MipGenerator::Box).generate(pixels, static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight), levels);
+            stbi_image_free(pixels);
+            
+            // Pack levels back to back (RGBA8 levels are always 4-byte aligned)
+            std::vector<VkDeviceSize> levelOffsets;
+            std::vector<uint8_t> levelData;
+            for (const TextureLevel& level : levels) {
+                levelOffsets.push_back(levelData.size());
+                levelData.insert(levelData.end(), level.data.begin(), level.data.end());
+            }
+            uploadTextureLevels(VK_FORMAT_R8G8B8A8_SRGB, static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight), levelData.data(), levelData.size(), levelOffsets);
+            return;
+        }
+        
         // Determine number of levels in mip chain
         mipLevels = std::floor(std::log2(std::max(texWidth, texHeight))) + 1;
+        textureWidth = static_cast<uint32_t>(texWidth);
+        textureHeight = static_cast<uint32_t>(texHeight);
+        textureFormat = VK_FORMAT_R8G8B8A8_SRGB;
         
-        // Copy image data into staging buffer
-        VkBuffer stagingBuffer;
-        VkDeviceMemory stagingBufferMemory;
-        createBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+        // Copy image data into the staging ring
+        StagingRing::Region stagingRegion = uploadBatcher.stage(imageSize, 16);
         
-        void* data;
-        vkMapMemory(device, stagingBufferMemory, 0, imageSize, 0, &data);
-        memcpy(data, pixels, static_cast<size_t>(imageSize));
-        vkUnmapMemory(device, stagingBufferMemory);
+        memcpy(stagingRegion.data, pixels, static_cast<size_t>(imageSize));
         
         stbi_image_free(pixels);
         
         // Create texture image
-        createImage(static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight), mipLevels, VK_SAMPLE_COUNT_1_BIT, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_HEAP_DEVICE_LOCAL_BIT, textureImage, textureImageMemory);
+        createImage(static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight), mipLevels, VK_SAMPLE_COUNT_1_BIT, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, MEMORY_USAGE_GPU_ONLY, textureImage, textureImageAllocation);
         // _transfer_src: for mipmap blitting
         // _transfer_dst: for copy from buffer
         // _sampled for imageview to be used as descriptor in shader
         
         // Transition image layout from initial value _UNDEFINED to _TRANSFER_DST_OPTIMAL
         transitionImageLayout(textureImage, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, mipLevels);
-        // Copy staging buffer to texture image
-        copyBufferToImage(stagingBuffer, textureImage, static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight));
+        // Copy staging region to texture image (mip level 0)
+        copyBufferToImage(stagingRing.buffer(), textureImage, {textureLevelRegion(0, stagingRegion.offset)});
         // Transition image layout now for shader access (this is done in generateMipmaps() now)
 //        transitionImageLayout(textureImage, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, mipLevels);
+        // Hand every level to the graphics queue, where the blits run (still in TRANSFER_DST_OPTIMAL)
+        uploadBatcher.releaseImage(textureImage, {VK_IMAGE_ASPECT_COLOR_BIT, 0, mipLevels, 0, 1}, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                                   VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT);
         
         // Generate mip maps and transition imgae layout for shader access
         generateMipmaps(textureImage, VK_FORMAT_R8G8B8A8_SRGB, texWidth, texHeight, mipLevels);
-        
-        // Clean up
-        vkDestroyBuffer(device, stagingBuffer, nullptr);
-        vkFreeMemory(device, stagingBufferMemory, nullptr);
     }
-    void createImage(uint32_t width, uint32_t height, uint32_t mipLevels, VkSampleCountFlagBits numSamples, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory ) {
+    void createImage(uint32_t width, uint32_t height, uint32_t mipLevels, VkSampleCountFlagBits numSamples, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, const MemoryUsage& memoryUsage, VkImage& image, Allocation& imageAllocation) {
         // Create image, allocate memory, and bind memory to image
         
         // Create image
@@ -1335,17 +7046,7 @@ private:
         imageInfo.tiling = tiling; // How texels are laid out
         imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED; // Whether texels are discarded or preserved on the first transition; can only be _UNDEFINED or _PREINITIALIZED; need to separately "transition" the image to other layouts (e.g., VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL)
         imageInfo.usage = usage; // Will copy buffer into this image, and will sample it from fragment shader
-        if (SEPARATE_TRANSFER_QUEUE_FAMILY) {
-            imageInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
-            QueueFamilyIndices queueFamilies = findQueueFamilies(physicalDevice);
-            std::array<uint32_t, 2> queueFamilyIndices = {queueFamilies.graphicsFamily.value(), queueFamilies.transferFamily.value()};
-
-            imageInfo.sharingMode = VK_SHARING_MODE_CONCURRENT; // If graphics and transfer families are separate
-            imageInfo.queueFamilyIndexCount = static_cast<uint32_t>(queueFamilyIndices.size());
-            imageInfo.pQueueFamilyIndices = queueFamilyIndices.data();
-        }
-        else
-            imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE; // Only will be used by one queue family (graphics+transfer)
+        imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE; // Owned by one queue family at a time; uploads transfer ownership to graphics (see UploadBatcher)
         imageInfo.samples = numSamples; // For multi-sampling; only for attachments
         imageInfo.flags = 0;
         
@@ -1357,69 +7058,16 @@ private:
         VkMemoryRequirements memoryRequirements;
         vkGetImageMemoryRequirements(device, image, &memoryRequirements);
         
-        VkMemoryAllocateInfo allocateInfo{};
-        allocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-        allocateInfo.allocationSize = memoryRequirements.size;
-        allocateInfo.memoryTypeIndex = findMemoryType(memoryRequirements.memoryTypeBits, properties); // Review this
-        
-        if (vkAllocateMemory(device, &allocateInfo, nullptr, &imageMemory) != VK_SUCCESS) {
-            throw std::runtime_error("Failed to allocate image memory!");
-        }
+        DeviceMemoryAllocator::ResourceKind kind = tiling == VK_IMAGE_TILING_OPTIMAL ? DeviceMemoryAllocator::Optimal : DeviceMemoryAllocator::Linear;
+        imageAllocation = allocator.allocate(memoryRequirements, memoryUsage, kind);
         
         // Bind allocated memory to the image
-        vkBindImageMemory(device, image, imageMemory, 0);
-    }
-    VkCommandBuffer beginSingleTimeCommands() {
-        // Allocate command buffer
-        VkCommandBufferAllocateInfo allocateInfo{};
-        allocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-        allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-        if (SEPARATE_TRANSFER_QUEUE_FAMILY) {
-            allocateInfo.commandPool = transferCommandPool;
-        } else {
-            allocateInfo.commandPool = graphicsCommandPool;
-        }
-        allocateInfo.commandBufferCount = 1;
-        
-        VkCommandBuffer commandBuffer;
-        vkAllocateCommandBuffers(device, &allocateInfo, &commandBuffer);
-        
-        // Begin recording command buffer
-        VkCommandBufferBeginInfo beginInfo{};
-        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-        
-        vkBeginCommandBuffer(commandBuffer, &beginInfo);
-        
-        return commandBuffer;
-    }
-    void endSingleTimeCommands(VkCommandBuffer commandBuffer) {
-        // End recording command buffer
-        vkEndCommandBuffer(commandBuffer);
-        
-        // Submit command buffer to appropriate queue, then free it
-        VkSubmitInfo submitInfo{};
-        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-        submitInfo.commandBufferCount = 1;
-        submitInfo.pCommandBuffers = &commandBuffer;
-        
-        if (SEPARATE_TRANSFER_QUEUE_FAMILY) {
-            vkQueueSubmit(transferQueue, 1, &submitInfo, VK_NULL_HANDLE);
-            vkQueueWaitIdle(transferQueue); // Could also use vkWaitForFences
-            vkFreeCommandBuffers(device, transferCommandPool, 1, &commandBuffer);
-        } else {
-            vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
-            vkQueueWaitIdle(graphicsQueue); // Could also use vkWaitForFences
-            vkFreeCommandBuffers(device, graphicsCommandPool, 1, &commandBuffer);
-        }
+        vkBindImageMemory(device, image, imageAllocation.memory, imageAllocation.offset);
     }
-    void transitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t mipLevels) {
-        // Execute the transition using a command buffer, with an image memory barrier as a pipeline barrier
+    void transitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t mipLevels, uint32_t baseMipLevel = 0) {
+        // Record the transition into the upload batch, as an image memory barrier in a pipeline barrier
+        // - Transfer destinations are prepared on the transfer queue; shader reads are released from it to the graphics queue
         
-        // 1. Allocate and begin
-        VkCommandBuffer commandBuffer = beginSingleTimeCommands();
-        
-        // 2. Record
         // Define a pipeline barrier (memory dependency) for the image
         VkImageMemoryBarrier barrier{}; // A pipeline barrier; generally used for synchronization (finish write before read), but can be used to transition image layouts and transfer queue family ownership. VkBufferMemoryBarrier also exists for buffers.
         barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
@@ -1436,7 +7084,7 @@ private:
         } else {
             barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
         }
-        barrier.subresourceRange.baseMipLevel = 0;
+        barrier.subresourceRange.baseMipLevel = baseMipLevel;
         barrier.subresourceRange.levelCount = mipLevels;
         barrier.subresourceRange.baseArrayLayer = 0;
         barrier.subresourceRange.layerCount = 1;
@@ -1451,47 +7099,23 @@ private:
             barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
             sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT; // Earliest possible pipeline stage
             destinationStage = VK_PIPELINE_STAGE_TRANSFER_BIT; // Not an actual stage; a pseudo-stage where transfers happen
+            vkCmdPipelineBarrier(uploadBatcher.transferCommands(), sourceStage, destinationStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
         } else if (oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL && newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) {
-            barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-            barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-            sourceStage = VK_PIPELINE_STAGE_TRANSFER_BIT; // Not an actual stage; a pseudo-stage where transfers happen
-            destinationStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+            // Also transfers ownership to the graphics family
+            uploadBatcher.releaseImage(image, barrier.subresourceRange, oldLayout, newLayout, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
         } else if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL) {
             barrier.srcAccessMask = 0;
             barrier.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
             sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
             destinationStage = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+            vkCmdPipelineBarrier(uploadBatcher.graphicsCommands(), sourceStage, destinationStage, 0, 0, nullptr, 0, nullptr, 1, &barrier); // Specify pipeline stages which occur before the barrier, and stages which wait on the barrier
         } else {
             throw std::invalid_argument("Unsupported layout transition!");
         }
-        
-        vkCmdPipelineBarrier(commandBuffer, sourceStage, destinationStage, 0, 0, nullptr, 0, nullptr, 1, &barrier); // Specify pipeline stages which occur before the barrier, and stages which wait on the barrier
-        
-        // 3. End, submit, and free
-        endSingleTimeCommands(commandBuffer);
     }
-    void copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height) {
-        // Execute the copy using a command buffer
-        
-        // 1. Allocate and begin
-        VkCommandBuffer commandBuffer = beginSingleTimeCommands();
-        
-        // 2. Record
-        // Copy buffer region to image region
-        VkBufferImageCopy region{};
-        region.bufferOffset = 0;
-        region.bufferRowLength = 0; // 0 indicates tightly packed; nonzero if there are padding bytes between rows of the image
-        region.bufferImageHeight = 0;
-        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        region.imageSubresource.mipLevel = 0;
-        region.imageSubresource.baseArrayLayer = 0;
-        region.imageSubresource.layerCount = 1;
-        region.imageOffset = {0, 0, 0};
-        region.imageExtent = {width, height, 1};
-        vkCmdCopyBufferToImage(commandBuffer, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region); // Assumes image has already been transitioned to the specified layout
-        
-        // 3. End, submit, and free
-        endSingleTimeCommands(commandBuffer);
+    void copyBufferToImage(VkBuffer buffer, VkImage image, const std::vector<VkBufferImageCopy>& regions) {
+        // Record the copy into the upload batch
+        vkCmdCopyBufferToImage(uploadBatcher.transferCommands(), buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(regions.size()), regions.data()); // Assumes image has already been transitioned to the specified layout
     }
     void generateMipmaps(VkImage image, VkFormat imageFormat, int32_t texWidth, int32_t texHeight, uint32_t mipLevels) {
         // Check physical device support for linear filtering
@@ -1505,8 +7129,8 @@ private:
             // Or, can use stb_image_resize
         }
         
-        // Begin recording command buffer
-        VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+        // Record into the batch's graphics command buffer: blits need a graphics queue
+        VkCommandBuffer commandBuffer = uploadBatcher.graphicsCommands();
         
         // Set common image memory barrier properties
         // - Queue family index stays the same (ignored)
@@ -1578,15 +7202,13 @@ private:
         
         // Create pipeline barrier for layout transition
         vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
-        
-        endSingleTimeCommands(commandBuffer);
     }
     
     // ================ createTextureImageView() ================
     void createTextureImageView() {
-        textureImageView = createImageView(textureImage, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_ASPECT_COLOR_BIT, 1);
+        textureImageView = createImageView(textureImage, textureFormat, VK_IMAGE_ASPECT_COLOR_BIT, mipLevels - residentMipLevel, residentMipLevel);
     }
-    VkImageView createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t mipLevels) {
+    VkImageView createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t mipLevels, uint32_t baseMipLevel = 0) {
         // Create an image view for the given image
         // - Image view specifies view type, format, aspect mask, mip levels, layers
         
@@ -1600,7 +7222,7 @@ private:
 //        createInfo.components.b = VK_COMPONENT_SWIZZLE_B; // Unneeded because VK_COMPONENT_SWIZZLE_IDENTITY = 0
 //        createInfo.components.a = VK_COMPONENT_SWIZZLE_A; // Unneeded because VK_COMPONENT_SWIZZLE_IDENTITY = 0
         viewInfo.subresourceRange.aspectMask = aspectFlags;
-        viewInfo.subresourceRange.baseMipLevel = 0;
+        viewInfo.subresourceRange.baseMipLevel = baseMipLevel;
         viewInfo.subresourceRange.levelCount = mipLevels;
         viewInfo.subresourceRange.baseArrayLayer = 0;
         viewInfo.subresourceRange.layerCount = 1;
@@ -1649,17 +7271,69 @@ private:
     
     // ================ loadModel() ================
     void loadModel() {
-        // Use tinyobjloader to load vertices and indices
+        // Load vertices and indices, from the binary mesh cache if it matches the OBJ, otherwise by parsing the OBJ
+        
+        auto startTime = std::chrono::high_resolution_clock::now();
+        
+        // Hash the OBJ contents so that the cache is rebuilt automatically whenever the model changes
+        MappedFile objFile;
+        if (!objFile.open(SOURCE_PATH + MODEL_PATH)) {
+            throw std::runtime_error("Failed to open model file!");
+        }
+        uint64_t sourceHash = hashBytes(objFile.data, objFile.size);
+        
+        bool warm = MESH_CACHE_ENABLED && loadMeshCache(SOURCE_PATH + MESH_CACHE_PATH, sourceHash, objFile.size);
+        if (!warm) {
+            parseObj(objFile);
+            optimizeMesh(); // Before the cache is written, so warm loads get the optimized buffers as-is
+            if (MESH_CACHE_ENABLED)
+                writeMeshCache(SOURCE_PATH + MESH_CACHE_PATH, sourceHash, objFile.size);
+        }
+        
+        // Object-space bounds, for frustum culling
+        meshBounds = vertices.empty() ? Aabb{} : Aabb{vertices[0].pos, vertices[0].pos};
+        for (const Vertex& vertex : vertices) {
+            meshBounds.min = glm::min(meshBounds.min, vertex.pos);
+            meshBounds.max = glm::max(meshBounds.max, vertex.pos);
+        }
+        
+        auto endTime = std::chrono::high_resolution_clock::now();
+        std::cout << "Loaded model " << (warm ? "(warm, mesh cache)" : "(cold, OBJ parse)") << " in "
+                  << std::chrono::duration<double, std::milli>(endTime - startTime).count() << " ms: "
+                  << vertices.size() << " vertices, " << indices.size() << " indices" << std::endl;
+    }
+    void parseObj(const MappedFile& objFile) {
+        // Use ParallelObjParser (or tinyobjloader) to load vertices and indices
         
         tinyobj::attrib_t attrib;
         std::vector<tinyobj::shape_t> shapes;
         std::vector<tinyobj::material_t> materials;
         std::string warn, err;
         
-        if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, (SOURCE_PATH + "models/viking_room.obj").c_str())) {
+        auto startTime = std::chrono::high_resolution_clock::now();
+        std::string unsupported;
+        bool parsed = PARALLEL_OBJ_PARSER && ParallelObjParser().parse(objFile, attrib, shapes, materials, warn, unsupported);
+        if (PARALLEL_OBJ_PARSER && !parsed) {
+            std::cout << "Parallel OBJ parser does not support " << unsupported << ", falling back to tinyobj" << std::endl;
+        }
+        if (!parsed && !tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, (SOURCE_PATH + MODEL_PATH).c_str())) {
             throw std::runtime_error(warn + err);
         }
+        double parseSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count();
+        std::cout << "Parsed OBJ (" << (parsed ? "parallel" : "tinyobj") << ") at "
+                  << objFile.size / (1024.0 * 1024.0) / std::max(parseSeconds, 1e-9) << " MB/s" << std::endl;
+        
+        if (parsed && VERIFY_PARALLEL_OBJ) {
+            verifyParallelObj(attrib, shapes);
+        }
         
+        // Expand every face corner into a full vertex, then weld duplicates into the index buffer
+        size_t cornerCount = 0;
+        for (const auto& shape : shapes) {
+            cornerCount += shape.mesh.indices.size();
+        }
+        std::vector<Vertex> corners;
+        corners.reserve(cornerCount);
         for (const auto& shape : shapes) {
             for (const auto& index : shape.mesh.indices) {
                 Vertex vertex{};
@@ -1673,142 +7347,530 @@ private:
                     1.0 - attrib.texcoords[2 * index.texcoord_index + 1] // flip v
                 };
                 vertex.color = {1.0f, 1.0f, 1.0f};
-                
-                if (!uniqueVertices.contains(vertex)) {
-                    // Index of new vertex is just the current size of the vertices vector
-                    uniqueVertices[vertex] = static_cast<uint32_t>(vertices.size());
-                    vertices.push_back(vertex);
-                }
-                
-                indices.push_back(uniqueVertices[vertex]);
+                corners.push_back(vertex);
             }
         }
-    }
-    
-    // ================ createVertexBuffer() ================
-    void createVertexBuffer() {
-        VkDeviceSize bufferSize = sizeof(vertices[0]) * vertices.size();
         
-        // Create/allocate the staging buffer - on CPU
-        VkBuffer stagingBuffer;
-        VkDeviceMemory stagingBufferMemory;
-        createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+        VertexWelder welder;
+        welder.weld(corners, vertices, indices);
         
-        // Fill the staging buffer
-        // - Can also fill the vertex buffer directly if HOST_COHERENT_BIT and HOST_VISIBLE_BIT were set on it. The HOST_COHERENT_BIT ensures allocated memory in memory heap matches the mapped memory (i.e., there are no delays due to caching). Can use VkFlushMappedMemoryRanges and VkInvalidateMappedMemoryRanges to control transfer to GPU. Otherwise, transfer to GPU occurs in the background and specification guarantees that this is completed as of the next VkQueueSubmit call.
-        void* data;
-        vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);  // Temporarily map bufferMemory to data ptr. Can also use VK_WHOLE_SIZE?
-        memcpy(data, vertices.data(), static_cast<size_t>(bufferSize));
-        vkUnmapMemory(device, stagingBufferMemory);
+        if (BENCHMARK_VERTEX_WELDING) {
+            benchmarkVertexWelding(corners);
+        }
+    }
+    void verifyParallelObj(const tinyobj::attrib_t& attrib, const std::vector<tinyobj::shape_t>& shapes) {
+        // Compare ParallelObjParser output against tinyobj::LoadObj, bit for bit
+        tinyobj::attrib_t referenceAttrib;
+        std::vector<tinyobj::shape_t> referenceShapes;
+        std::vector<tinyobj::material_t> referenceMaterials;
+        std::string warn, err;
+        if (!tinyobj::LoadObj(&referenceAttrib, &referenceShapes, &referenceMaterials, &warn, &err, (SOURCE_PATH + MODEL_PATH).c_str())) {
+            throw std::runtime_error(warn + err);
+        }
         
-        // Create/allocate vertex buffer - local to GPU
-        // - Can't map, but can transfer (copy) data into it
-        createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, vertexBuffer, vertexBufferMemory);
+        auto sameReals = [](const std::vector<tinyobj::real_t>& a, const std::vector<tinyobj::real_t>& b) {
+            return a.size() == b.size() && (a.empty() || memcmp(a.data(), b.data(), a.size() * sizeof(tinyobj::real_t)) == 0);
+        };
+        bool identical = sameReals(attrib.vertices, referenceAttrib.vertices) && sameReals(attrib.vertex_weights, referenceAttrib.vertex_weights) &&
+                         sameReals(attrib.normals, referenceAttrib.normals) && sameReals(attrib.texcoords, referenceAttrib.texcoords) &&
+                         sameReals(attrib.colors, referenceAttrib.colors) && shapes.size() == referenceShapes.size();
+        for (size_t s = 0; identical && s < shapes.size(); s++) {
+            const tinyobj::mesh_t& mesh = shapes[s].mesh;
+            const tinyobj::mesh_t& referenceMesh = referenceShapes[s].mesh;
+            identical = shapes[s].name == referenceShapes[s].name && mesh.indices.size() == referenceMesh.indices.size() &&
+                        mesh.num_face_vertices == referenceMesh.num_face_vertices && mesh.material_ids == referenceMesh.material_ids &&
+                        mesh.smoothing_group_ids == referenceMesh.smoothing_group_ids;
+            for (size_t i = 0; identical && i < mesh.indices.size(); i++) {
+                identical = mesh.indices[i].vertex_index == referenceMesh.indices[i].vertex_index &&
+                            mesh.indices[i].normal_index == referenceMesh.indices[i].normal_index &&
+                            mesh.indices[i].texcoord_index == referenceMesh.indices[i].texcoord_index;
+            }
+        }
+        if (!identical) {
+            throw std::runtime_error("Parallel OBJ parser output differs from tinyobj::LoadObj!");
+        }
+        std::cout << "Parallel OBJ parser output matches tinyobj::LoadObj" << std::endl;
+    }
+    void benchmarkVertexWelding(const std::vector<Vertex>& modelCorners) {
+        // Time the old std::unordered_map dedup against VertexWelder (serial and parallel) on the model and on a large synthetic grid
+        
+        auto timeMs = [](auto&& func) {
+            auto start = std::chrono::high_resolution_clock::now();
+            func();
+            return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        };
         
-        // Copy from staging buffer (CPU) to vertex buffer (GPU)
-        copyBuffer(stagingBuffer, vertexBuffer, bufferSize);
+        // Synthetic 1024x1024-quad grid: 6 corners per quad, ~1M unique vertices, ~6.3M corners
+        const uint32_t gridSize = 1024;
+        std::vector<Vertex> gridCorners;
+        gridCorners.reserve(size_t(gridSize) * gridSize * 6);
+        auto gridVertex = [gridSize](uint32_t x, uint32_t y) {
+            Vertex vertex{};
+            vertex.pos = {static_cast<float>(x), static_cast<float>(y), 0.0f};
+            vertex.color = {1.0f, 1.0f, 1.0f};
+            vertex.texCoord = {x / static_cast<float>(gridSize), y / static_cast<float>(gridSize)};
+            return vertex;
+        };
+        for (uint32_t y = 0; y < gridSize; y++) {
+            for (uint32_t x = 0; x < gridSize; x++) {
+                for (auto [dx, dy] : {std::pair{0, 0}, {1, 0}, {1, 1}, {1, 1}, {0, 1}, {0, 0}}) {
+                    gridCorners.push_back(gridVertex(x + dx, y + dy));
+                }
+            }
+        }
         
-        // Free staging buffer memory
-        vkDestroyBuffer(device, stagingBuffer, nullptr);
-        vkFreeMemory(device, stagingBufferMemory, nullptr);
+        for (const std::vector<Vertex>* corners : {&modelCorners, const_cast<const std::vector<Vertex>*>(&gridCorners)}) {
+            std::vector<Vertex> mapVertices, weldVertices, parallelVertices;
+            std::vector<uint32_t> mapIndices, weldIndices, parallelIndices;
+            
+            double mapMs = timeMs([&]() {
+                std::unordered_map<Vertex, uint32_t> uniqueVertices;
+                for (const Vertex& vertex : *corners) {
+                    if (!uniqueVertices.contains(vertex)) {
+                        uniqueVertices[vertex] = static_cast<uint32_t>(mapVertices.size());
+                        mapVertices.push_back(vertex);
+                    }
+                    mapIndices.push_back(uniqueVertices[vertex]);
+                }
+            });
+            double weldMs = timeMs([&]() { VertexWelder().weld(*corners, weldVertices, weldIndices, false); });
+            double parallelMs = timeMs([&]() { VertexWelder().weldParallel(*corners, parallelVertices, parallelIndices); });
+            
+            bool identical = mapIndices == weldIndices && mapIndices == parallelIndices && mapVertices.size() == weldVertices.size() && mapVertices.size() == parallelVertices.size();
+            std::cout << "Vertex welding, " << corners->size() << " corners -> " << weldVertices.size() << " vertices: "
+                      << "unordered_map " << mapMs << " ms, welder " << weldMs << " ms, parallel welder " << parallelMs << " ms"
+                      << (identical ? "" : " (OUTPUT MISMATCH)") << std::endl;
+        }
     }
-    void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory) {
-        // Create buffer
-        VkBufferCreateInfo bufferInfo{};
-        bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-        bufferInfo.size = size;
-        bufferInfo.usage = usage;
+    bool loadMeshCache(const std::string& filename, uint64_t sourceHash, uint64_t sourceSize) {
+        // Memory-map the cache and take the final vertex and index arrays straight from it
+        // - Returns false (caller falls back to parsing) if the cache is missing, stale, or was written with a different layout
+        
+        MappedFile cacheFile;
+        if (!cacheFile.open(filename) || cacheFile.size < sizeof(MeshCacheHeader))
+            return false;
+        
+        MeshCacheHeader header;
+        memcpy(&header, cacheFile.data, sizeof(header));
+        if (header.magic != MESH_CACHE_MAGIC || header.version != MESH_CACHE_VERSION
+            || header.vertexStride != sizeof(Vertex) || header.indexStride != sizeof(uint32_t) || header.optimized != OPTIMIZE_MESH
+            || header.sourceHash != sourceHash || header.sourceSize != sourceSize) {
+            std::cout << "Mesh cache is stale, rebuilding." << std::endl;
+            return false;
+        }
         
-        if (SEPARATE_TRANSFER_QUEUE_FAMILY) {
-            QueueFamilyIndices queueFamilies = findQueueFamilies(physicalDevice);
-            std::array<uint32_t, 2> queueFamilyIndices = {queueFamilies.graphicsFamily.value(), queueFamilies.transferFamily.value()};
-
-            bufferInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
-            bufferInfo.queueFamilyIndexCount = static_cast<uint32_t>(queueFamilyIndices.size());
-            bufferInfo.pQueueFamilyIndices = queueFamilyIndices.data();
-        } else {
-            bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE; // Exclusive access by graphics queue
+        size_t vertexBytes = header.vertexCount * sizeof(Vertex);
+        size_t indexBytes = header.indexCount * sizeof(uint32_t);
+        if (cacheFile.size != sizeof(MeshCacheHeader) + vertexBytes + indexBytes) {
+            std::cout << "Mesh cache is truncated, rebuilding." << std::endl;
+            return false;
         }
         
-        if (vkCreateBuffer(device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS) {
-            throw std::runtime_error("Failed to create vertex buffer!");
+        // One bulk copy per array; pages are faulted in directly from the page cache with no parsing
+        const uint8_t* vertexData = cacheFile.data + sizeof(MeshCacheHeader);
+        vertices.resize(header.vertexCount);
+        memcpy(vertices.data(), vertexData, vertexBytes);
+        indices.resize(header.indexCount);
+        memcpy(indices.data(), vertexData + vertexBytes, indexBytes);
+        
+        return true;
+    }
+    void writeMeshCache(const std::string& filename, uint64_t sourceHash, uint64_t sourceSize) {
+        // Write to a temporary file and rename it over the cache, so a crash mid-write never leaves a corrupt cache behind
+        
+        MeshCacheHeader header{};
+        header.magic = MESH_CACHE_MAGIC;
+        header.version = MESH_CACHE_VERSION;
+        header.sourceHash = sourceHash;
+        header.sourceSize = sourceSize;
+        header.vertexStride = sizeof(Vertex);
+        header.indexStride = sizeof(uint32_t);
+        header.optimized = OPTIMIZE_MESH;
+        header.vertexCount = vertices.size();
+        header.indexCount = indices.size();
+        
+        std::string tempFilename = filename + ".tmp";
+        std::ofstream file(tempFilename, std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) {
+            std::cerr << "Failed to write mesh cache " << filename << std::endl; // Not fatal; next start parses the OBJ again
+            return;
+        }
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(vertices.data()), vertices.size() * sizeof(Vertex));
+        file.write(reinterpret_cast<const char*>(indices.data()), indices.size() * sizeof(uint32_t));
+        file.close();
+        
+        if (!file || std::rename(tempFilename.c_str(), filename.c_str()) != 0) {
+            std::cerr << "Failed to write mesh cache " << filename << std::endl;
+            std::remove(tempFilename.c_str());
         }
+    }
+    
+    // ================ optimizeMesh() ================
+    void optimizeMesh() {
+        // Optional stage of loadModel() between parseObj() and writeMeshCache(), so it only runs when the cache is cold; order matters:
+        // 1. Vertex cache (triangle order), 2. overdraw (cluster order on top of 1), 3. vertex fetch (vertex order follows final triangle order)
+        if (!OPTIMIZE_MESH)
+            return;
         
-        // Allocate memory for the buffer
-        VkMemoryRequirements memoryRequirements;
-        vkGetBufferMemoryRequirements(device, buffer, &memoryRequirements);
+        auto startTime = std::chrono::high_resolution_clock::now();
+        VertexCacheStatistics before = analyzeVertexCache(indices, vertices.size());
         
-        VkMemoryAllocateInfo allocateInfo{};
-        allocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-        allocateInfo.allocationSize = memoryRequirements.size;
-        allocateInfo.memoryTypeIndex = findMemoryType(memoryRequirements.memoryTypeBits, properties);
+        optimizeVertexCache(indices, vertices.size());
+        VertexCacheStatistics afterCache = analyzeVertexCache(indices, vertices.size());
+        optimizeOverdraw(indices, vertices);
+        optimizeVertexFetch(vertices, indices);
+        VertexCacheStatistics after = analyzeVertexCache(indices, vertices.size());
+        
+        auto endTime = std::chrono::high_resolution_clock::now();
+        std::cout << "Optimized mesh in " << std::chrono::duration<double, std::milli>(endTime - startTime).count() << " ms: "
+                  << "ACMR " << before.acmr << " -> " << afterCache.acmr << " (cache) -> " << after.acmr << " (overdraw), "
+                  << "ATVR " << before.atvr << " -> " << after.atvr << std::endl;
+    }
+    
+    // ================ generateLods() ================
+    void generateLods() {
+        // Simplify the optimized index buffer into successively coarser levels; they share the model's vertices, so only
+        // indices are added. Each level is simplified from the previous one, so errors accumulate down the chain
+        // - Not stored in the mesh cache (see writeMeshCache()); regenerated on every load
+        meshLods.clear();
+        if (!GENERATE_LODS || indices.empty())
+            return;
         
-        // Realistically, should combine buffers and call this on groups of buffers (i.e., objects) so that the maxMemoryAllocationCount physical device limit isn't reached
-        // - Can use VulkanMemoryAllocator library for this
-        if (vkAllocateMemory(device, &allocateInfo, nullptr, &bufferMemory) != VK_SUCCESS) {
-            throw std::runtime_error("Failed to allocate vertex buffer memory!");
+        auto startTime = std::chrono::high_resolution_clock::now();
+        MeshSimplifier simplifier(vertices, indices);
+        size_t previousCount = indices.size();
+        for (uint32_t level = 1; level < MAX_MESH_LODS; level++) {
+            size_t targetCount = static_cast<size_t>(previousCount / 3 * LOD_TRIANGLE_RATIO) * 3;
+            const std::vector<uint32_t>& simplified = simplifier.simplify(targetCount, LOD_MAX_ERROR);
+            // Stop once the error limit (or locked borders and seams) keeps a level from getting meaningfully smaller
+            if (simplified.empty() || simplified.size() > previousCount * 9 / 10)
+                break;
+            meshLods.push_back({simplified, simplifier.error()});
+            optimizeVertexCache(meshLods.back().indices, vertices.size());
+            previousCount = simplified.size();
         }
         
-        // Bind the allocated memory to the buffer
-        vkBindBufferMemory(device, buffer, bufferMemory, 0);
+        auto endTime = std::chrono::high_resolution_clock::now();
+        float meshSize = glm::length(meshBounds.max - meshBounds.min);
+        std::cout << "Generated " << meshLods.size() << " LODs in " << std::chrono::duration<double, std::milli>(endTime - startTime).count() << " ms:" << std::endl;
+        std::cout << "  LOD 0: " << indices.size() / 3 << " triangles" << std::endl;
+        for (size_t level = 0; level < meshLods.size(); level++) {
+            std::cout << "  LOD " << level + 1 << ": " << meshLods[level].indices.size() / 3 << " triangles ("
+                      << 100.0 * meshLods[level].indices.size() / indices.size() << "%), error " << meshLods[level].error
+                      << " (" << 100.0f * meshLods[level].error / std::max(meshSize, 1e-20f) << "% of extent)" << std::endl;
+        }
     }
-    uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) {
-        // Look into this!
+    
+    // ================ selectMeshFormats() ================
+    void selectMeshFormats() {
+        // Per-mesh choice of vertex layout and index type, made once the final vertex count is known
+        indexType = vertices.size() < 65536 ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+        
+        // CompactVertex drops color, so only use it when every vertex has the constant color the compact shader variant assumes
+        useCompactVertices = COMPACT_VERTICES && !vertices.empty();
+        for (const Vertex& vertex : vertices) {
+            if (vertex.color != glm::vec3(1.0f)) {
+                useCompactVertices = false;
+                break;
+            }
+        }
+        // The compact shader variant is built separately by compile.sh
+        struct stat shaderStat;
+        if (useCompactVertices && stat((SOURCE_PATH + "shaders/vert_compact.spv").c_str(), &shaderStat) != 0) {
+            std::cout << "shaders/vert_compact.spv not found (run compile.sh), using full vertex format" << std::endl;
+            useCompactVertices = false;
+        }
         
-        VkPhysicalDeviceMemoryProperties memoryProperties;
-        vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+        if (useCompactVertices) {
+            glm::vec3 minPosition = vertices[0].pos;
+            glm::vec3 maxPosition = vertices[0].pos;
+            for (const Vertex& vertex : vertices) {
+                minPosition = glm::min(minPosition, vertex.pos);
+                maxPosition = glm::max(maxPosition, vertex.pos);
+            }
+            glm::vec3 extent = maxPosition - minPosition;
+            meshDequantization.positionScale = glm::vec4(extent, 0.0f);
+            meshDequantization.positionOffset = glm::vec4(minPosition, 1.0f);
+            
+            compactVertices.resize(vertices.size());
+            for (size_t i = 0; i < vertices.size(); i++) {
+                for (int axis = 0; axis < 3; axis++) {
+                    float normalized = extent[axis] > 0.0f ? (vertices[i].pos[axis] - minPosition[axis]) / extent[axis] : 0.0f;
+                    compactVertices[i].pos[axis] = static_cast<uint16_t>(std::lround(std::clamp(normalized, 0.0f, 1.0f) * 65535.0f));
+                }
+                compactVertices[i].pos[3] = 0;
+                compactVertices[i].texCoord[0] = floatToHalf(vertices[i].texCoord.x);
+                compactVertices[i].texCoord[1] = floatToHalf(vertices[i].texCoord.y);
+            }
+        } else {
+            compactVertices.clear();
+            meshDequantization.positionScale = glm::vec4(1.0f, 1.0f, 1.0f, 0.0f);
+            meshDequantization.positionOffset = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+        }
         
-        for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
-            if (typeFilter & (1 << i) && (memoryProperties.memoryTypes[i].propertyFlags & properties)) {
-                return i;
+        size_t vertexStride = useCompactVertices ? sizeof(CompactVertex) : sizeof(Vertex);
+        size_t indexStride = indexType == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t);
+        std::cout << "Mesh formats: " << (useCompactVertices ? "compact" : "full") << " vertices (" << vertexStride << " B), "
+                  << indexStride * 8 << "-bit indices, "
+                  << (vertices.size() * vertexStride + indices.size() * indexStride) / 1024 << " KiB (was "
+                  << (vertices.size() * sizeof(Vertex) + indices.size() * sizeof(uint32_t)) / 1024 << " KiB)" << std::endl;
+    }
+    
+    // ================ createScene() ================
+    void createScene() {
+        // Entities are only created here and with each mesh's object (plus temporarily by benchmarkCommandRecording());
+        // removeMesh() releases an object's entity for reuse. Updating the scene each frame never allocates
+        // - The grid gets an entity per instance up front, for the largest grid drawn; setInstanceGrid() attaches the
+        //   ones in use to the grid's instances
+        scene.init(SCENE_CAPACITY, MAX_FRAMES_IN_FLIGHT);
+        turntable = scene.create();
+        uint32_t gridRoot = scene.create();
+        gridEntityCount = std::max(*std::max_element(INSTANCE_GRID_COUNTS.begin(), INSTANCE_GRID_COUNTS.end()),
+                                   BENCHMARK_INSTANCING ? *std::max_element(INSTANCE_BENCHMARK_COUNTS.begin(), INSTANCE_BENCHMARK_COUNTS.end()) : 0u);
+        gridFirstEntity = scene.size();
+        for (uint32_t i = 0; i < gridEntityCount; i++) {
+            scene.create(gridRoot);
+        }
+        viewMatrix = glm::lookAt(glm::vec3(2.0f, 2.0f, 2.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+        
+        if (BENCHMARK_SCENE_UPDATE) {
+            benchmarkSceneUpdate();
+        }
+    }
+    void benchmarkSceneUpdate() {
+        // SceneGraph::update() time for a root with 100 groups of leaves, each leaf an instance
+        // - Instances are written to CPU memory here rather than to a mapped (write-combined) buffer
+        const uint32_t count = SCENE_BENCHMARK_ENTITY_COUNT;
+        const uint32_t groupCount = 100;
+        SceneGraph benchmarkScene;
+        benchmarkScene.init(count, 1);
+        FrustumCuller culler;
+        culler.init(count);
+        std::vector<InstanceData> instanceData(count);
+        uint32_t root = benchmarkScene.create();
+        std::vector<uint32_t> groups;
+        for (uint32_t group = 0; group < groupCount; group++) {
+            groups.push_back(benchmarkScene.create(root, glm::vec3(float(group), 0.0f, 0.0f)));
+        }
+        Aabb leafBounds{glm::vec3(-0.5f), glm::vec3(0.5f)};
+        for (uint32_t i = 0; benchmarkScene.size() < count; i++) {
+            uint32_t leaf = benchmarkScene.create(groups[i % groupCount], glm::vec3(0.0f, float(i / groupCount), 0.0f), SceneGraph::rotation(0.001f * i, glm::vec3(0.0f, 0.0f, 1.0f)), glm::vec3(0.5f));
+            benchmarkScene.attachInstance(leaf, i, leafBounds);
+        }
+        uint32_t firstLeaf = 1 + groupCount;
+        
+        const int iterations = 20;
+        auto time = [&](auto&& change) {
+            double seconds = 0.0;
+            for (int i = 0; i <= iterations; i++) {
+                change(i);
+                auto start = std::chrono::high_resolution_clock::now();
+                benchmarkScene.update(0, instanceData.data(), &culler);
+                if (i > 0) { // The first update is a warm-up
+                    seconds += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+                }
+            }
+            return seconds / iterations;
+        };
+        auto report = [&](const char* name, double seconds) {
+            SceneGraph::Statistics statistics = benchmarkScene.statistics();
+            std::cout << "  " << name << ": " << statistics.lastWorldUpdates << " world matrices, " << statistics.lastInstanceWrites << " instances in "
+                      << 1000.0 * seconds << " ms (" << statistics.lastWorldUpdates / 1e6 / std::max(seconds, 1e-9) << " M entities/s)" << std::endl;
+        };
+        std::cout << "Scene update benchmark (" << count << " entities, " << SceneGraph::instructionSet() << "):" << std::endl;
+        report("Every leaf rotated", time([&](int i) {
+            for (uint32_t leaf = firstLeaf; leaf < count; leaf++) {
+                benchmarkScene.setRotation(leaf, SceneGraph::rotation(0.01f * i + 0.001f * leaf, glm::vec3(0.0f, 0.0f, 1.0f)));
             }
+        }));
+        report("Root moved", time([&](int i) { benchmarkScene.setPosition(root, glm::vec3(0.0f, 0.0f, 0.01f * i)); }));
+        report("One group moved", time([&](int i) { benchmarkScene.setPosition(groups[groupCount / 2], glm::vec3(float(groupCount / 2), 0.0f, 0.01f * i)); }));
+        report("Unchanged", time([](int) {}));
+    }
+    
+    // ================ createGeometryBuffers() ================
+    void createGeometryBuffers() {
+        // Create/allocate the shared vertex and index buffers - local to GPU
+        // - Can't map, but can transfer (copy) data into them; meshes are sub-allocated with addMesh()
+        // - Vertex layout and index type are the ones selectMeshFormats() chose (the pipeline's vertex input depends on them)
+        createBuffer(GEOMETRY_VERTEX_BUFFER_SIZE, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, MEMORY_USAGE_GPU_ONLY, vertexBuffer, vertexBufferAllocation);
+        createBuffer(GEOMETRY_INDEX_BUFFER_SIZE, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, MEMORY_USAGE_GPU_ONLY, indexBuffer, indexBufferAllocation);
+        uint32_t vertexStride = useCompactVertices ? sizeof(CompactVertex) : sizeof(Vertex);
+        geometry.init(vertexBuffer, GEOMETRY_VERTEX_BUFFER_SIZE, vertexStride, indexBuffer, GEOMETRY_INDEX_BUFFER_SIZE, indexType);
+        
+        // The loaded model
+        const void* vertexData = useCompactVertices ? static_cast<const void*>(compactVertices.data()) : static_cast<const void*>(vertices.data());
+        meshes.push_back(addMesh(vertexData, static_cast<uint32_t>(vertices.size()), indices, meshLods, meshDequantization, meshBounds));
+        objects.push_back({meshes.back(), scene.create(turntable)});
+        
+        if (VERIFY_MESH_REMOVAL && vertices.size() >= 6) {
+            verifyMeshRemoval(vertexData);
+        }
+    }
+    void verifyMeshRemoval(const void* vertexData) {
+        // Add two small meshes (the model's first vertices) as objects and remove them again, the first one first so its
+        // ranges are freed as a gap; once both frees have run, the geometry buffer's free ranges must have coalesced back to
+        // where they started and the objects' scene entities must have been released
+        // - Nothing has been drawn yet, so the deferred frees are run as soon as the device is idle
+        // - The meshes' copies are submitted and waited for first: freed ranges must not be handed to a later mesh while
+        //   stale copies into them are still recorded in the upload batch
+        GeometryBuffer::Statistics before = geometry.statistics();
+        SceneGraph::Statistics sceneBefore = scene.statistics();
+        std::vector<GeometryBuffer::Mesh> added;
+        for (uint32_t vertexCount : {3u, 6u}) {
+            std::vector<uint32_t> meshIndices(vertexCount);
+            std::iota(meshIndices.begin(), meshIndices.end(), 0u);
+            added.push_back(addMesh(vertexData, vertexCount, meshIndices, {}, meshDequantization, meshBounds));
+            objects.push_back({added.back(), scene.create(turntable)});
+        }
+        uploadBatcher.wait(uploadBatcher.flush());
+        for (const GeometryBuffer::Mesh& mesh : added) {
+            removeMesh(mesh);
+        }
+        vkDeviceWaitIdle(device);
+        runDeferredDestroys(UINT64_MAX);
+        
+        GeometryBuffer::Statistics after = geometry.statistics();
+        SceneGraph::Statistics sceneAfter = scene.statistics();
+        if (after.meshCount != before.meshCount || after.usedVertices != before.usedVertices || after.usedIndices != before.usedIndices
+            || after.freeRangeCount != before.freeRangeCount || after.largestFreeVertexRange != before.largestFreeVertexRange
+            || after.largestFreeIndexRange != before.largestFreeIndexRange) {
+            throw std::runtime_error("Geometry buffer free ranges didn't coalesce after removing meshes!");
+        }
+        if (sceneAfter.entityCount - sceneAfter.freeEntities != sceneBefore.entityCount - sceneBefore.freeEntities) {
+            throw std::runtime_error("Scene entities of removed meshes weren't released!");
         }
-        throw std::runtime_error("Failed to find suitable memory type!");
+        std::cout << "Mesh removal check: " << added.size() << " meshes added and removed, " << after.freeRangeCount << " free ranges" << std::endl;
     }
-    void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size) {
-        // Execute the copy using a command buffer
+    GeometryBuffer::Mesh addMesh(const void* vertexData, uint32_t vertexCount, const std::vector<uint32_t>& meshIndices, const std::vector<MeshLod>& lods, const MeshDequantization& dequantization, const Aabb& bounds) {
+        // Sub-allocate ranges in the shared buffers and record their uploads into the current upload batch
+        // - vertexData is in the geometry buffer's vertex layout; indices are relative to the mesh's first vertex
+        // - lods are the coarser levels of meshIndices (at most MAX_MESH_LODS - 1); their indices follow level 0's in the same range
+        size_t lodCount = std::min<size_t>(lods.size() + 1, MAX_MESH_LODS);
+        std::vector<uint32_t> lodIndices;
+        if (lodCount > 1) {
+            lodIndices = meshIndices;
+            for (size_t level = 1; level < lodCount; level++) {
+                lodIndices.insert(lodIndices.end(), lods[level - 1].indices.begin(), lods[level - 1].indices.end());
+            }
+        }
+        const std::vector<uint32_t>& allIndices = lodCount > 1 ? lodIndices : meshIndices;
         
-        // 1. Allocate and begin recording command buffer
-        VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+        GeometryBuffer::Mesh mesh;
+        if (!geometry.allocate(vertexCount, static_cast<uint32_t>(allIndices.size()), mesh)) {
+            throw std::runtime_error("Geometry buffer is full!");
+        }
+        mesh.dequantization = dequantization;
+        mesh.bounds = bounds;
+        mesh.lods[0].indexCount = static_cast<uint32_t>(meshIndices.size()); // allocate() set level 0 to the whole range
+        for (size_t level = 1; level < lodCount; level++) {
+            const GeometryBuffer::Lod& previous = mesh.lods[level - 1];
+            mesh.lods[level] = {previous.firstIndex + previous.indexCount, static_cast<uint32_t>(lods[level - 1].indices.size()), lods[level - 1].error};
+        }
+        mesh.lodCount = static_cast<uint32_t>(lodCount);
         
-        // 2. Record command buffer
-        // Copy buffer region to buffer region
-        VkBufferCopy copyRegion{};
-        copyRegion.srcOffset = 0;
-        copyRegion.dstOffset = 0;
-        copyRegion.size = size;
-        vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
+        // Copy through the staging ring (CPU) to the vertex and index buffers (GPU)
+        // - Can also fill the vertex buffer directly if HOST_COHERENT_BIT and HOST_VISIBLE_BIT were set on it. The HOST_COHERENT_BIT ensures allocated memory in memory heap matches the mapped memory (i.e., there are no delays due to caching). Can use VkFlushMappedMemoryRanges and VkInvalidateMappedMemoryRanges to control transfer to GPU. Otherwise, transfer to GPU occurs in the background and specification guarantees that this is completed as of the next VkQueueSubmit call.
+        uploadBuffer(vertexData, vertexBuffer, geometry.vertexOffset(mesh), geometry.vertexSize(mesh), VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT);
         
-        // 3. End recording command buffer, submit, then free it
-        endSingleTimeCommands(commandBuffer);
+        // Narrow to 16-bit indices when the geometry buffer uses them
+        std::vector<uint16_t> indices16;
+        if (geometry.getIndexType() == VK_INDEX_TYPE_UINT16) {
+            indices16.assign(allIndices.begin(), allIndices.end());
+        }
+        const void* indexData = geometry.getIndexType() == VK_INDEX_TYPE_UINT16 ? static_cast<const void*>(indices16.data()) : static_cast<const void*>(allIndices.data());
+        uploadBuffer(indexData, indexBuffer, geometry.indexOffset(mesh), geometry.indexSize(mesh), VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_INDEX_READ_BIT);
+        return mesh;
     }
-    
-    // ================ createIndexBuffer() ================
-    void createIndexBuffer() {
-        VkDeviceSize bufferSize = sizeof(indices[0]) * indices.size();
+    void removeMesh(const GeometryBuffer::Mesh& mesh) {
+        // Frames in flight may still draw the mesh, so its ranges return to the free lists once they have completed
+        // - The objects' entities are released right away: world matrices are only read while recording
+        for (const RenderObject& object : objects) {
+            if (object.mesh.firstVertex == mesh.firstVertex && object.mesh.firstIndex == mesh.firstIndex) {
+                scene.destroy(object.entity);
+            }
+        }
+        objects.erase(std::remove_if(objects.begin(), objects.end(), [&mesh](const RenderObject& object) {
+            return object.mesh.firstVertex == mesh.firstVertex && object.mesh.firstIndex == mesh.firstIndex;
+        }), objects.end());
+        meshes.erase(std::remove_if(meshes.begin(), meshes.end(), [&mesh](const GeometryBuffer::Mesh& other) {
+            return other.firstVertex == mesh.firstVertex && other.firstIndex == mesh.firstIndex;
+        }), meshes.end());
+        deferDestroy([this, mesh] { geometry.free(mesh); });
+    }
+    void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, const MemoryUsage& memoryUsage, VkBuffer& buffer, Allocation& bufferAllocation) {
+        // Create buffer
+        VkBufferCreateInfo bufferInfo{};
+        bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bufferInfo.size = size;
+        bufferInfo.usage = usage;
+        
+        bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE; // Owned by one queue family at a time; uploads transfer ownership to graphics (see UploadBatcher)
         
-        // Create/allocate the staging buffer - on CPU
-        VkBuffer stagingBuffer;
-        VkDeviceMemory stagingBufferMemory;
-        createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+        if (vkCreateBuffer(device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to create vertex buffer!");
+        }
         
-        // Fill the staging buffer
-        // - Can also fill the index buffer directly if HOST_COHERENT_BIT and HOST_VISIBLE_BIT were set on it. The HOST_COHERENT_BIT ensures allocated memory in memory heap matches the mapped memory (i.e., there are no delays due to caching). Can use VkFlushMappedMemoryRanges and VkInvalidateMappedMemoryRanges to control transfer to GPU. Otherwise, transfer to GPU occurs in the background and specification guarantees that this is completed as of the next VkQueueSubmit call.
-        void* data;
-        vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);  // Temporarily map bufferMemory to data ptr. Can also use VK_WHOLE_SIZE?
-        memcpy(data, indices.data(), static_cast<size_t>(bufferSize));
-        vkUnmapMemory(device, stagingBufferMemory);
+        // Allocate memory for the buffer
+        VkMemoryRequirements memoryRequirements;
+        vkGetBufferMemoryRequirements(device, buffer, &memoryRequirements);
         
-        // Create/allocate index buffer - local to GPU
-        // - Can't map, but can transfer (copy) data into it
-        createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, indexBuffer, indexBufferMemory);
+        // Sub-allocated from a shared block, so the maxMemoryAllocationCount physical device limit isn't reached
+        bufferAllocation = allocator.allocate(memoryRequirements, memoryUsage, DeviceMemoryAllocator::Linear);
         
-        // Copy from staging buffer (CPU) to index buffer (GPU)
-        copyBuffer(stagingBuffer, indexBuffer, bufferSize);
+        // Bind the allocated memory to the buffer
+        vkBindBufferMemory(device, buffer, bufferAllocation.memory, bufferAllocation.offset);
+    }
+    void reportMemoryStatistics() {
+        // Allocator usage after initialization; fragmentation = share of free block memory outside the largest free range
+        DeviceMemoryAllocator::Statistics statistics = allocator.statistics();
+        auto megabytes = [](VkDeviceSize bytes) { return bytes / 1024.0 / 1024.0; };
+        std::cout << "Device memory: " << statistics.blockCount << " blocks (" << megabytes(statistics.blockBytes) << " MB) holding "
+                  << statistics.allocationCount << " allocations (" << megabytes(statistics.usedBytes) << " MB used, "
+                  << megabytes(statistics.roundedBytes - statistics.usedBytes) << " MB rounding, " << megabytes(statistics.freeBytes) << " MB free, "
+                  << (statistics.freeBytes ? 100.0 * (1.0 - double(statistics.largestFreeRange) / statistics.freeBytes) : 0.0) << "% fragmented), "
+                  << statistics.dedicatedCount << " dedicated (" << megabytes(statistics.dedicatedBytes) << " MB), "
+                  << statistics.deviceAllocationCalls << " vkAllocateMemory calls, " << statistics.budgetFallbacks << " budget fallbacks" << std::endl;
+        for (size_t heap = 0; heap < statistics.heaps.size(); heap++) {
+            const auto& budget = statistics.heaps[heap];
+            std::cout << "  Heap " << heap << (budget.deviceLocal ? " (device local)" : "") << ": " << megabytes(budget.usage)
+                      << " / " << megabytes(budget.budget) << " MB budget" << (memoryBudgetExtSupported ? "" : " (estimated)") << std::endl;
+        }
+        StagingRing::Statistics staging = stagingRing.statistics();
+        std::cout << "Staging ring: " << megabytes(staging.size) << " MB, " << megabytes(staging.uploadedBytes) << " MB uploaded in "
+                  << staging.allocationCount << " regions / " << staging.submissionCount << " submissions, peak "
+                  << megabytes(staging.peakUsage) << " MB, " << staging.waitCount << " waits for space" << std::endl;
+        GeometryBuffer::Statistics geometryStatistics = geometry.statistics();
+        std::cout << "Geometry buffers: " << geometryStatistics.meshCount << " meshes, " << geometryStatistics.usedVertices << " / "
+                  << geometryStatistics.vertexCapacity << " vertices, " << geometryStatistics.usedIndices << " / " << geometryStatistics.indexCapacity
+                  << " indices, largest gaps " << geometryStatistics.largestFreeVertexRange << " vertices / " << geometryStatistics.largestFreeIndexRange
+                  << " indices (" << geometryStatistics.freeRangeCount << " free ranges)" << std::endl;
+        InstanceBuffer::Statistics instanceStatistics = instances.statistics();
+        std::cout << "Instances: " << instanceStatistics.usedInstances << " / " << instanceStatistics.capacity << " ("
+                  << megabytes(instances.frameSize()) << " MB per frame in flight)" << std::endl;
+        UploadBatcher::Statistics uploads = uploadBatcher.statistics();
+        std::cout << "Uploads: " << uploads.batchCount << " batches, " << uploads.submissionCount << " submissions, "
+                  << uploads.stagingFlushes << " early flushes" << (timelineSemaphoreSupported ? "" : " (no timeline semaphores, waited idle)") << std::endl;
+    }
+    void uploadBuffer(const void* data, VkBuffer dstBuffer, VkDeviceSize dstOffset, VkDeviceSize size, VkPipelineStageFlags dstStage, VkAccessFlags dstAccess) {
+        // Stage data in the ring and record copies into the upload batch, in chunks of up to half the ring so large buffers don't need it all at once
+        for (VkDeviceSize offset = 0; offset < size; ) {
+            VkDeviceSize chunkSize = std::min(size - offset, STAGING_RING_SIZE / 2);
+            StagingRing::Region stagingRegion = uploadBatcher.stage(chunkSize, 16);
+            memcpy(stagingRegion.data, static_cast<const uint8_t*>(data) + offset, static_cast<size_t>(chunkSize));
+            
+            // Copy buffer region to buffer region
+            VkBufferCopy copyRegion{};
+            copyRegion.srcOffset = stagingRegion.offset;
+            copyRegion.dstOffset = dstOffset + offset;
+            copyRegion.size = chunkSize;
+            vkCmdCopyBuffer(uploadBatcher.transferCommands(), stagingRing.buffer(), dstBuffer, 1, &copyRegion);
+            offset += chunkSize;
+        }
         
-        // Free staging buffer memory
-        vkDestroyBuffer(device, stagingBuffer, nullptr);
-        vkFreeMemory(device, stagingBufferMemory, nullptr);
+        // Hand the written range to the graphics queue for its first use (dstStage/dstAccess)
+        uploadBatcher.releaseBuffer(dstBuffer, dstOffset, size, dstStage, dstAccess);
     }
     
     // ================ createCommandBuffer() ================
@@ -1816,13 +7878,148 @@ private:
         VkDeviceSize bufferSize = sizeof(UniformBufferObject);
         
         uniformBuffers.resize(MAX_FRAMES_IN_FLIGHT);
-        uniformBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
+        uniformBuffersAllocations.resize(MAX_FRAMES_IN_FLIGHT);
         uniformBuffersMapped.resize(MAX_FRAMES_IN_FLIGHT); // Pointers; written to on each frame
         
         for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-            createBuffer(bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, uniformBuffers[i], uniformBuffersMemory[i]);
+            createBuffer(bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, MEMORY_USAGE_DYNAMIC, uniformBuffers[i], uniformBuffersAllocations[i]);
             
-            vkMapMemory(device, uniformBuffersMemory[i], 0, bufferSize, 0, &uniformBuffersMapped[i]); // "Persistent" mapping
+            uniformBuffersMapped[i] = uniformBuffersAllocations[i].mapped; // "Persistent" mapping (of the allocator's block)
+        }
+        
+        // Per-draw uniforms: one ring segment per frame in flight, bound with dynamic offsets
+        VkPhysicalDeviceProperties properties{};
+        vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+        createBuffer(DRAW_UNIFORM_RING_SIZE * MAX_FRAMES_IN_FLIGHT, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, MEMORY_USAGE_DYNAMIC, drawUniformBuffer, drawUniformBufferAllocation);
+        drawUniforms.init(drawUniformBuffer, drawUniformBufferAllocation.mapped, DRAW_UNIFORM_RING_SIZE, properties.limits.minUniformBufferOffsetAlignment);
+    }
+    void createInstanceBuffer() {
+        // Per-instance transforms: one copy per frame in flight, written in place by InstanceBuffer::sync() and SceneGraph::update() (no staging or transfer queue)
+        // - Host visible, preferably device local; only instances changed since a frame's copy was last written are copied
+        createBuffer(VkDeviceSize(INSTANCE_CAPACITY) * sizeof(InstanceData) * MAX_FRAMES_IN_FLIGHT, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, MEMORY_USAGE_DYNAMIC,
+                     instanceStorageBuffer, instanceStorageBufferAllocation);
+        instances.init(instanceStorageBuffer, instanceStorageBufferAllocation.mapped, INSTANCE_CAPACITY, MAX_FRAMES_IN_FLIGHT);
+        instanceCuller.init(INSTANCE_CAPACITY);
+        
+        // Draw lists: the visible InstanceBuffer indices of each frame, rewritten by cullObjects()
+        createBuffer(VkDeviceSize(INSTANCE_CAPACITY) * sizeof(uint32_t) * MAX_FRAMES_IN_FLIGHT, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, MEMORY_USAGE_DYNAMIC,
+                     drawListBuffer, drawListBufferAllocation);
+        
+        if (BENCHMARK_FRUSTUM_CULLING) {
+            benchmarkFrustumCulling();
+        }
+    }
+    void createGpuDrivenBuffers() {
+        // Per frame in flight, so a frame's culling never touches buffers an earlier frame may still be drawing with
+        // - GpuObjects are written by the CPU, and the counts are read back by it (host visible); the rest is only touched by the GPU
+        // - Without GPU-driven support the frames only carry their (idle) readback state, and no buffers are created
+        gpuDrivenFrames.resize(MAX_FRAMES_IN_FLIGHT);
+        if (!gpuDrivenSupported)
+            return;
+        for (GpuDrivenFrame& gpuFrame : gpuDrivenFrames) {
+            createBuffer(VkDeviceSize(MAX_GPU_DRAWS) * sizeof(GpuObject), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, MEMORY_USAGE_DYNAMIC,
+                         gpuFrame.objectBuffer, gpuFrame.objectAllocation);
+            createBuffer(VkDeviceSize(INSTANCE_CAPACITY) * MAX_MESH_LODS * 2 * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, MEMORY_USAGE_GPU_ONLY,
+                         gpuFrame.drawListBuffer, gpuFrame.drawListAllocation);
+            createBuffer(VkDeviceSize(MAX_GPU_DRAWS) * MAX_MESH_LODS * sizeof(VkDrawIndexedIndirectCommand), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+                         MEMORY_USAGE_GPU_ONLY, gpuFrame.indirectBuffer, gpuFrame.indirectAllocation);
+            createBuffer(VkDeviceSize(1 + MAX_GPU_DRAWS * MAX_MESH_LODS) * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                         MEMORY_USAGE_DYNAMIC, gpuFrame.countBuffer, gpuFrame.countAllocation);
+        }
+    }
+    void benchmarkFrustumCulling() {
+        // FrustumCuller throughput (million boxes per millisecond) on random boxes around the default camera's view, against a scalar Frustum::intersects() loop
+        const uint32_t count = 1 << 22;
+        FrustumCuller culler;
+        culler.init(count);
+        uint32_t seed = 12345;
+        auto random = [&seed]() { // [-1, 1)
+            seed = seed * 1664525u + 1013904223u;
+            return (seed >> 8) / float(1 << 23) - 1.0f;
+        };
+        std::vector<Aabb> boxes(count);
+        for (uint32_t i = 0; i < count; i++) {
+            glm::vec3 center(6.0f * random(), 6.0f * random(), 6.0f * random());
+            glm::vec3 extent = glm::vec3(0.05f) + 0.05f * glm::abs(glm::vec3(random(), random(), random()));
+            boxes[i] = {center - extent, center + extent};
+            culler.setBounds(i, boxes[i]);
+        }
+        glm::mat4 view = glm::lookAt(glm::vec3(2.0f, 2.0f, 2.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+        glm::mat4 proj = glm::perspective(glm::radians(45.0f), WIDTH / (float) HEIGHT, 0.1f, 10.0f);
+        Frustum frustum = Frustum::fromMatrix(proj * view);
+        std::vector<uint32_t> visible(count);
+        
+        const int iterations = 10;
+        auto millionPerMs = [count](double seconds) { return count / 1e6 / (seconds * 1000.0); };
+        auto time = [&](auto&& body) {
+            body(); // Warm up
+            auto start = std::chrono::high_resolution_clock::now();
+            for (int i = 0; i < iterations; i++) {
+                body();
+            }
+            return std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count() / iterations;
+        };
+        uint32_t scalarVisible = 0, serialVisible = 0, parallelVisible = 0;
+        double scalarSeconds = time([&]() {
+            scalarVisible = 0;
+            for (uint32_t i = 0; i < count; i++) {
+                if (frustum.intersects(boxes[i]))
+                    visible[scalarVisible++] = i;
+            }
+        });
+        double serialSeconds = time([&]() { serialVisible = culler.cull(frustum, 0, count, visible.data(), false); });
+        double parallelSeconds = time([&]() { parallelVisible = culler.cull(frustum, 0, count, visible.data()); });
+        std::cout << "Frustum culling " << count << " boxes (" << 100.0 * (count - parallelVisible) / count << "% culled): scalar AoS "
+                  << millionPerMs(scalarSeconds) << ", " << FrustumCuller::instructionSet() << " " << millionPerMs(serialSeconds) << ", "
+                  << FrustumCuller::instructionSet() << " x " << std::max(1u, std::thread::hardware_concurrency()) << " threads "
+                  << millionPerMs(parallelSeconds) << " M boxes/ms" << (scalarVisible == serialVisible && serialVisible == parallelVisible ? "" : " (results differ!)") << std::endl;
+    }
+    void setInstanceGrid(uint32_t count) {
+        // Draw the loaded model as count instances on a square grid over its original footprint (count = 0: the single model)
+        if (objects.empty())
+            return;
+        RenderObject& object = objects.front();
+        if (object.firstInstance != InstanceBuffer::IDENTITY) {
+            for (uint32_t i = 0; i < object.instanceCount; i++) {
+                scene.detachInstance(gridFirstEntity + i);
+            }
+            instances.free(object.firstInstance, object.instanceCount);
+        }
+        object.firstInstance = InstanceBuffer::IDENTITY;
+        object.instanceCount = 1;
+        instanceGridSide = 0;
+        instanceUpdateCursor = 0;
+        if (count == 0)
+            return;
+        if (count > gridEntityCount) {
+            throw std::runtime_error("Instance grid has more instances than entities!");
+        }
+        
+        uint32_t firstInstance = instances.allocate(count);
+        if (firstInstance == RangeAllocator::INVALID) {
+            throw std::runtime_error("Instance buffer is full!");
+        }
+        // The scene writes each instance's transform and bounds (for the CPU culler and the GPU) on its next update()
+        instanceGridSide = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<double>(count))));
+        float spacing = 2.0f / instanceGridSide;
+        for (uint32_t i = 0; i < count; i++) {
+            glm::vec3 position((i % instanceGridSide + 0.5f) * spacing - 1.0f, (i / instanceGridSide + 0.5f) * spacing - 1.0f, 0.0f);
+            scene.setTransform(gridFirstEntity + i, position, SceneGraph::rotation(0.0f, glm::vec3(0.0f, 0.0f, 1.0f)), glm::vec3(0.8f * spacing));
+            scene.attachInstance(gridFirstEntity + i, firstInstance + i, object.mesh.bounds);
+        }
+        object.firstInstance = firstInstance;
+        object.instanceCount = count;
+    }
+    void animateInstances(float time) {
+        // Re-orient a window of the grid each frame, so only INSTANCE_UPDATES_PER_FRAME instances are copied per frame
+        if (objects.empty() || objects.front().firstInstance == InstanceBuffer::IDENTITY)
+            return;
+        const RenderObject& object = objects.front();
+        uint32_t updates = std::min(INSTANCE_UPDATES_PER_FRAME, object.instanceCount);
+        for (uint32_t n = 0; n < updates; n++) {
+            uint32_t i = instanceUpdateCursor;
+            scene.setRotation(gridFirstEntity + i, SceneGraph::rotation(time + 0.001f * i, glm::vec3(0.0f, 0.0f, 1.0f)));
+            instanceUpdateCursor = (instanceUpdateCursor + 1) % object.instanceCount;
         }
     }
     
@@ -1830,17 +8027,21 @@ private:
         // Contains descriptor sets
         // Used for uniform buffers, image samplers, etc.
         
-        std::array<VkDescriptorPoolSize, 2> poolSizes{};
+        std::array<VkDescriptorPoolSize, 4> poolSizes{};
         poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
         poolSizes[0].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT); // Depending on driver, may allow allocation beyond this count. Should use Best Practices Validation to avoid exceeding this limit!
         poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
         poolSizes[1].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT); // Depending on driver, may allow allocation beyond this count. Should use Best Practices Validation to avoid exceeding this limit!
+        poolSizes[2].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+        poolSizes[2].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+        poolSizes[3].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        poolSizes[3].descriptorCount = static_cast<uint32_t>(9 * MAX_FRAMES_IN_FLIGHT); // 4 in the graphics set, 5 in the culling set
         
         VkDescriptorPoolCreateInfo poolInfo{};
         poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
         poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
         poolInfo.pPoolSizes = poolSizes.data();
-        poolInfo.maxSets = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+        poolInfo.maxSets = static_cast<uint32_t>(2 * MAX_FRAMES_IN_FLIGHT); // Graphics and culling set per frame
         
         if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool) != VK_SUCCESS) {
             throw std::runtime_error("Failed to create descriptor pool!");
@@ -1877,8 +8078,37 @@ private:
             imageInfo.imageView = textureImageView;
             imageInfo.sampler = textureSampler;
             
+            // Per-draw uniform data; the offset into the ring is given when binding
+            VkDescriptorBufferInfo drawUniformsInfo{};
+            drawUniformsInfo.buffer = drawUniforms.buffer();
+            drawUniformsInfo.offset = 0;
+            drawUniformsInfo.range = sizeof(DrawUniforms);
+            
+            // Frame i's copy of the instance data
+            VkDescriptorBufferInfo instancesInfo{};
+            instancesInfo.buffer = instances.buffer();
+            instancesInfo.offset = instances.frameOffset(static_cast<uint32_t>(i));
+            instancesInfo.range = instances.frameSize();
+            
+            // Frame i's draw list
+            VkDescriptorBufferInfo drawListInfo{};
+            drawListInfo.buffer = drawListBuffer;
+            drawListInfo.offset = i * VkDeviceSize(INSTANCE_CAPACITY) * sizeof(uint32_t);
+            drawListInfo.range = VkDeviceSize(INSTANCE_CAPACITY) * sizeof(uint32_t);
+            
+            // Frame i's GPU-driven per-object data and draw list
+            // - Only read by GPU_DRIVEN pipelines; without GPU-driven support they have no buffers, so the CPU draw list stands in
+            VkDescriptorBufferInfo gpuObjectsInfo{};
+            gpuObjectsInfo.buffer = gpuDrivenSupported ? gpuDrivenFrames[i].objectBuffer : drawListBuffer;
+            gpuObjectsInfo.offset = 0;
+            gpuObjectsInfo.range = VK_WHOLE_SIZE;
+            VkDescriptorBufferInfo gpuDrawListInfo{};
+            gpuDrawListInfo.buffer = gpuDrivenSupported ? gpuDrivenFrames[i].drawListBuffer : drawListBuffer;
+            gpuDrawListInfo.offset = 0;
+            gpuDrawListInfo.range = VK_WHOLE_SIZE;
+            
             // Update descriptor set i
-            std::array<VkWriteDescriptorSet, 2> descriptorWrites{};
+            std::array<VkWriteDescriptorSet, 7> descriptorWrites{};
             // Uniform buffer descriptor info
             descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
             descriptorWrites[0].dstSet = descriptorSets[i];
@@ -1899,9 +8129,100 @@ private:
             descriptorWrites[1].pBufferInfo = nullptr;
             descriptorWrites[1].pImageInfo = &imageInfo; // For descriptors that refer to image data
             descriptorWrites[1].pTexelBufferView = nullptr; // For descriptors that refer to buffer views
+            // Per-draw uniform buffer descriptor info
+            descriptorWrites[2].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            descriptorWrites[2].dstSet = descriptorSets[i];
+            descriptorWrites[2].dstBinding = 2;
+            descriptorWrites[2].dstArrayElement = 0;
+            descriptorWrites[2].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+            descriptorWrites[2].descriptorCount = 1;
+            descriptorWrites[2].pBufferInfo = &drawUniformsInfo;
+            // Instance storage buffer descriptor info
+            descriptorWrites[3].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            descriptorWrites[3].dstSet = descriptorSets[i];
+            descriptorWrites[3].dstBinding = 3;
+            descriptorWrites[3].dstArrayElement = 0;
+            descriptorWrites[3].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            descriptorWrites[3].descriptorCount = 1;
+            descriptorWrites[3].pBufferInfo = &instancesInfo;
+            // Draw list storage buffer descriptor info
+            descriptorWrites[4].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            descriptorWrites[4].dstSet = descriptorSets[i];
+            descriptorWrites[4].dstBinding = 4;
+            descriptorWrites[4].dstArrayElement = 0;
+            descriptorWrites[4].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            descriptorWrites[4].descriptorCount = 1;
+            descriptorWrites[4].pBufferInfo = &drawListInfo;
+            // GPU-driven storage buffer descriptor infos
+            descriptorWrites[5] = descriptorWrites[4];
+            descriptorWrites[5].dstBinding = 5;
+            descriptorWrites[5].pBufferInfo = &gpuObjectsInfo;
+            descriptorWrites[6] = descriptorWrites[4];
+            descriptorWrites[6].dstBinding = 6;
+            descriptorWrites[6].pBufferInfo = &gpuDrawListInfo;
             
             vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr); // Can also use to copy descriptors to each other
         }
+        
+        createCullDescriptorSets();
+    }
+    void createCullDescriptorSets() {
+        // One culling set per frame, over that frame's GPU-driven buffers and its copy of the instances
+        if (!gpuDrivenSupported)
+            return;
+        std::vector<VkDescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT, cullDescriptorSetLayout);
+        VkDescriptorSetAllocateInfo allocateInfo{};
+        allocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocateInfo.descriptorPool = descriptorPool;
+        allocateInfo.descriptorSetCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+        allocateInfo.pSetLayouts = layouts.data();
+        
+        std::vector<VkDescriptorSet> sets(MAX_FRAMES_IN_FLIGHT);
+        if (vkAllocateDescriptorSets(device, &allocateInfo, sets.data()) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to allocate culling descriptor sets!");
+        }
+        
+        for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+            GpuDrivenFrame& gpuFrame = gpuDrivenFrames[i];
+            gpuFrame.cullDescriptorSet = sets[i];
+            
+            // Bindings 0-4 of cull.comp
+            std::array<VkDescriptorBufferInfo, 5> bufferInfos{};
+            bufferInfos[0] = {gpuFrame.objectBuffer, 0, VK_WHOLE_SIZE};
+            bufferInfos[1] = {instances.buffer(), instances.frameOffset(i), instances.frameSize()};
+            bufferInfos[2] = {gpuFrame.countBuffer, 0, VK_WHOLE_SIZE};
+            bufferInfos[3] = {gpuFrame.drawListBuffer, 0, VK_WHOLE_SIZE};
+            bufferInfos[4] = {gpuFrame.indirectBuffer, 0, VK_WHOLE_SIZE};
+            
+            std::array<VkWriteDescriptorSet, 5> descriptorWrites{};
+            for (uint32_t binding = 0; binding < descriptorWrites.size(); binding++) {
+                descriptorWrites[binding].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+                descriptorWrites[binding].dstSet = gpuFrame.cullDescriptorSet;
+                descriptorWrites[binding].dstBinding = binding;
+                descriptorWrites[binding].dstArrayElement = 0;
+                descriptorWrites[binding].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+                descriptorWrites[binding].descriptorCount = 1;
+                descriptorWrites[binding].pBufferInfo = &bufferInfos[binding];
+            }
+            vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+        }
+    }
+    void updateTextureDescriptor(size_t frame) {
+        // Point a frame's descriptor set at the current texture image view (the set must not be in use)
+        VkDescriptorImageInfo imageInfo{};
+        imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        imageInfo.imageView = textureImageView;
+        imageInfo.sampler = textureSampler;
+        
+        VkWriteDescriptorSet descriptorWrite{};
+        descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrite.dstSet = descriptorSets[frame];
+        descriptorWrite.dstBinding = 1;
+        descriptorWrite.dstArrayElement = 0;
+        descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        descriptorWrite.descriptorCount = 1;
+        descriptorWrite.pImageInfo = &imageInfo;
+        vkUpdateDescriptorSets(device, 1, &descriptorWrite, 0, nullptr);
     }
     
     // ================ createCommandBuffers() ================
@@ -1955,6 +8276,15 @@ private:
         // 1. Wait for previous frame to finish (when previous command buffer finishes execution)
         vkWaitForFences(device, 1, &inFlightFences[currentFrame], VK_TRUE, UINT64_MAX); // Blocks
         
+        // ~. Destroy resources retired MAX_FRAMES_IN_FLIGHT frames ago, and progress texture streaming
+        runDeferredDestroys(frameNumber);
+        readGpuCullingResults(currentFrame);
+        if (frameNumber == transientAttachmentsReportFrame) {
+            reportTransientAttachments();
+        }
+        updateTextureStreaming();
+        uploadBatcher.flush();
+        
         // 2. Acquire an image from the swap chain
         uint32_t imageIndex;
         VkResult result = vkAcquireNextImageKHR(device, swapchain, UINT64_MAX, imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
@@ -1970,23 +8300,44 @@ private:
         
         // ~. Update uniform buffer
         updateUniformBuffer(currentFrame);
+        instances.sync(currentFrame); // This frame's copy of the instances changed since it was last drawn
+        scene.update(currentFrame, instances.frameData(currentFrame), &instanceCuller); // Object model matrices, and the grid's instances straight into this frame's copy
+        // Cull on the GPU once its pipeline permutation is ready, otherwise on the CPU
+        PipelineKey gpuDrivenKey = pipelineKey;
+        gpuDrivenKey.gpuDriven = true;
+        frameGpuDriven = gpuDrivenSupported && gpuDrivenEnabled && pipelineLibrary.get(gpuDrivenKey) != VK_NULL_HANDLE;
+        cullObjects(currentFrame);
         // Note that the image sampler doesn't get updated each frame
         
         // 3. Record a command buffer to draw the scene onto that image
         vkResetCommandBuffer(graphicsCommandBuffers[currentFrame], 0);
+        auto recordingStart = std::chrono::high_resolution_clock::now();
         recordCommandBuffer(graphicsCommandBuffers[currentFrame], imageIndex);
+        recordingSeconds += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - recordingStart).count();
         
         // 4. Submit the recorded command buffer
         VkSubmitInfo submitInfo{};
         submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
         
-        VkSemaphore waitSemaphores[] = {imageAvailableSemaphores[currentFrame]};
+        std::vector<VkSemaphore> waitSemaphores = {imageAvailableSemaphores[currentFrame]};
         // GPU must wait to write colors to the image until it is available, but is allowed to execute other pipeline stages anytime
         // Can also include VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT instead of creating a subpass source dependency on the swap chain image as done currently in createRenderPass()
-        VkPipelineStageFlags waitStages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
-        submitInfo.waitSemaphoreCount = 1;
-        submitInfo.pWaitSemaphores = waitSemaphores;
-        submitInfo.pWaitDstStageMask = waitStages;
+        std::vector<VkPipelineStageFlags> waitStages = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
+        // Upload batches submitted since the last frame: wait on their timeline value (binary semaphores ignore their values)
+        VkTimelineSemaphoreSubmitInfoKHR timelineInfo{};
+        std::vector<uint64_t> waitValues = {0};
+        if (uint64_t uploadValue = uploadBatcher.frameWaitValue()) {
+            waitSemaphores.push_back(uploadBatcher.timelineSemaphore());
+            waitStages.push_back(VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+            waitValues.push_back(uploadValue);
+            timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+            timelineInfo.waitSemaphoreValueCount = static_cast<uint32_t>(waitValues.size());
+            timelineInfo.pWaitSemaphoreValues = waitValues.data();
+            submitInfo.pNext = &timelineInfo;
+        }
+        submitInfo.waitSemaphoreCount = static_cast<uint32_t>(waitSemaphores.size());
+        submitInfo.pWaitSemaphores = waitSemaphores.data();
+        submitInfo.pWaitDstStageMask = waitStages.data();
         
         submitInfo.commandBufferCount = 1;
         submitInfo.pCommandBuffers = &graphicsCommandBuffers[currentFrame];
@@ -2017,15 +8368,21 @@ private:
         presentInfo.pResults = nullptr; // Allows you to check presentation result of each swap chain
         
         result = vkQueuePresentKHR(presentQueue, &presentInfo);
-        if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || framebufferResized) {
+        bool resized = framebufferResized;
+        framebufferResized = false;
+        if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || (resized && swapchainExtentChanged())) {
             // Some platforms don't trigger VK_ERROR_OUT_OF_DATE_KHR after window resize
             // Therefore, need to also explicitly check based on GLFW's callback
             recreateSwapchain();
-            framebufferResized = false;
         } else if (result != VK_SUCCESS) {
             throw std::runtime_error("Failed to present swap chain image!");
         }
         
+        if (frameNumber == 0) {
+            std::cout << "First frame after " << std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count()
+                      << " ms (texture mip levels " << residentMipLevel << "-" << mipLevels - 1 << " resident)" << std::endl;
+        }
+        frameNumber++;
         currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
     }
     void recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex) {
@@ -2039,6 +8396,10 @@ private:
             throw std::runtime_error("Failed to begin recording command buffer!");
         }
         
+        if (frameGpuDriven) {
+            recordGpuCulling(commandBuffer);
+        }
+        
         // Begin render pass
         VkRenderPassBeginInfo renderPassBeginInfo{};
         renderPassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
@@ -2054,10 +8415,75 @@ private:
         renderPassBeginInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
         renderPassBeginInfo.pClearValues = clearValues.data(); // Used for VK_ATTACHMENT_LOAD_OP_CLEAR of the framebuffer's color and depth attachments
         
-        vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE); // Embed render pass commands in primary command buffer without executing any secondary command buffers
-        
         // Graphics
-        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
+        // Never wait for a permutation that is still compiling; draw with the default one meanwhile
+        PipelineKey key = pipelineKey;
+        key.gpuDriven = frameGpuDriven; // Only set once its permutation is ready (see drawFrame())
+        VkPipeline pipeline = pipelineLibrary.get(key);
+        if (pipeline == VK_NULL_HANDLE) {
+            pipeline = pipelineLibrary.get(STARTUP_PIPELINES[0]);
+        }
+        
+        // Draw!
+        // - Each mesh is a range of the shared buffers, selected with firstIndex/vertexOffset
+        // - Per-draw data: the model matrix in push constants, the rest in the dynamic uniform ring; the frame's one
+        //   descriptor set is rebound with the draw's dynamic offset, so no descriptor set is allocated or written per draw
+        drawUniforms.beginFrame(currentFrame);
+        if (frameGpuDriven) {
+            // - GPU-driven: one call for the whole scene; the draws and their count were written by cull.comp, and
+            //   shader.vert reads each instance's object from the GpuObjects. The push constants and dynamic offset are
+            //   only set because the pipeline layout requires them
+            vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE); // Embed render pass commands in primary command buffer without executing any secondary command buffers
+            bindDrawState(commandBuffer, pipeline);
+            const GpuDrivenFrame& gpuFrame = gpuDrivenFrames[currentFrame];
+            DrawPushConstants pushConstants{};
+            vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(DrawPushConstants), &pushConstants);
+            uint32_t drawUniformsOffset = drawUniforms.push(DrawUniforms{glm::vec4(1.0f)});
+            vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSets[currentFrame], 1, &drawUniformsOffset);
+            cmdDrawIndexedIndirectCount(commandBuffer, gpuFrame.indirectBuffer, 0, gpuFrame.countBuffer, 0, gpuFrame.objectCount * MAX_MESH_LODS, sizeof(VkDrawIndexedIndirectCommand));
+        } else {
+            // - Only objects with visible instances are drawn, and only those instances (see cullObjects())
+            drawUniformOffsets.resize(visibleDraws.size());
+            for (size_t i = 0; i < visibleDraws.size(); i++) {
+                drawUniformOffsets[i] = drawUniforms.push(DrawUniforms{visibleDraws[i].object->tint});
+            }
+            uint32_t threadCount = 1;
+            if (parallelRecordingEnabled) {
+                threadCount = std::min({commandRecorder.threadCount(), recordingThreadLimit, static_cast<uint32_t>(visibleDraws.size() / MIN_DRAWS_PER_RECORDING_THREAD)});
+            }
+            if (threadCount >= 2) {
+                // - Parallel: contiguous ranges of draws are recorded into secondary command buffers on the recorder's
+                //   threads; they inherit the render pass but no state, so each binds the pipeline and buffers itself
+                vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS); // The subpass may only execute secondary command buffers
+                VkCommandBufferInheritanceInfo inheritanceInfo{};
+                inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+                inheritanceInfo.renderPass = renderPass;
+                inheritanceInfo.subpass = 0;
+                inheritanceInfo.framebuffer = swapchainFramebuffers[imageIndex]; // Optional, but lets the driver specialize the secondaries
+                const std::vector<VkCommandBuffer>& secondaries = commandRecorder.record(currentFrame, inheritanceInfo, visibleDraws.size(), threadCount,
+                    [this, pipeline](VkCommandBuffer secondary, size_t begin, size_t end) {
+                        bindDrawState(secondary, pipeline);
+                        recordDraws(secondary, begin, end);
+                    });
+                vkCmdExecuteCommands(commandBuffer, static_cast<uint32_t>(secondaries.size()), secondaries.data()); // In draw order
+            } else {
+                vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE); // Embed render pass commands in primary command buffer without executing any secondary command buffers
+                bindDrawState(commandBuffer, pipeline);
+                recordDraws(commandBuffer, 0, visibleDraws.size());
+            }
+        }
+        
+        // End render pass
+        vkCmdEndRenderPass(commandBuffer);
+        
+        // End command buffer
+        if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to end recording command buffer!");
+        }
+    }
+    void bindDrawState(VkCommandBuffer commandBuffer, VkPipeline pipeline) const {
+        // State every command buffer drawing the scene needs; secondary command buffers don't inherit it from the primary
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
         
         // Viewport and scissor
         if (DYNAMIC_VIEWPORT_SCISSOR) {
@@ -2076,24 +8502,18 @@ private:
             vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
         }
         
-        // Bind buffers
-        VkBuffer vertexBuffers[] = {vertexBuffer};
-        VkDeviceSize offsets[] = {0};
-        vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
-        
-        vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, VK_INDEX_TYPE_UINT32);
-        
-        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSets[currentFrame], 0, nullptr);
-        
-        // Draw!
-        vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(indices.size()), 1, 0, 0, 0); // Use vkCmdDraw for non-indexed drawing
-        
-        // End render pass
-        vkCmdEndRenderPass(commandBuffer);
-        
-        // End command buffer
-        if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
-            throw std::runtime_error("Failed to end recording command buffer!");
+        // Bind buffers (once for every mesh)
+        geometry.bind(commandBuffer);
+    }
+    void recordDraws(VkCommandBuffer commandBuffer, size_t begin, size_t end) const {
+        // Draws visibleDraws[begin, end); only reads shared state, so ranges can be recorded on several threads at once
+        for (size_t i = begin; i < end; i++) {
+            const VisibleDraw& draw = visibleDraws[i];
+            const RenderObject& object = *draw.object;
+            DrawPushConstants pushConstants{scene.worldMatrix(object.entity), object.mesh.dequantization};
+            vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(DrawPushConstants), &pushConstants);
+            vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSets[currentFrame], 1, &drawUniformOffsets[i]);
+            geometry.draw(commandBuffer, object.mesh, draw.firstInstance, draw.instanceCount, draw.lod); // Use vkCmdDraw for non-indexed drawing
         }
     }
     void updateUniformBuffer(uint32_t currentImage) {
@@ -2102,15 +8522,252 @@ private:
         auto currentTime = std::chrono::high_resolution_clock::now();
         float time = std::chrono::duration<float, std::chrono::seconds::period>(currentTime - startTime).count();
         
+        // Only marks entities dirty; drawFrame() updates the scene once this frame's instance copy is free
+        scene.setRotation(turntable, SceneGraph::rotation(time / 5.0f * glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f)));
+        animateInstances(time);
+        
         UniformBufferObject ubo{};
-        ubo.model = glm::rotate(glm::mat4(1.0f), time / 5.0f * glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-        ubo.view = glm::lookAt(glm::vec3(2.0f, 2.0f, 2.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+        ubo.view = viewMatrix;
         ubo.proj = glm::perspective(glm::radians(45.0f), swapchainExtent.width / (float) swapchainExtent.height, 0.1f, 10.0f);
         ubo.proj[1][1] *= -1;   // OpenGL's y clip coordinate is flipped?
+        viewProjection = ubo.proj * ubo.view;
+        lodPixelScale = std::abs(ubo.proj[1][1]) * 0.5f * static_cast<float>(swapchainExtent.height);
+        
+        memcpy(uniformBuffersMapped[currentImage], &ubo, sizeof(ubo));  // Per-view data only; per-object values go in push constants
+    }
+    void cullObjects(uint32_t frame) {
+        // Test every object's instances against the view frustum and write the visible ones to the frame's draw list
+        // - The frustum is taken from the object's full model-view-projection, so instance bounds stay in object space
+        //   (they don't change when the object's entity moves)
+        // - In the GPU-driven path only the objects are written here; cull.comp tests the instances (see recordGpuCulling())
+        if (frameGpuDriven) {
+            prepareGpuCulling(frame);
+            return;
+        }
+        auto startTime = std::chrono::high_resolution_clock::now();
+        uint32_t* drawList = static_cast<uint32_t*>(drawListBufferAllocation.mapped) + size_t(frame) * INSTANCE_CAPACITY;
+        uint32_t listSize = 0;
+        uint64_t tested = 0;
+        uint64_t triangles = 0;
+        uint64_t lodInstances[MAX_MESH_LODS] = {};
+        visibleDraws.clear();
+        for (const RenderObject& object : objects) {
+            if (listSize + object.instanceCount > INSTANCE_CAPACITY) {
+                throw std::runtime_error("Draw list is full!");
+            }
+            tested += object.instanceCount;
+            if (!lodEnabled || object.mesh.lodCount == 1) {
+                uint32_t visibleCount = cullObject(object, drawList + listSize);
+                if (visibleCount > 0) {
+                    visibleDraws.push_back({&object, listSize, visibleCount});
+                    listSize += visibleCount;
+                    triangles += uint64_t(visibleCount) * object.mesh.lods[0].indexCount / 3;
+                    lodInstances[0] += visibleCount;
+                }
+                continue;
+            }
+            
+            // Select each visible instance's level, then group the draw list by level (stable, so instance order is
+            // kept within a level) for one instanced draw per level
+            lodSortScratch.resize(INSTANCE_CAPACITY);
+            uint32_t visibleCount = cullObject(object, lodSortScratch.data());
+            if (visibleCount == 0)
+                continue;
+            instanceLods.resize(visibleCount);
+            LodSelection selection = LodSelection::create(viewMatrix * scene.worldMatrix(object.entity), lodPixelScale, object.mesh.bounds);
+            parallelFor(visibleCount, MIN_LOD_SELECTIONS_PER_THREAD, [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; i++) {
+                    uint32_t instance = lodSortScratch[i];
+                    if (instance == InstanceBuffer::IDENTITY) {
+                        instanceLods[i] = static_cast<uint8_t>(selection.select(object.mesh, object.mesh.bounds.min, object.mesh.bounds.max));
+                    } else {
+                        Aabb bounds = instanceCuller.bounds(instance);
+                        instanceLods[i] = static_cast<uint8_t>(selection.select(object.mesh, bounds.min, bounds.max));
+                    }
+                }
+            });
+            uint32_t levelStart[MAX_MESH_LODS + 1] = {};
+            for (uint32_t i = 0; i < visibleCount; i++) {
+                levelStart[instanceLods[i] + 1]++;
+            }
+            for (uint32_t level = 0; level < MAX_MESH_LODS; level++) {
+                uint32_t levelCount = levelStart[level + 1];
+                if (levelCount > 0) {
+                    visibleDraws.push_back({&object, listSize + levelStart[level], levelCount, level});
+                    triangles += uint64_t(levelCount) * object.mesh.lods[level].indexCount / 3;
+                    lodInstances[level] += levelCount;
+                }
+                levelStart[level + 1] += levelStart[level];
+            }
+            for (uint32_t i = 0; i < visibleCount; i++) {
+                drawList[listSize + levelStart[instanceLods[i]]++] = lodSortScratch[i];
+            }
+            listSize += visibleCount;
+        }
+        drawnTriangles += triangles;
         
-        memcpy(uniformBuffersMapped[currentImage], &ubo, sizeof(ubo));  // For frequently changing values, use push constants instead of a UBO this way
+        if (REPORT_CULLING) {
+            reportCulling(tested, listSize, triangles, lodInstances, std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count(), FrustumCuller::instructionSet());
+        }
+    }
+    uint32_t cullObject(const RenderObject& object, uint32_t* visible) {
+        // Writes the object's visible InstanceBuffer indices; returns how many
+        Frustum frustum = Frustum::fromMatrix(viewProjection * scene.worldMatrix(object.entity));
+        if (object.firstInstance == InstanceBuffer::IDENTITY) {
+            if (!frustum.intersects(object.mesh.bounds))
+                return 0;
+            visible[0] = InstanceBuffer::IDENTITY;
+            return 1;
+        }
+        return instanceCuller.cull(frustum, object.firstInstance, object.instanceCount, visible);
+    }
+    void prepareGpuCulling(uint32_t frame) {
+        // Write a GpuObject per object for cull.comp and shader.vert; each object reserves instanceCount draw list entries
+        // per level it can be drawn at
+        auto startTime = std::chrono::high_resolution_clock::now();
+        if (objects.size() > MAX_GPU_DRAWS) {
+            throw std::runtime_error("Too many objects for the GPU-driven path!");
+        }
+        GpuDrivenFrame& gpuFrame = gpuDrivenFrames[frame];
+        GpuObject* gpuObjects = static_cast<GpuObject*>(gpuFrame.objectAllocation.mapped);
+        uint32_t listSize = 0;
+        uint32_t maxInstanceCount = 0;
+        uint64_t tested = 0;
+        uint64_t expectedVisible = 0;
+        gpuFrame.lodTriangles.assign(objects.size() * MAX_MESH_LODS, 0);
+        for (size_t i = 0; i < objects.size(); i++) {
+            const RenderObject& object = objects[i];
+            uint32_t lodCount = lodEnabled ? object.mesh.lodCount : 1;
+            if (listSize + uint64_t(object.instanceCount) * lodCount > uint64_t(INSTANCE_CAPACITY) * MAX_MESH_LODS) {
+                throw std::runtime_error("Draw list is full!");
+            }
+            GpuObject gpuObject{};
+            gpuObject.model = scene.worldMatrix(object.entity);
+            gpuObject.dequantization = object.mesh.dequantization;
+            gpuObject.tint = object.tint;
+            Frustum frustum = Frustum::fromMatrix(viewProjection * gpuObject.model);
+            std::copy(std::begin(frustum.planes), std::end(frustum.planes), gpuObject.frustumPlanes);
+            gpuObject.boundsMin = glm::vec4(object.mesh.bounds.min, 0.0f);
+            gpuObject.boundsMax = glm::vec4(object.mesh.bounds.max, 0.0f);
+            gpuObject.firstInstance = object.firstInstance;
+            gpuObject.instanceCount = object.instanceCount;
+            gpuObject.drawListOffset = listSize;
+            gpuObject.vertexOffset = static_cast<int32_t>(object.mesh.firstVertex);
+            LodSelection selection = LodSelection::create(viewMatrix * gpuObject.model, lodPixelScale, object.mesh.bounds);
+            gpuObject.depthPlane = selection.depthPlane;
+            gpuObject.objectScale = selection.objectScale;
+            gpuObject.lodErrorScale = selection.errorScale;
+            gpuObject.lodCount = lodCount;
+            for (uint32_t level = 0; level < lodCount; level++) {
+                const GeometryBuffer::Lod& lod = object.mesh.lods[level];
+                gpuObject.lods[level] = glm::uvec4(lod.firstIndex, lod.indexCount, std::bit_cast<uint32_t>(lod.error), 0);
+                gpuFrame.lodTriangles[i * MAX_MESH_LODS + level] = lod.indexCount / 3;
+            }
+            gpuObjects[i] = gpuObject; // One write per object into the mapped (possibly write-combined) buffer
+            
+            if (VERIFY_GPU_CULLING) {
+                cullScratch.resize(INSTANCE_CAPACITY);
+                expectedVisible += cullObject(object, cullScratch.data());
+            }
+            listSize += object.instanceCount * lodCount;
+            tested += object.instanceCount;
+            maxInstanceCount = std::max(maxInstanceCount, object.instanceCount);
+        }
+        gpuFrame.objectCount = static_cast<uint32_t>(objects.size());
+        gpuFrame.maxInstanceCount = maxInstanceCount;
+        gpuFrame.testedInstances = tested;
+        gpuFrame.expectedVisible = expectedVisible;
+        gpuFrame.cpuSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count();
+        gpuFrame.pending = true;
+    }
+    void recordGpuCulling(VkCommandBuffer commandBuffer) {
+        // Cull on the GPU and build the indirect draws (outside the render pass)
+        // 1. Clear the draw count and the per-(object, level) visible counts
+        // 2. PASS = 0: one invocation per instance (x) of each object (y); visible instances select a level and are
+        //    appended to that level's region of the object's draw list entries
+        // 3. PASS = 1: one invocation per (object, level); levels with visible instances append a VkDrawIndexedIndirectCommand
+        const GpuDrivenFrame& gpuFrame = gpuDrivenFrames[currentFrame];
+        vkCmdFillBuffer(commandBuffer, gpuFrame.countBuffer, 0, VK_WHOLE_SIZE, 0);
+        
+        VkMemoryBarrier clearBarrier{};
+        clearBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        clearBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        clearBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &clearBarrier, 0, nullptr, 0, nullptr);
+        
+        const uint32_t workgroupSize = 64; // local_size_x in cull.comp
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipelineLayout, 0, 1, &gpuFrame.cullDescriptorSet, 0, nullptr);
+        vkCmdPushConstants(commandBuffer, cullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(uint32_t), &gpuFrame.objectCount);
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullInstancesPipeline);
+        vkCmdDispatch(commandBuffer, (gpuFrame.maxInstanceCount + workgroupSize - 1) / workgroupSize, gpuFrame.objectCount, 1);
+        
+        VkMemoryBarrier cullBarrier{};
+        cullBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        cullBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        cullBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &cullBarrier, 0, nullptr, 0, nullptr);
+        
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, buildDrawsPipeline);
+        vkCmdDispatch(commandBuffer, (gpuFrame.objectCount * MAX_MESH_LODS + workgroupSize - 1) / workgroupSize, 1, 1);
+        
+        // Draw list -> vertex shader, draws and count -> vkCmdDrawIndexedIndirectCount, counts -> readGpuCullingResults()
+        VkMemoryBarrier drawBarrier{};
+        drawBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        drawBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        drawBarrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_HOST_READ_BIT;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_HOST_BIT,
+                             0, 1, &drawBarrier, 0, nullptr, 0, nullptr);
+    }
+    void readGpuCullingResults(uint32_t frame) {
+        // Called once the frame's previous submission has completed, so its visible counts can be read back
+        GpuDrivenFrame& gpuFrame = gpuDrivenFrames[frame];
+        if (!gpuFrame.pending)
+            return;
+        gpuFrame.pending = false;
+        const uint32_t* counts = static_cast<const uint32_t*>(gpuFrame.countAllocation.mapped);
+        uint64_t visible = 0;
+        uint64_t triangles = 0;
+        uint64_t lodInstances[MAX_MESH_LODS] = {};
+        for (uint32_t i = 0; i < gpuFrame.objectCount * MAX_MESH_LODS; i++) {
+            visible += counts[1 + i];
+            triangles += uint64_t(counts[1 + i]) * gpuFrame.lodTriangles[i];
+            lodInstances[i % MAX_MESH_LODS] += counts[1 + i];
+        }
+        drawnTriangles += triangles;
+        if (VERIFY_GPU_CULLING && visible != gpuFrame.expectedVisible) {
+            std::cout << "GPU culling found " << visible << " visible instances, CPU culling " << gpuFrame.expectedVisible << std::endl;
+        }
+        if (REPORT_CULLING) {
+            reportCulling(gpuFrame.testedInstances, visible, triangles, lodInstances, gpuFrame.cpuSeconds, "GPU");
+        }
+    }
+    void reportCulling(uint64_t tested, uint64_t visible, uint64_t triangles, const uint64_t (&lodInstances)[MAX_MESH_LODS], double seconds, const char* method) {
+        // Accumulate per-frame culling counts and print their averages once per second
+        cullingReport.frames++;
+        cullingReport.testedInstances += tested;
+        cullingReport.visibleInstances += visible;
+        cullingReport.triangles += triangles;
+        for (uint32_t level = 0; level < MAX_MESH_LODS; level++) {
+            cullingReport.lodInstances[level] += lodInstances[level];
+        }
+        cullingReport.seconds += seconds;
+        auto now = std::chrono::high_resolution_clock::now();
+        if (now - cullingReport.start >= std::chrono::seconds(1)) {
+            double frames = cullingReport.frames;
+            double elapsed = std::chrono::duration<double>(now - cullingReport.start).count();
+            std::cout << "Culling: " << cullingReport.visibleInstances / frames << " / " << cullingReport.testedInstances / frames << " instances visible, "
+                      << (cullingReport.testedInstances - cullingReport.visibleInstances) / frames << " culled per frame in "
+                      << 1000.0 * cullingReport.seconds / frames << " ms CPU (" << method << ")" << std::endl;
+            std::cout << "  " << cullingReport.triangles / frames << " triangles/frame, " << cullingReport.triangles / elapsed / 1e9 << " G triangles/s; instances per LOD:";
+            for (uint32_t level = 0; level < MAX_MESH_LODS; level++) {
+                std::cout << " " << cullingReport.lodInstances[level] / frames;
+            }
+            std::cout << std::endl;
+            cullingReport = CullingReport{};
+        }
     }
     void recreateSwapchain() {
+        // Called by drawFrame(); doesn't wait for the device, so frames already submitted keep rendering with the old resources
         int iconified = glfwGetWindowAttrib(window, GLFW_ICONIFIED);
         int width, height;
         glfwGetWindowSize(window, &width, &height);
@@ -2120,16 +8777,56 @@ private:
             glfwGetWindowSize(window, &width, &height);
         }
         
-        vkDeviceWaitIdle(device);
-        
-        cleanupSwapchain();
+        // The new swapchain is created from the old one, which is retired along with everything sized to it
+        VkSwapchainKHR oldSwapchain = swapchain;
+        retireSwapchain();
         
-        createSwapchain();
+        createSwapchain(oldSwapchain);
         createSwapchainImageViews();
         createColorResources();
         createDepthResources();
         createFramebuffers();
     }
+    void retireSwapchain() {
+        // Hand the current swapchain, its image views and framebuffers, and the attachments to the deletion queue: they are
+        // destroyed once every frame in flight that may use them has completed (see deferDestroy())
+        struct RetiredSwapchain {
+            VkSwapchainKHR swapchain;
+            std::vector<VkImageView> imageViews;
+            std::vector<VkFramebuffer> framebuffers;
+            VkImage colorImage;
+            VkImageView colorImageView;
+            Allocation colorImageAllocation;
+            VkImage depthImage;
+            VkImageView depthImageView;
+            Allocation depthImageAllocation;
+        };
+        RetiredSwapchain retired{swapchain, swapchainImageViews, swapchainFramebuffers, colorImage, colorImageView, colorImageAllocation,
+                                 depthImage, depthImageView, depthImageAllocation};
+        deferDestroy([this, retired]() mutable {
+            vkDestroyImageView(device, retired.colorImageView, nullptr);
+            vkDestroyImage(device, retired.colorImage, nullptr);
+            allocator.free(retired.colorImageAllocation);
+            vkDestroyImageView(device, retired.depthImageView, nullptr);
+            vkDestroyImage(device, retired.depthImage, nullptr);
+            allocator.free(retired.depthImageAllocation);
+            for (VkFramebuffer framebuffer : retired.framebuffers) {
+                vkDestroyFramebuffer(device, framebuffer, nullptr);
+            }
+            for (VkImageView imageView : retired.imageViews) {
+                vkDestroyImageView(device, imageView, nullptr);
+            }
+            // Its presents were queued before the frames this waits for completed
+            vkDestroySwapchainKHR(device, retired.swapchain, nullptr);
+        });
+    }
+    bool swapchainExtentChanged() {
+        // Resize events are coalesced: however many arrived since the last frame, recreate only if the surface size differs
+        VkSurfaceCapabilitiesKHR capabilities;
+        vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physicalDevice, surface, &capabilities);
+        VkExtent2D extent = chooseSwapExtent(capabilities);
+        return extent.width != swapchainExtent.width || extent.height != swapchainExtent.height;
+    }
     
     static std::vector<char> readFile(const std::string& filename) {
         std::ifstream file(filename, std::ios::ate | std::ios::binary);
@@ -2149,7 +8846,20 @@ private:
     }
 };
 
-int main() {
+int main(int argc, char** argv) {
+    // Offline texture baking: FirstVulkanProgram --bake-texture <source image> <output .ktx2> [rgba8|bc1|bc7|bc]
+    if ((argc == 4 || argc == 5) && std::string(argv[1]) == "--bake-texture") {
+        const std::map<std::string, TextureEncoding> encodings = {
+            {"rgba8", TextureEncoding::Rgba8}, {"bc1", TextureEncoding::Bc1}, {"bc7", TextureEncoding::Bc7}, {"bc", TextureEncoding::BlockCompressed}
+        };
+        auto encoding = encodings.find(argc == 5 ? argv[4] : "rgba8");
+        if (encoding == encodings.end()) {
+            std::cerr << "Unknown texture encoding " << argv[4] << std::endl;
+            return EXIT_FAILURE;
+        }
+        return bakeTexture(argv[2], argv[3], encoding->second) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    
     HelloTriangleApplication app;
     
     try {
@@ -4,12 +4,22 @@ layout(binding = 1) uniform sampler2D texSampler;
 
 layout(location = 0) in vec3 fragColor;
 layout(location = 1) in vec2 fragTexCoord;
+layout(location = 2) flat in vec4 fragTint; // Per-draw tint, from the DrawUniforms or the GpuObject (see shader.vert)
 
 layout(location = 0) out vec4 outColor;
 
+// Pipeline permutation (see DebugView in main.cpp)
+layout(constant_id = 0) const int DEBUG_VIEW = 0;
+
 void main() {
 //    vec4 mixed = mix(vec4(fragColor, 1.0), texture(texSampler, 1.5 * fragTexCoord), 0.5);
 //    outColor = mixed;
     
-    outColor = texture(texSampler, fragTexCoord);
+    if (DEBUG_VIEW == 1) {
+        outColor = vec4(fragColor, 1.0);
+    } else if (DEBUG_VIEW == 2) {
+        outColor = vec4(fract(fragTexCoord), 0.0, 1.0);
+    } else {
+        outColor = texture(texSampler, fragTexCoord) * fragTint;
+    }
 }
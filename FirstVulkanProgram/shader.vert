@@ -2,21 +2,110 @@
 
 //layout(binding = 0) uniform UniformBufferObject {
 layout(set = 0, binding = 0) uniform UniformBufferObject {
-    vec2 foo;
-    mat4 model;
     mat4 view;
     mat4 proj;
 } ubo;
 
+// Per-draw: model matrix, and CompactVertex dequantization: position = offset + unorm * scale (identity for the full Vertex layout)
+layout(push_constant) uniform DrawPushConstants {
+    mat4 model;
+    vec4 positionScale;
+    vec4 positionOffset;
+} mesh;
+
+// Per-draw, bound at a dynamic offset
+layout(set = 0, binding = 2) uniform DrawUniforms {
+    vec4 tint;
+} draw;
+
+// Per-instance transforms and bounds (instance 0 is the identity)
+struct InstanceData {
+    mat4 model;
+    vec4 boundsMin;
+    vec4 boundsMax;
+};
+layout(std430, set = 0, binding = 3) readonly buffer InstanceBuffer {
+    InstanceData data[];
+} instances;
+
+// Visible instances of the frame (written by frustum culling); draws index it with gl_InstanceIndex
+layout(std430, set = 0, binding = 4) readonly buffer DrawList {
+    uint instanceIndices[];
+} drawList;
+
+// GPU-driven path: per-draw data comes from the objects instead of the push constants and DrawUniforms
+// - GpuObject matches main.cpp
+struct GpuObject {
+    mat4 model;
+    vec4 positionScale;
+    vec4 positionOffset;
+    vec4 tint;
+    vec4 frustumPlanes[6];
+    vec4 boundsMin;
+    vec4 boundsMax;
+    vec4 depthPlane;
+    float objectScale;
+    float lodErrorScale;
+    uint lodCount;
+    int vertexOffset;
+    uint firstInstance;
+    uint instanceCount;
+    uint drawListOffset;
+    uint padding;
+    uvec4 lods[6]; // MAX_MESH_LODS
+};
+layout(std430, set = 0, binding = 5) readonly buffer GpuObjects {
+    GpuObject objects[];
+} gpuObjects;
+
+// Visible (instance, object) pairs written by cull.comp; each indirect draw's firstInstance is its object's offset
+layout(std430, set = 0, binding = 6) readonly buffer GpuDrawList {
+    uvec2 entries[];
+} gpuDrawList;
+
+// Pipeline permutation (see PipelineKey in main.cpp)
+layout(constant_id = 1) const bool GPU_DRIVEN = false;
+
+#ifdef COMPACT_VERTEX
+layout(location = 0) in vec4 inPosition; // R16G16B16A16_UNORM relative to the mesh AABB
+layout(location = 2) in vec2 inTexCoord; // R16G16_SFLOAT
+#else
 layout(location = 0) in vec3 inPosition;
 layout(location = 1) in vec3 inColor;
 layout(location = 2) in vec2 inTexCoord;
+#endif
 
 layout(location = 0) out vec3 fragColor;
 layout(location = 1) out vec2 fragTexCoord;
+layout(location = 2) flat out vec4 fragTint;
 
 void main() {
-    gl_Position = ubo.proj * ubo.view * ubo.model * vec4(inPosition, 1.0);
+    mat4 model;
+    mat4 instanceModel;
+    vec4 positionScale;
+    vec4 positionOffset;
+    if (GPU_DRIVEN) {
+        uvec2 entry = gpuDrawList.entries[gl_InstanceIndex];
+        GpuObject object = gpuObjects.objects[entry.y];
+        model = object.model;
+        instanceModel = instances.data[entry.x].model;
+        positionScale = object.positionScale;
+        positionOffset = object.positionOffset;
+        fragTint = object.tint;
+    } else {
+        model = mesh.model;
+        instanceModel = instances.data[drawList.instanceIndices[gl_InstanceIndex]].model;
+        positionScale = mesh.positionScale;
+        positionOffset = mesh.positionOffset;
+        fragTint = draw.tint;
+    }
+#ifdef COMPACT_VERTEX
+    vec3 position = positionOffset.xyz + inPosition.xyz * positionScale.xyz;
+    fragColor = vec3(1.0); // Compact meshes have constant white vertex color
+#else
+    vec3 position = inPosition;
     fragColor = inColor;
+#endif
+    gl_Position = ubo.proj * ubo.view * model * instanceModel * vec4(position, 1.0);
     fragTexCoord = inTexCoord;
 }